@@ -24,6 +24,10 @@ public:
 		return Rect3i(center - extents, 2 * extents);
 	}
 
+	static inline Rect3i from_min_max(Vector3i p_min, Vector3i p_max) {
+		return Rect3i(p_min, p_max - p_min);
+	}
+
 	static inline Rect3i get_bounding_box(Rect3i a, Rect3i b) {
 
 		Rect3i box;
@@ -42,6 +46,41 @@ public:
 		return box;
 	}
 
+	// A box is empty if it has no volume, which is also how "nothing" is represented
+	bool inline is_empty() const {
+		return size.x <= 0 || size.y <= 0 || size.z <= 0;
+	}
+
+	// Grows the box so it also encloses the other one. Empty boxes are ignored.
+	void merge_with(const Rect3i &other) {
+		if (other.is_empty()) {
+			return;
+		}
+		if (is_empty()) {
+			*this = other;
+			return;
+		}
+		*this = get_bounding_box(*this, other);
+	}
+
+	// Returns the part of this box which is inside the other one. May be empty.
+	Rect3i clipped(const Rect3i &other) const {
+		Vector3i end = pos + size;
+		Vector3i other_end = other.pos + other.size;
+		Rect3i box;
+		box.pos.x = MAX(pos.x, other.pos.x);
+		box.pos.y = MAX(pos.y, other.pos.y);
+		box.pos.z = MAX(pos.z, other.pos.z);
+		box.size.x = MAX(MIN(end.x, other_end.x) - box.pos.x, 0);
+		box.size.y = MAX(MIN(end.y, other_end.y) - box.pos.y, 0);
+		box.size.z = MAX(MIN(end.z, other_end.z) - box.pos.z, 0);
+		return box;
+	}
+
+	Rect3i padded(int margin) const {
+		return Rect3i(pos - Vector3i(margin), size + Vector3i(2 * margin));
+	}
+
 	bool inline contains(Vector3i p_pos) const {
 		Vector3i end = pos + size;
 		return p_pos.x >= pos.x &&
@@ -52,6 +91,41 @@ public:
 			   p_pos.z < end.z;
 	}
 
+	// Calls `action(Rect3i)` with up to 6 non-overlapping boxes covering the part of this box outside of `b`.
+	// When a box moves by a small amount, this is a lot cheaper than testing every cell of their bounds.
+	template <typename A>
+	void difference(const Rect3i &b, A action) const {
+		if (is_empty()) {
+			return;
+		}
+		const Rect3i inter = clipped(b);
+		if (inter.is_empty()) {
+			action(*this);
+			return;
+		}
+
+		Vector3i a_min = pos;
+		Vector3i a_max = pos + size;
+		Vector3i b_min = inter.pos;
+		Vector3i b_max = inter.pos + inter.size;
+
+		// Cut slabs on each axis, then shrink the remaining part to the intersection on that axis
+		for (unsigned int axis = 0; axis < 3; ++axis) {
+			if (a_min[axis] < b_min[axis]) {
+				Vector3i slab_max = a_max;
+				slab_max[axis] = b_min[axis];
+				action(from_min_max(a_min, slab_max));
+				a_min[axis] = b_min[axis];
+			}
+			if (a_max[axis] > b_max[axis]) {
+				Vector3i slab_min = a_min;
+				slab_min[axis] = b_max[axis];
+				action(from_min_max(slab_min, a_max));
+				a_max[axis] = b_max[axis];
+			}
+		}
+	}
+
 	String to_string() const {
 		return String("(o:{0}, s:{1})").format(varray(pos.to_vec3(), size.to_vec3()));
 	}
@@ -73,6 +147,10 @@ public:
 	}
 };
 
+inline bool operator==(const Rect3i &a, const Rect3i &b) {
+	return a.pos == b.pos && a.size == b.size;
+}
+
 inline bool operator!=(const Rect3i &a, const Rect3i &b) {
 	return a.pos != b.pos || a.size != b.size;
 }
@@ -101,7 +101,12 @@ void VoxelMesherBlocky::build(VoxelMesher::Output &output, const VoxelBuffer &bu
 	// That means we can use raw pointers to voxel data inside instead of using the higher-level getters,
 	// and then save a lot of time.
 
-	uint8_t *type_buffer = buffer.get_channel_raw(channel);
+	ERR_FAIL_COND(buffer.get_channel_compression(channel) == VoxelBuffer::COMPRESSION_PALETTE_RLE ||
+				  buffer.get_channel_compression(channel) == VoxelBuffer::COMPRESSION_BRICKS);
+	// Voxel IDs are 8-bit
+	ERR_FAIL_COND(buffer.get_channel_format(channel) != VoxelBuffer::FORMAT_U8);
+
+	uint8_t *type_buffer = buffer.get_channel_raw_typed<uint8_t>(channel);
 	/*       _
 	//      | \
 	//     /\ \\
@@ -1,9 +1,11 @@
 #ifndef HERMITE_VALUE_H
 #define HERMITE_VALUE_H
 
+#include "../../util/morton.h"
 #include "../../util/utility.h"
 #include "../../voxel_buffer.h"
 #include <core/math/vector3.h>
+#include <vector>
 
 namespace dmc {
 
@@ -42,7 +44,121 @@ inline HermiteValue get_hermite_value(const VoxelBuffer &voxels, unsigned int x,
 	return v;
 }
 
-inline HermiteValue get_interpolated_hermite_value(const VoxelBuffer &voxels, Vector3 pos) {
+// Copy of the isolevel channel as floats, which the mesher reads instead of the VoxelBuffer.
+// The mesher reads lots of small neighborhoods (6 neighbors per gradient, 8 corners per cell),
+// which are more likely to share cache lines in Morton order than in the linear order of VoxelBuffer.
+// Morton order needs an array padded to the next power of two on each axis though, so both are available.
+class SdfGrid {
+public:
+	enum Layout {
+		LAYOUT_LINEAR, // Same order as VoxelBuffer, [z][x][y]
+		LAYOUT_MORTON
+	};
+
+	void build(const VoxelBuffer &voxels, Layout layout) {
+		_size = voxels.get_size();
+		_layout = layout;
+
+		if (_layout == LAYOUT_LINEAR) {
+			_values.resize(voxels.get_volume());
+			voxels.get_channel_f(VoxelBuffer::CHANNEL_ISOLEVEL, _values.data());
+			return;
+		}
+
+		_values.resize(morton_get_volume(_size.x, _size.y, _size.z));
+
+		// Convert one slice at a time instead of the whole channel,
+		// and scatter it in Morton order. Linear order is ZXY, so only Y has to be stepped within a row.
+		_slice.resize(_size.x * _size.y);
+		for (int z = 0; z < _size.z; ++z) {
+			voxels.get_region_f(VoxelBuffer::CHANNEL_ISOLEVEL, Rect3i(Vector3i(0, 0, z), Vector3i(_size.x, _size.y, 1)), _slice.data());
+			unsigned int i = 0;
+			for (int x = 0; x < _size.x; ++x) {
+				uint32_t m = morton_encode(x, 0, z);
+				for (int y = 0; y < _size.y; ++y) {
+					_values[m] = _slice[i];
+					m = morton_inc_y(m);
+					++i;
+				}
+			}
+		}
+	}
+
+	inline const Vector3i &get_size() const { return _size; }
+
+	inline unsigned int get_index(unsigned int x, unsigned int y, unsigned int z) const {
+		if (_layout == LAYOUT_MORTON) {
+			return morton_encode(x, y, z);
+		}
+		return y + _size.y * (x + _size.x * z);
+	}
+
+	inline float get_sdf(unsigned int x, unsigned int y, unsigned int z) const {
+		return _values[get_index(x, y, z)];
+	}
+
+	inline float get_sdf_clamped(unsigned int x, unsigned int y, unsigned int z) const {
+		x = x >= (unsigned int)_size.x ? _size.x - 1 : x;
+		y = y >= (unsigned int)_size.y ? _size.y - 1 : y;
+		z = z >= (unsigned int)_size.z ? _size.z - 1 : z;
+		return get_sdf(x, y, z);
+	}
+
+	inline HermiteValue get_hermite_value(unsigned int x, unsigned int y, unsigned int z) const {
+
+		if (x == 0 || y == 0 || z == 0 ||
+				x + 1 >= (unsigned int)_size.x || y + 1 >= (unsigned int)_size.y || z + 1 >= (unsigned int)_size.z) {
+			return get_hermite_value_clamped(x, y, z);
+		}
+
+		const float *values = _values.data();
+		HermiteValue v;
+
+		if (_layout == LAYOUT_MORTON) {
+			// Neighbors are all inside, step directly on the Morton code
+			const uint32_t m = morton_encode(x, y, z);
+			v.sdf = values[m];
+			v.gradient.x = values[morton_inc_x(m)] - values[morton_dec_x(m)];
+			v.gradient.y = values[morton_inc_y(m)] - values[morton_dec_y(m)];
+			v.gradient.z = values[morton_inc_z(m)] - values[morton_dec_z(m)];
+
+		} else {
+			const unsigned int i = get_index(x, y, z);
+			const unsigned int stride_x = _size.y;
+			const unsigned int stride_z = _size.y * _size.x;
+			v.sdf = values[i];
+			v.gradient.x = values[i + stride_x] - values[i - stride_x];
+			v.gradient.y = values[i + 1] - values[i - 1];
+			v.gradient.z = values[i + stride_z] - values[i - stride_z];
+		}
+
+		return v;
+	}
+
+private:
+	HermiteValue get_hermite_value_clamped(unsigned int x, unsigned int y, unsigned int z) const {
+		// Same as the VoxelBuffer version
+		HermiteValue v;
+		v.sdf = get_sdf_clamped(x, y, z);
+		v.gradient.x = get_sdf_clamped(x + 1, y, z) - get_sdf_clamped(x - 1, y, z);
+		v.gradient.y = get_sdf_clamped(x, y + 1, z) - get_sdf_clamped(x, y - 1, z);
+		v.gradient.z = get_sdf_clamped(x, y, z + 1) - get_sdf_clamped(x, y, z - 1);
+		return v;
+	}
+
+	Vector3i _size;
+	Layout _layout = LAYOUT_MORTON;
+	std::vector<float> _values;
+	// Temporary slice of voxels used when building in Morton order
+	std::vector<float> _slice;
+};
+
+inline HermiteValue get_hermite_value(const SdfGrid &grid, unsigned int x, unsigned int y, unsigned int z) {
+	return grid.get_hermite_value(x, y, z);
+}
+
+template <typename Grid_T>
+inline HermiteValue get_interpolated_hermite_value(const Grid_T &voxels, Vector3 pos) {
 
 	int x0 = static_cast<int>(pos.x);
 	int y0 = static_cast<int>(pos.y);
@@ -20,22 +20,22 @@ const float SQRT3 = 1.7320508075688772;
 // Helper to access padded voxel data
 struct VoxelAccess {
 
-	const VoxelBuffer &buffer;
+	const SdfGrid &grid;
 	const Vector3i offset;
 
-	VoxelAccess(const VoxelBuffer &p_buffer, Vector3i p_offset) :
-			buffer(p_buffer),
+	VoxelAccess(const SdfGrid &p_grid, Vector3i p_offset) :
+			grid(p_grid),
 			offset(p_offset) {}
 
 	inline HermiteValue get_hermite_value(int x, int y, int z) const {
-		return dmc::get_hermite_value(buffer, x + offset.x, y + offset.y, z + offset.z);
+		return grid.get_hermite_value(x + offset.x, y + offset.y, z + offset.z);
 	}
 
 	inline HermiteValue get_interpolated_hermite_value(Vector3 pos) const {
 		pos.x += offset.x;
 		pos.y += offset.y;
 		pos.z += offset.z;
-		return dmc::get_interpolated_hermite_value(buffer, pos);
+		return dmc::get_interpolated_hermite_value(grid, pos);
 	}
 };
 
@@ -48,7 +48,6 @@ bool can_split(Vector3i node_origin, int node_size, const VoxelAccess &voxels, f
 
 	Vector3i origin = node_origin + voxels.offset;
 	int step = node_size;
-	int channel = VoxelBuffer::CHANNEL_ISOLEVEL;
 
 	// Don't split if nothing is inside, i.e isolevel distance is greater than the size of the cube we are in
 	Vector3i center_pos = node_origin + Vector3i(node_size / 2);
@@ -59,15 +58,15 @@ bool can_split(Vector3i node_origin, int node_size, const VoxelAccess &voxels, f
 
 	// Fighting with Clang-format here /**/
 
-	float v0 = voxels.buffer.get_voxel_f(origin.x, /*  */ origin.y, /*  */ origin.z, /*  */ channel); // 0
-	float v1 = voxels.buffer.get_voxel_f(origin.x + step, origin.y, /*  */ origin.z, /*  */ channel); // 1
-	float v2 = voxels.buffer.get_voxel_f(origin.x + step, origin.y, /*  */ origin.z + step, channel); // 2
-	float v3 = voxels.buffer.get_voxel_f(origin.x, /*  */ origin.y, /*  */ origin.z + step, channel); // 3
+	float v0 = voxels.grid.get_sdf(origin.x, /*  */ origin.y, /*  */ origin.z); // 0
+	float v1 = voxels.grid.get_sdf(origin.x + step, origin.y, /*  */ origin.z); // 1
+	float v2 = voxels.grid.get_sdf(origin.x + step, origin.y, /*  */ origin.z + step); // 2
+	float v3 = voxels.grid.get_sdf(origin.x, /*  */ origin.y, /*  */ origin.z + step); // 3
 
-	float v4 = voxels.buffer.get_voxel_f(origin.x, /*  */ origin.y + step, origin.z, /*  */ channel); // 4
-	float v5 = voxels.buffer.get_voxel_f(origin.x + step, origin.y + step, origin.z, /*  */ channel); // 5
-	float v6 = voxels.buffer.get_voxel_f(origin.x + step, origin.y + step, origin.z + step, channel); // 6
-	float v7 = voxels.buffer.get_voxel_f(origin.x, /*  */ origin.y + step, origin.z + step, channel); // 7
+	float v4 = voxels.grid.get_sdf(origin.x, /*  */ origin.y + step, origin.z); // 4
+	float v5 = voxels.grid.get_sdf(origin.x + step, origin.y + step, origin.z); // 5
+	float v6 = voxels.grid.get_sdf(origin.x + step, origin.y + step, origin.z + step); // 6
+	float v7 = voxels.grid.get_sdf(origin.x, /*  */ origin.y + step, origin.z + step); // 7
 
 	int hstep = step / 2;
 
@@ -128,7 +127,7 @@ bool can_split(Vector3i node_origin, int node_size, const VoxelAccess &voxels, f
 
 		Vector3i pos = positions[i];
 
-		HermiteValue value = get_hermite_value(voxels.buffer, pos.x, pos.y, pos.z);
+		HermiteValue value = voxels.grid.get_hermite_value(pos.x, pos.y, pos.z);
 
 		float interpolated_value = ::interpolate(v0, v1, v2, v3, v4, v5, v6, v7, positions_ratio[i]);
 
@@ -1363,7 +1362,7 @@ void polygonize_dual_cell(const DualCell &cell, const VoxelAccess &voxels, MeshB
 	polygonize_cell_marching_cubes(corners, values, mesh_builder);
 
 	if (skirts_enabled) {
-		add_marching_squares_skirts(corners, values, mesh_builder, Vector3(), (voxels.buffer.get_size() + voxels.offset).to_vec3());
+		add_marching_squares_skirts(corners, values, mesh_builder, Vector3(), (voxels.grid.get_size() + voxels.offset).to_vec3());
 	}
 }
 
@@ -1374,7 +1373,7 @@ inline void polygonize_dual_grid(const DualGrid &grid, const VoxelAccess &voxels
 	}
 }
 
-void polygonize_volume_directly(const VoxelBuffer &voxels, Vector3i min, Vector3i size, MeshBuilder &mesh_builder, bool skirts_enabled) {
+void polygonize_volume_directly(const SdfGrid &voxels, Vector3i min, Vector3i size, MeshBuilder &mesh_builder, bool skirts_enabled) {
 
 	Vector3 corners[8];
 	HermiteValue values[8];
@@ -1460,6 +1459,14 @@ VoxelMesherDMC::SeamMode VoxelMesherDMC::get_seam_mode() const {
 	return _seam_mode;
 }
 
+void VoxelMesherDMC::set_sdf_layout(SdfLayout layout) {
+	_sdf_layout = layout;
+}
+
+VoxelMesherDMC::SdfLayout VoxelMesherDMC::get_sdf_layout() const {
+	return _sdf_layout;
+}
+
 void VoxelMesherDMC::build(VoxelMesher::Output &output, const VoxelBuffer &voxels, int padding) {
 
 	// Requirements:
@@ -1494,10 +1501,18 @@ void VoxelMesherDMC::build(VoxelMesher::Output &output, const VoxelBuffer &voxel
 	// and we are forced to at least re-upload the mesh entirely or have 16 versions of it just swapping seams...
 	// So we can't improve this further until Godot's API gives us that possibility, or other approaches like skirts need to be taken.
 
+	// Ticks don't fit in the precision of real_t, durations do
+	uint64_t time_before = OS::get_singleton()->get_ticks_usec();
+
+	// Meshing does many neighborhood reads, so work on a float copy of the isolevels
+	_sdf_grid.build(voxels, _sdf_layout == SDF_LAYOUT_MORTON ? dmc::SdfGrid::LAYOUT_MORTON : dmc::SdfGrid::LAYOUT_LINEAR);
+
+	_stats.sdf_grid_build_time = OS::get_singleton()->get_ticks_usec() - time_before;
+
 	// Construct an intermediate to handle padding transparently
-	dmc::VoxelAccess voxels_access(voxels, Vector3i(padding));
+	dmc::VoxelAccess voxels_access(_sdf_grid, Vector3i(padding));
 
-	real_t time_before = OS::get_singleton()->get_ticks_usec();
+	time_before = OS::get_singleton()->get_ticks_usec();
 
 	// In an ideal world, a tiny sphere placed in the middle of an empty SDF volume will
 	// cause corners data to change so that they indicate distance to it.
@@ -1568,7 +1583,7 @@ void VoxelMesherDMC::build(VoxelMesher::Output &output, const VoxelBuffer &voxel
 		// This is essentially regular marching cubes.
 
 		time_before = OS::get_singleton()->get_ticks_usec();
-		dmc::polygonize_volume_directly(voxels, Vector3i(padding), Vector3i(chunk_size), _mesh_builder, skirts_enabled);
+		dmc::polygonize_volume_directly(_sdf_grid, Vector3i(padding), Vector3i(chunk_size), _mesh_builder, skirts_enabled);
 		_stats.meshing_time = OS::get_singleton()->get_ticks_usec() - time_before;
 	}
 
@@ -1598,11 +1613,13 @@ VoxelMesher *VoxelMesherDMC::clone() {
 	c->set_simplify_mode(_simplify_mode);
 	c->set_geometric_error(_geometric_error);
 	c->set_seam_mode(_seam_mode);
+	c->set_sdf_layout(_sdf_layout);
 	return c;
 }
 
 Dictionary VoxelMesherDMC::get_stats() const {
 	Dictionary d;
+	d["sdf_grid_build_time"] = _stats.sdf_grid_build_time;
 	d["octree_build_time"] = _stats.octree_build_time;
 	d["dualgrid_derivation_time"] = _stats.dualgrid_derivation_time;
 	d["meshing_time"] = _stats.meshing_time;
@@ -1624,6 +1641,9 @@ void VoxelMesherDMC::_bind_methods() {
 	ClassDB::bind_method(D_METHOD("set_seam_mode", "mode"), &VoxelMesherDMC::set_seam_mode);
 	ClassDB::bind_method(D_METHOD("get_seam_mode"), &VoxelMesherDMC::get_seam_mode);
 
+	ClassDB::bind_method(D_METHOD("set_sdf_layout", "layout"), &VoxelMesherDMC::set_sdf_layout);
+	ClassDB::bind_method(D_METHOD("get_sdf_layout"), &VoxelMesherDMC::get_sdf_layout);
+
 	ClassDB::bind_method(D_METHOD("get_stats"), &VoxelMesherDMC::get_stats);
 
 	BIND_ENUM_CONSTANT(MESH_NORMAL);
@@ -1637,4 +1657,7 @@ void VoxelMesherDMC::_bind_methods() {
 
 	BIND_ENUM_CONSTANT(SEAM_NONE);
 	BIND_ENUM_CONSTANT(SEAM_MARCHING_SQUARE_SKIRTS);
+
+	BIND_ENUM_CONSTANT(SDF_LAYOUT_LINEAR);
+	BIND_ENUM_CONSTANT(SDF_LAYOUT_MORTON);
 }
@@ -87,6 +87,12 @@ public:
 		// SEAM_JUNCTION_TRIANGLES // Extra triangles for alternate borders, requires index buffer switching
 	};
 
+	// How isolevels are laid out in the copy the mesher works on
+	enum SdfLayout {
+		SDF_LAYOUT_LINEAR, // Same as VoxelBuffer, smaller
+		SDF_LAYOUT_MORTON // Better locality for neighborhood reads
+	};
+
 	VoxelMesherDMC();
 
 	void set_mesh_mode(MeshMode mode);
@@ -101,6 +107,9 @@ public:
 	void set_seam_mode(SeamMode mode);
 	SeamMode get_seam_mode() const;
 
+	void set_sdf_layout(SdfLayout layout);
+	SdfLayout get_sdf_layout() const;
+
 	void build(VoxelMesher::Output &output, const VoxelBuffer &voxels, int padding) override;
 	int get_minimum_padding() const override;
 
@@ -115,12 +124,15 @@ private:
 	dmc::MeshBuilder _mesh_builder;
 	dmc::DualGrid _dual_grid;
 	dmc::OctreeNodePool _octree_node_pool;
+	dmc::SdfGrid _sdf_grid;
 	real_t _geometric_error = 0.1;
 	MeshMode _mesh_mode = MESH_NORMAL;
 	SimplifyMode _simplify_mode = SIMPLIFY_OCTREE_BOTTOM_UP;
 	SeamMode _seam_mode = SEAM_NONE;
+	SdfLayout _sdf_layout = SDF_LAYOUT_MORTON;
 
 	struct Stats {
+		real_t sdf_grid_build_time = 0;
 		real_t octree_build_time = 0;
 		real_t dualgrid_derivation_time = 0;
 		real_t meshing_time = 0;
@@ -133,5 +145,6 @@ private:
 VARIANT_ENUM_CAST(VoxelMesherDMC::SimplifyMode)
 VARIANT_ENUM_CAST(VoxelMesherDMC::MeshMode)
 VARIANT_ENUM_CAST(VoxelMesherDMC::SeamMode)
+VARIANT_ENUM_CAST(VoxelMesherDMC::SdfLayout)
 
 #endif // VOXEL_MESHER_DMC_H
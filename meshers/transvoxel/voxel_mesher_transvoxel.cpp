@@ -16,6 +16,11 @@ inline int8_t tos(uint8_t v) {
 	return v - 128;
 }
 
+// Samples are processed as 8-bit whatever the format of the channel is
+inline int8_t get_sample(const uint8_t *samples, const VoxelBuffer &voxels, Vector3i pos) {
+	return tos(samples[voxels.index(pos.x, pos.y, pos.z)]);
+}
+
 // Values considered negative have a sign bit of 1
 inline uint8_t sign(int8_t v) {
 	return (v >> 7) & 1;
@@ -131,6 +136,22 @@ void VoxelMesherTransvoxel::build_internal(const VoxelBuffer &voxels, unsigned i
 		return;
 	}
 
+	// 8-bit channels are read in place, other formats are converted once for the whole block
+	const uint8_t *samples = NULL;
+	if (voxels.get_channel_format(channel) == VoxelBuffer::FORMAT_U8) {
+		samples = voxels.get_channel_raw_typed<uint8_t>(channel);
+	}
+	if (samples == NULL) {
+		const unsigned int volume = voxels.get_volume();
+		m_float_samples.resize(volume);
+		m_byte_samples.resize(volume);
+		voxels.get_channel_f(channel, m_float_samples.data());
+		for (unsigned int i = 0; i < volume; ++i) {
+			m_byte_samples[i] = VoxelBuffer::iso_to_byte(m_float_samples[i]);
+		}
+		samples = m_byte_samples.data();
+	}
+
 	const Vector3i block_size = voxels.get_size();
 	// TODO No lod yet, but it's planned
 	//const int lod_index = 0;
@@ -156,14 +177,14 @@ void VoxelMesherTransvoxel::build_internal(const VoxelBuffer &voxels, unsigned i
 				// Negative values are "solid" and positive are "air".
 				// Due to raw cells being unsigned 8-bit, they get converted to signed.
 				int8_t cell_samples[8] = {
-					tos(voxels.get_voxel(pos.x, pos.y, pos.z, channel)),
-					tos(voxels.get_voxel(pos.x + 1, pos.y, pos.z, channel)),
-					tos(voxels.get_voxel(pos.x, pos.y + 1, pos.z, channel)),
-					tos(voxels.get_voxel(pos.x + 1, pos.y + 1, pos.z, channel)),
-					tos(voxels.get_voxel(pos.x, pos.y, pos.z + 1, channel)),
-					tos(voxels.get_voxel(pos.x + 1, pos.y, pos.z + 1, channel)),
-					tos(voxels.get_voxel(pos.x, pos.y + 1, pos.z + 1, channel)),
-					tos(voxels.get_voxel(pos.x + 1, pos.y + 1, pos.z + 1, channel))
+					get_sample(samples, voxels, pos),
+					get_sample(samples, voxels, pos + Vector3i(1, 0, 0)),
+					get_sample(samples, voxels, pos + Vector3i(0, 1, 0)),
+					get_sample(samples, voxels, pos + Vector3i(1, 1, 0)),
+					get_sample(samples, voxels, pos + Vector3i(0, 0, 1)),
+					get_sample(samples, voxels, pos + Vector3i(1, 0, 1)),
+					get_sample(samples, voxels, pos + Vector3i(0, 1, 1)),
+					get_sample(samples, voxels, pos + Vector3i(1, 1, 1))
 				};
 
 				// Concatenate the sign of cell values to obtain the case code.
@@ -194,9 +215,9 @@ void VoxelMesherTransvoxel::build_internal(const VoxelBuffer &voxels, unsigned i
 
 					Vector3i p = pos + g_corner_dirs[i];
 
-					float nx = tof(tos(voxels.get_voxel(p - Vector3i(1, 0, 0), channel))) - tof(tos(voxels.get_voxel(p + Vector3i(1, 0, 0), channel)));
-					float ny = tof(tos(voxels.get_voxel(p - Vector3i(0, 1, 0), channel))) - tof(tos(voxels.get_voxel(p + Vector3i(0, 1, 0), channel)));
-					float nz = tof(tos(voxels.get_voxel(p - Vector3i(0, 0, 1), channel))) - tof(tos(voxels.get_voxel(p + Vector3i(0, 0, 1), channel)));
+					float nx = tof(get_sample(samples, voxels, p - Vector3i(1, 0, 0))) - tof(get_sample(samples, voxels, p + Vector3i(1, 0, 0)));
+					float ny = tof(get_sample(samples, voxels, p - Vector3i(0, 1, 0))) - tof(get_sample(samples, voxels, p + Vector3i(0, 1, 0)));
+					float nz = tof(get_sample(samples, voxels, p - Vector3i(0, 0, 1))) - tof(get_sample(samples, voxels, p + Vector3i(0, 0, 1)));
 
 					corner_normals[i] = Vector3(nx, ny, nz);
 					corner_normals[i].normalize();
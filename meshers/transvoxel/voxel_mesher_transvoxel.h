@@ -3,6 +3,7 @@
 
 #include "../voxel_mesher.h"
 #include <scene/resources/mesh.h>
+#include <vector>
 
 class VoxelMesherTransvoxel : public VoxelMesher {
 	GDCLASS(VoxelMesherTransvoxel, VoxelMesher)
@@ -35,6 +36,10 @@ private:
 	Vector<ReuseCell> m_cache[2];
 	Vector3i m_block_size;
 
+	// Samples of channels which can't be read in place
+	std::vector<float> m_float_samples;
+	std::vector<uint8_t> m_byte_samples;
+
 	Vector<Vector3> m_output_vertices;
 	//Vector<Vector3> m_output_vertices_secondary;
 	Vector<Vector3> m_output_normals;
@@ -2,19 +2,26 @@
 #include "meshers/blocky/voxel_mesher_blocky.h"
 #include "meshers/dmc/voxel_mesher_dmc.h"
 #include "meshers/transvoxel/voxel_mesher_transvoxel.h"
+#include "streams/voxel_block_serializer.h"
 #include "streams/voxel_stream_image.h"
 #include "streams/voxel_stream_noise.h"
+#include "streams/voxel_stream_region_files.h"
 #include "streams/voxel_stream_test.h"
 #include "terrain/voxel_box_mover.h"
 #include "terrain/voxel_lod_terrain.h"
 #include "terrain/voxel_map.h"
 #include "terrain/voxel_terrain.h"
+#include "util/parallel_for.h"
 #include "voxel_buffer.h"
 #include "voxel_isosurface_tool.h"
 #include "voxel_library.h"
+#include "voxel_memory_pool.h"
 
 void register_voxel_types() {
 
+	VoxelMemoryPool::create_singleton();
+	VoxelWorkerPool::create_singleton();
+
 	// Storage
 	ClassDB::register_class<VoxelBuffer>();
 	ClassDB::register_class<VoxelMap>();
@@ -32,10 +39,12 @@ void register_voxel_types() {
 	ClassDB::register_class<VoxelStreamTest>();
 	ClassDB::register_class<VoxelStreamImage>();
 	ClassDB::register_class<VoxelStreamNoise>();
+	ClassDB::register_class<VoxelStreamRegionFiles>();
 
 	// Helpers
 	ClassDB::register_class<VoxelBoxMover>();
 	ClassDB::register_class<VoxelIsoSurfaceTool>();
+	ClassDB::register_class<VoxelBlockSerializer>();
 
 	// Meshers
 	ClassDB::register_class<VoxelMesher>();
@@ -45,4 +54,7 @@ void register_voxel_types() {
 }
 
 void unregister_voxel_types() {
+
+	VoxelWorkerPool::destroy_singleton();
+	VoxelMemoryPool::destroy_singleton();
 }
@@ -0,0 +1,195 @@
+#include "voxel_block_serializer.h"
+#include <core/io/compression.h>
+#include <core/io/marshalls.h>
+
+namespace {
+
+const uint8_t BLOCK_FORMAT_VERSION = 0;
+const Compression::Mode BLOCK_COMPRESSION_MODE = Compression::MODE_FASTLZ;
+
+// Layout of uncompressed data:
+// - uint8_t version
+// - uint16_t size_x, size_y, size_z
+// - For each channel:
+//   - uint8_t format
+//   - uint8_t compression, either COMPRESSION_UNIFORM or COMPRESSION_NONE
+//   - uniform: uint32_t raw value
+//   - none: raw voxels, in the same order as VoxelBuffer stores them
+const unsigned int HEADER_SIZE = 1 + 3 * 2;
+const unsigned int CHANNEL_HEADER_SIZE = 2;
+
+// Compressed data is prefixed with the size of uncompressed data as uint32_t,
+// so it can be decompressed in a single allocation.
+const unsigned int COMPRESSED_HEADER_SIZE = 4;
+
+// Blocks are not expected to be bigger than this, sizes read from data beyond it are treated as corrupt
+const unsigned int MAX_BLOCK_VOLUME = 128 * 128 * 128;
+const unsigned int MAX_DATA_SIZE = HEADER_SIZE + VoxelBuffer::MAX_CHANNELS * (CHANNEL_HEADER_SIZE + MAX_BLOCK_VOLUME * 4);
+
+} // namespace
+
+const std::vector<uint8_t> &VoxelBlockSerializer::serialize(const VoxelBuffer &voxel_buffer) {
+
+	const Vector3i size = voxel_buffer.get_size();
+	const unsigned int volume = voxel_buffer.get_volume();
+
+	_data.clear();
+	ERR_FAIL_COND_V(size.x > 0xffff || size.y > 0xffff || size.z > 0xffff, _data);
+	ERR_FAIL_COND_V(volume > MAX_BLOCK_VOLUME, _data);
+
+	// Compute the total size first, so the buffer is resized only once
+	unsigned int data_size = HEADER_SIZE;
+	for (unsigned int channel_index = 0; channel_index < VoxelBuffer::MAX_CHANNELS; ++channel_index) {
+		data_size += CHANNEL_HEADER_SIZE;
+		if (voxel_buffer.get_channel_compression(channel_index) == VoxelBuffer::COMPRESSION_UNIFORM) {
+			data_size += 4;
+		} else {
+			data_size += volume * VoxelBuffer::get_format_size(voxel_buffer.get_channel_format(channel_index));
+		}
+	}
+
+	_data.resize(data_size);
+	uint8_t *dst = _data.data();
+
+	*dst++ = BLOCK_FORMAT_VERSION;
+	dst += encode_uint16(size.x, dst);
+	dst += encode_uint16(size.y, dst);
+	dst += encode_uint16(size.z, dst);
+
+	for (unsigned int channel_index = 0; channel_index < VoxelBuffer::MAX_CHANNELS; ++channel_index) {
+
+		const VoxelBuffer::ChannelFormat format = voxel_buffer.get_channel_format(channel_index);
+		*dst++ = format;
+
+		if (voxel_buffer.get_channel_compression(channel_index) == VoxelBuffer::COMPRESSION_UNIFORM) {
+			*dst++ = VoxelBuffer::COMPRESSION_UNIFORM;
+			dst += encode_uint32(voxel_buffer.get_channel_uniform_raw_value(channel_index), dst);
+
+		} else {
+			// Compressed representations are written as flat arrays, the block codec takes care of redundancy
+			*dst++ = VoxelBuffer::COMPRESSION_NONE;
+			voxel_buffer.get_channel_raw_bytes(channel_index, dst);
+			dst += volume * VoxelBuffer::get_format_size(format);
+		}
+	}
+
+	CRASH_COND(dst != _data.data() + _data.size());
+	return _data;
+}
+
+bool VoxelBlockSerializer::deserialize(const uint8_t *src, unsigned int src_size, VoxelBuffer &out_voxel_buffer) {
+
+	const uint8_t *src_end = src + src_size;
+	ERR_FAIL_COND_V(src_size < HEADER_SIZE, false);
+
+	const uint8_t version = *src++;
+	ERR_FAIL_COND_V(version != BLOCK_FORMAT_VERSION, false);
+
+	Vector3i size;
+	size.x = decode_uint16(src);
+	size.y = decode_uint16(src + 2);
+	size.z = decode_uint16(src + 4);
+	src += 6;
+	ERR_FAIL_COND_V(size.x == 0 || size.y == 0 || size.z == 0, false);
+	ERR_FAIL_COND_V((uint64_t)size.x * size.y * size.z > MAX_BLOCK_VOLUME, false);
+
+	out_voxel_buffer.clear();
+	out_voxel_buffer.create(size.x, size.y, size.z);
+	const unsigned int volume = out_voxel_buffer.get_volume();
+
+	for (unsigned int channel_index = 0; channel_index < VoxelBuffer::MAX_CHANNELS; ++channel_index) {
+
+		ERR_FAIL_COND_V(src + CHANNEL_HEADER_SIZE > src_end, false);
+		const uint8_t format = *src++;
+		const uint8_t compression = *src++;
+		ERR_FAIL_COND_V(format >= VoxelBuffer::FORMAT_COUNT, false);
+
+		// The channel is uniform at this point, so changing its format is cheap
+		out_voxel_buffer.set_channel_format(channel_index, (VoxelBuffer::ChannelFormat)format);
+
+		switch (compression) {
+
+			case VoxelBuffer::COMPRESSION_UNIFORM:
+				ERR_FAIL_COND_V(src + 4 > src_end, false);
+				out_voxel_buffer.set_channel_uniform_raw_value(channel_index, decode_uint32(src));
+				src += 4;
+				break;
+
+			case VoxelBuffer::COMPRESSION_NONE: {
+				const unsigned int channel_size = volume * VoxelBuffer::get_format_size((VoxelBuffer::ChannelFormat)format);
+				ERR_FAIL_COND_V(src + channel_size > src_end, false);
+				out_voxel_buffer.set_channel_raw_bytes(channel_index, src);
+				src += channel_size;
+			} break;
+
+			default:
+				ERR_PRINT("Unexpected channel compression in serialized block");
+				return false;
+		}
+	}
+
+	// This is a freshly loaded block, nothing was edited yet
+	out_voxel_buffer.clear_modified_box();
+	return true;
+}
+
+const std::vector<uint8_t> &VoxelBlockSerializer::serialize_and_compress(const VoxelBuffer &voxel_buffer) {
+
+	const std::vector<uint8_t> &data = serialize(voxel_buffer);
+
+	_compressed_data.clear();
+	ERR_FAIL_COND_V(data.empty(), _compressed_data);
+
+	_compressed_data.resize(COMPRESSED_HEADER_SIZE + Compression::get_max_compressed_buffer_size(data.size(), BLOCK_COMPRESSION_MODE));
+	encode_uint32(data.size(), _compressed_data.data());
+
+	const int compressed_size = Compression::compress(
+			_compressed_data.data() + COMPRESSED_HEADER_SIZE, data.data(), data.size(), BLOCK_COMPRESSION_MODE);
+	CRASH_COND(compressed_size < 0);
+
+	_compressed_data.resize(COMPRESSED_HEADER_SIZE + compressed_size);
+	return _compressed_data;
+}
+
+bool VoxelBlockSerializer::decompress_and_deserialize(const uint8_t *src, unsigned int src_size, VoxelBuffer &out_voxel_buffer) {
+	ERR_FAIL_COND_V(src == NULL, false);
+	ERR_FAIL_COND_V(src_size < COMPRESSED_HEADER_SIZE, false);
+
+	const unsigned int data_size = decode_uint32(src);
+	ERR_FAIL_COND_V(data_size > MAX_DATA_SIZE, false);
+	_data.resize(data_size);
+
+	const int decompressed_size = Compression::decompress(
+			_data.data(), data_size, src + COMPRESSED_HEADER_SIZE, src_size - COMPRESSED_HEADER_SIZE, BLOCK_COMPRESSION_MODE);
+	ERR_FAIL_COND_V(decompressed_size != (int)data_size, false);
+
+	return deserialize(_data.data(), data_size, out_voxel_buffer);
+}
+
+bool VoxelBlockSerializer::decompress_and_deserialize(const std::vector<uint8_t> &src, VoxelBuffer &out_voxel_buffer) {
+	return decompress_and_deserialize(src.data(), src.size(), out_voxel_buffer);
+}
+
+PoolByteArray VoxelBlockSerializer::_serialize_binding(Ref<VoxelBuffer> voxel_buffer) {
+	PoolByteArray bytes;
+	ERR_FAIL_COND_V(voxel_buffer.is_null(), bytes);
+
+	const std::vector<uint8_t> &data = serialize_and_compress(**voxel_buffer);
+
+	bytes.resize(data.size());
+	PoolByteArray::Write w = bytes.write();
+	memcpy(w.ptr(), data.data(), data.size());
+	return bytes;
+}
+
+bool VoxelBlockSerializer::_deserialize_binding(PoolByteArray bytes, Ref<VoxelBuffer> voxel_buffer) {
+	ERR_FAIL_COND_V(voxel_buffer.is_null(), false);
+	PoolByteArray::Read r = bytes.read();
+	return decompress_and_deserialize(r.ptr(), bytes.size(), **voxel_buffer);
+}
+
+void VoxelBlockSerializer::_bind_methods() {
+
+	ClassDB::bind_method(D_METHOD("serialize", "voxel_buffer"), &VoxelBlockSerializer::_serialize_binding);
+	ClassDB::bind_method(D_METHOD("deserialize", "bytes", "voxel_buffer"), &VoxelBlockSerializer::_deserialize_binding);
+}
@@ -0,0 +1,34 @@
+#ifndef VOXEL_BLOCK_SERIALIZER_H
+#define VOXEL_BLOCK_SERIALIZER_H
+
+#include "../voxel_buffer.h"
+#include <vector>
+
+// Turns voxel buffers into compact bytes and back, for storage on disk, network or in memory.
+// Uniform channels only store their value, other channels store their raw voxels,
+// and the whole block is then compressed with FastLZ, which favors speed over ratio.
+// Internal buffers are reused between calls, so one serializer should be kept per thread.
+// Buffers can have up to 128*128*128 voxels, so corrupt data can't cause huge allocations.
+class VoxelBlockSerializer : public Reference {
+	GDCLASS(VoxelBlockSerializer, Reference)
+public:
+	// The returned array is owned by the serializer, and remains valid until the next call.
+	const std::vector<uint8_t> &serialize_and_compress(const VoxelBuffer &voxel_buffer);
+	bool decompress_and_deserialize(const uint8_t *src, unsigned int src_size, VoxelBuffer &out_voxel_buffer);
+	bool decompress_and_deserialize(const std::vector<uint8_t> &src, VoxelBuffer &out_voxel_buffer);
+
+	// Same without compression, for data that wouldn't gain from it
+	const std::vector<uint8_t> &serialize(const VoxelBuffer &voxel_buffer);
+	bool deserialize(const uint8_t *src, unsigned int src_size, VoxelBuffer &out_voxel_buffer);
+
+private:
+	static void _bind_methods();
+
+	PoolByteArray _serialize_binding(Ref<VoxelBuffer> voxel_buffer);
+	bool _deserialize_binding(PoolByteArray bytes, Ref<VoxelBuffer> voxel_buffer);
+
+	std::vector<uint8_t> _data;
+	std::vector<uint8_t> _compressed_data;
+};
+
+#endif // VOXEL_BLOCK_SERIALIZER_H
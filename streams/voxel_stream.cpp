@@ -43,6 +43,13 @@ void VoxelStream::immerge_block(Ref<VoxelBuffer> buffer, Vector3i origin_in_voxe
 	}
 }
 
+void VoxelStream::emerge_blocks(Vector<BlockRequest> &p_blocks) {
+	for (int i = 0; i < p_blocks.size(); ++i) {
+		const BlockRequest &r = p_blocks[i];
+		emerge_block(r.voxel_buffer, r.origin_in_voxels, r.lod);
+	}
+}
+
 void VoxelStream::_emerge_block(Ref<VoxelBuffer> out_buffer, Vector3 origin_in_voxels, int lod) {
 	ERR_FAIL_COND(lod < 0);
 	emerge_block(out_buffer, Vector3i(origin_in_voxels), lod);
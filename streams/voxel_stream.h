@@ -9,9 +9,19 @@
 class VoxelStream : public Resource {
 	GDCLASS(VoxelStream, Resource)
 public:
+	struct BlockRequest {
+		Ref<VoxelBuffer> voxel_buffer;
+		Vector3i origin_in_voxels;
+		int lod;
+	};
+
 	virtual void emerge_block(Ref<VoxelBuffer> out_buffer, Vector3i origin_in_voxels, int lod);
 	virtual void immerge_block(Ref<VoxelBuffer> buffer, Vector3i origin_in_voxels, int lod);
 
+	// Same as `emerge_block`, for several blocks at once.
+	// Streams can override it to share work between blocks, by default blocks are emerged one by one.
+	virtual void emerge_blocks(Vector<BlockRequest> &p_blocks);
+
 protected:
 	static void _bind_methods();
 
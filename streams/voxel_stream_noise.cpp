@@ -1,5 +1,39 @@
 #include "voxel_stream_noise.h"
 
+namespace {
+
+// How fast a single octave of OpenSimplex noise can change per unit of its coordinates.
+// Upper bound of the sum of the gradients of all lattice contributions overlapping a point, worst gradient picked for each.
+const float OCTAVE_LIPSCHITZ = 5.f;
+
+// Octaves are summed with amplitudes multiplied by persistence each time, then divided by the sum of amplitudes.
+// Gives a bound on the absolute value of OpenSimplexNoise::get_noise_3d, and on how much it can change within `radius`.
+// Returns false if there is no useful bound.
+bool get_noise_bounds(const OpenSimplexNoise &noise, float radius, float &out_bound, float &out_variation) {
+	float amp = 1.f;
+	float freq = 1.f / noise.get_period();
+	float amp_sum = 0.f;
+	float abs_amp_sum = 0.f;
+	float variation = 0.f;
+	for (int i = 0; i < noise.get_octaves(); ++i) {
+		amp_sum += amp;
+		abs_amp_sum += Math::abs(amp);
+		// An octave can't vary by more than its whole range
+		variation += Math::abs(amp) * MIN(2.f, OCTAVE_LIPSCHITZ * freq * radius);
+		amp *= noise.get_persistence();
+		freq *= noise.get_lacunarity();
+	}
+	if (Math::abs(amp_sum) < 0.001f) {
+		// Normalization blows up
+		return false;
+	}
+	out_bound = abs_amp_sum / Math::abs(amp_sum);
+	out_variation = variation / Math::abs(amp_sum);
+	return true;
+}
+
+} // namespace
+
 void VoxelStreamNoise::set_noise(Ref<OpenSimplexNoise> noise) {
 	_noise = noise;
 }
@@ -32,11 +66,42 @@ void VoxelStreamNoise::emerge_block(Ref<VoxelBuffer> out_buffer, Vector3i origin
 	OpenSimplexNoise &noise = **_noise;
 	VoxelBuffer &buffer = **out_buffer;
 
-	if (origin_in_voxels.y > _height_start + _height_range) {
+	// A null range would make the gradient infinite
+	float height_range = _height_range;
+	if (Math::abs(height_range) < 0.001f) {
+		height_range = 0.001f;
+	}
+
+	// The surface is where noise plus the vertical gradient crosses zero.
+	// Noise is sampled at the center of the block, and knowing how fast it can change,
+	// blocks it can't make cross the surface are uniform and don't need more sampling.
+	// Meshers read a few voxels from neighbor blocks, so those must be uniform too.
+	const int padding = 2 << lod;
+	const Vector3 half_extent = ((buffer.get_size() - Vector3i(1)) << lod).to_vec3() * 0.5f + Vector3(padding, padding, padding);
+	const Vector3 center = origin_in_voxels.to_vec3() + half_extent - Vector3(padding, padding, padding);
+
+	// Distance field is proportional to `noise + 2 * t - 1`, find its range over the block
+	const float t_center = (center.y - _height_start) / height_range;
+	const float t_variation = half_extent.y / Math::abs(height_range);
+	float d_min = -1e10f;
+	float d_max = 1e10f;
+
+	float noise_bound;
+	float noise_variation;
+	if (get_noise_bounds(noise, half_extent.length(), noise_bound, noise_variation)) {
+		// Noise is bounded as a whole, and around the center where it is known
+		const float n_center = noise.get_noise_3d(center.x, center.y, center.z);
+		const float n_min = MAX(-noise_bound, n_center - noise_variation);
+		const float n_max = MIN(noise_bound, n_center + noise_variation);
+		d_min = n_min + 2.f * (t_center - t_variation) - 1.f;
+		d_max = n_max + 2.f * (t_center + t_variation) - 1.f;
+	}
+
+	if (d_min > 0.f) {
 
 		buffer.clear_channel_f(VoxelBuffer::CHANNEL_ISOLEVEL, 100.0);
 
-	} else if (origin_in_voxels.y + (buffer.get_size().y << lod) < _height_start) {
+	} else if (d_max < 0.f) {
 
 		buffer.clear_channel_f(VoxelBuffer::CHANNEL_ISOLEVEL, -100.0);
 
@@ -69,6 +134,12 @@ void VoxelStreamNoise::emerge_block(Ref<VoxelBuffer> out_buffer, Vector3i origin
 		float iso_scale = noise.get_period() * 0.1;
 		float noise_buffer_scale = 1.f / static_cast<float>(noise_buffer_step);
 
+		// Distances are computed as floats first, then converted all at once which is much faster
+		FloatBuffer3D &sdf_buffer = _sdf_buffer;
+		if (sdf_buffer.get_size() != buffer.get_size()) {
+			sdf_buffer.create(buffer.get_size());
+		}
+
 		for (int z = 0; z < buffer.get_size().z; ++z) {
 			for (int x = 0; x < buffer.get_size().x; ++x) {
 				for (int y = 0; y < buffer.get_size().y; ++y) {
@@ -76,14 +147,16 @@ void VoxelStreamNoise::emerge_block(Ref<VoxelBuffer> out_buffer, Vector3i origin
 					float ly = origin_in_voxels.y + (y << lod);
 
 					float n = noise_buffer.get_trilinear(x * noise_buffer_scale, y * noise_buffer_scale, z * noise_buffer_scale);
-					float t = (ly - _height_start) / _height_range;
+					float t = (ly - _height_start) / height_range;
 					float d = (n + 2.0 * t - 1.0) * iso_scale;
 
-					buffer.set_voxel_f(d, x, y, z, VoxelBuffer::CHANNEL_ISOLEVEL);
+					sdf_buffer.set(x, y, z, d);
 					// TODO Support for blocky voxels
 				}
 			}
 		}
+
+		buffer.set_channel_f(VoxelBuffer::CHANNEL_ISOLEVEL, sdf_buffer.get_data());
 	}
 }
 
@@ -25,6 +25,7 @@ protected:
 private:
 	Ref<OpenSimplexNoise> _noise;
 	FloatBuffer3D _noise_buffer;
+	FloatBuffer3D _sdf_buffer;
 	float _height_start = 0;
 	float _height_range = 300;
 };
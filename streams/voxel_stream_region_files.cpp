@@ -0,0 +1,657 @@
+#include "voxel_stream_region_files.h"
+#include <core/io/marshalls.h>
+#include <core/os/dir_access.h>
+#include <core/project_settings.h>
+#include <core/sort_array.h>
+
+#ifdef UNIX_ENABLED
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace {
+
+const uint8_t REGION_FORMAT_VERSION = 1;
+const char *REGION_FILE_EXTENSION = "vxr";
+const unsigned int MAX_OPEN_REGIONS = 32;
+
+// Blocks are stored in whole sectors, so they can often be rewritten at the same place
+const unsigned int SECTOR_SIZE = 512;
+
+// Layout of region files:
+// - 4 bytes magic "VXR_"
+// - uint8_t version
+// - uint8_t block_size_pow2
+// - uint8_t region_size_pow2
+// - uint8_t padding
+// - For each block of the region, Y first, then X, then Z:
+//   - uint32_t sector index, from the start of the file. For uniform blocks, index of the uniform block instead.
+//   - uint32_t size in bytes, zero if the block is absent or uniform.
+//     The highest bit is set if the block is not compressed, the next one if it is uniform.
+// - uint32_t count of uniform blocks
+// - MAX_UNIFORM_BLOCKS uniform blocks, used or not, each having for every channel:
+//   - uint8_t format
+//   - uint32_t raw value
+// - Sectors containing blocks serialized with VoxelBlockSerializer
+const unsigned int REGION_HEADER_SIZE = 8;
+const unsigned int BLOCK_LOCATION_SIZE = 8;
+const uint32_t BLOCK_UNCOMPRESSED_BIT = 1u << 31;
+const uint32_t BLOCK_UNIFORM_BIT = 1u << 30;
+
+// Worlds usually have few kinds of uniform blocks, like air or solid ground.
+// Those beyond this amount are stored in sectors like other blocks.
+const unsigned int MAX_UNIFORM_BLOCKS = 64;
+const unsigned int UNIFORM_BLOCK_SIZE = VoxelBuffer::MAX_CHANNELS * 5;
+
+inline unsigned int get_sector_count(unsigned int size) {
+	return (size + SECTOR_SIZE - 1) / SECTOR_SIZE;
+}
+
+// Offset of the uniform blocks, after the table of block locations
+inline unsigned int get_uniform_blocks_offset(unsigned int region_size_pow2) {
+	return REGION_HEADER_SIZE + (1 << (3 * region_size_pow2)) * BLOCK_LOCATION_SIZE;
+}
+
+inline unsigned int get_header_size(unsigned int region_size_pow2) {
+	return get_uniform_blocks_offset(region_size_pow2) + 4 + MAX_UNIFORM_BLOCKS * UNIFORM_BLOCK_SIZE;
+}
+
+// Sectors used by the header, after which blocks can be stored
+inline unsigned int get_header_sector_count(unsigned int region_size_pow2) {
+	return get_sector_count(get_header_size(region_size_pow2));
+}
+
+inline unsigned int get_block_index_in_region(Vector3i pos, unsigned int region_size_pow2) {
+	return pos.y + (pos.x << region_size_pow2) + (pos.z << (2 * region_size_pow2));
+}
+
+// Returns -1 if the size is not a cube with a power of two edge
+int get_block_size_pow2(Vector3i size) {
+	if (size.x != size.y || size.x != size.z || size.x <= 0) {
+		return -1;
+	}
+	int p = 0;
+	while ((1 << p) < size.x) {
+		++p;
+	}
+	return (1 << p) == size.x ? p : -1;
+}
+
+struct SectorSpan {
+	uint32_t begin;
+	uint32_t end;
+};
+
+struct SectorSpanComparator {
+	inline bool operator()(const SectorSpan &a, const SectorSpan &b) const {
+		return a.begin < b.begin;
+	}
+};
+
+} // namespace
+
+VoxelStreamRegionFiles::VoxelStreamRegionFiles() {
+	_serializer.instance();
+	_mutex = Mutex::create();
+}
+
+VoxelStreamRegionFiles::~VoxelStreamRegionFiles() {
+	close_all_regions_internal();
+	memdelete(_mutex);
+}
+
+void VoxelStreamRegionFiles::emerge_block(Ref<VoxelBuffer> out_buffer, Vector3i origin_in_voxels, int lod) {
+	Vector<BlockRequest> blocks;
+	BlockRequest r;
+	r.voxel_buffer = out_buffer;
+	r.origin_in_voxels = origin_in_voxels;
+	r.lod = lod;
+	blocks.push_back(r);
+	emerge_blocks(blocks);
+}
+
+void VoxelStreamRegionFiles::emerge_blocks(Vector<BlockRequest> &p_blocks) {
+
+	// Blocks that were never saved
+	Vector<BlockRequest> fallback_blocks;
+
+	{
+		MutexLock lock(_mutex);
+
+		for (int i = 0; i < p_blocks.size(); ++i) {
+			const BlockRequest &r = p_blocks[i];
+			if (!load_block(r.voxel_buffer, r.origin_in_voxels, r.lod)) {
+				fallback_blocks.push_back(r);
+			}
+		}
+	}
+
+	// Don't keep other threads waiting while blocks get generated
+	if (_fallback_stream.is_valid() && !fallback_blocks.empty()) {
+		_fallback_stream->emerge_blocks(fallback_blocks);
+	}
+}
+
+bool VoxelStreamRegionFiles::load_block(Ref<VoxelBuffer> out_buffer, Vector3i origin_in_voxels, int lod) {
+	// Invalid requests are not passed to the fallback stream either
+	ERR_FAIL_COND_V(out_buffer.is_null(), true);
+	ERR_FAIL_COND_V(lod < 0, true);
+
+	const int block_size_pow2 = get_block_size_pow2(out_buffer->get_size());
+	ERR_FAIL_COND_V(block_size_pow2 < 0, true);
+
+	const Vector3i bpos = origin_in_voxels >> (block_size_pow2 + lod);
+	const Vector3i region_pos = bpos >> _region_size_pow2;
+
+	Region *region = get_region(region_pos, lod, false, block_size_pow2);
+	if (region == nullptr) {
+		return false;
+	}
+
+	const unsigned int block_index = get_block_index_in_region(bpos - (region_pos << _region_size_pow2), _region_size_pow2);
+	const BlockLocation &location = region->blocks[block_index];
+	if (!location.exists()) {
+		return false;
+	}
+
+	if (location.uniform) {
+		// The header has all the values, no need to read the block
+		const UniformBlock &uniform_block = region->uniform_blocks[location.sector_index];
+		VoxelBuffer &voxels = **out_buffer;
+		voxels.clear();
+		for (unsigned int channel_index = 0; channel_index < VoxelBuffer::MAX_CHANNELS; ++channel_index) {
+			voxels.set_channel_format(channel_index, (VoxelBuffer::ChannelFormat)uniform_block.formats[channel_index]);
+			voxels.set_channel_uniform_raw_value(channel_index, uniform_block.values[channel_index]);
+		}
+		return true;
+	}
+
+	const uint8_t *src = nullptr;
+	const size_t begin = (size_t)location.sector_index * SECTOR_SIZE;
+
+	if (region->file == nullptr) {
+		// Read-only regions are already in memory, no need to copy
+		ERR_FAIL_COND_V(begin + location.size > region->data_size, true);
+		src = region->data + begin;
+
+	} else {
+		FileAccess *f = region->file;
+		_payload.resize(location.size);
+		f->seek(begin);
+		const unsigned int read_size = f->get_buffer(_payload.data(), _payload.size());
+		ERR_FAIL_COND_V(read_size != location.size, true);
+		src = _payload.data();
+	}
+
+	bool success;
+	if (location.compressed) {
+		success = _serializer->decompress_and_deserialize(src, location.size, **out_buffer);
+	} else {
+		success = _serializer->deserialize(src, location.size, **out_buffer);
+	}
+	ERR_FAIL_COND_V(!success, true);
+	return true;
+}
+
+void VoxelStreamRegionFiles::immerge_block(Ref<VoxelBuffer> buffer, Vector3i origin_in_voxels, int lod) {
+	ERR_FAIL_COND(buffer.is_null());
+	ERR_FAIL_COND(lod < 0);
+	ERR_FAIL_COND(_read_only);
+
+	const int block_size_pow2 = get_block_size_pow2(buffer->get_size());
+	ERR_FAIL_COND(block_size_pow2 < 0);
+
+	MutexLock lock(_mutex);
+
+	const Vector3i bpos = origin_in_voxels >> (block_size_pow2 + lod);
+	const Vector3i region_pos = bpos >> _region_size_pow2;
+
+	Region *region = get_region(region_pos, lod, true, block_size_pow2);
+	ERR_FAIL_COND(region == nullptr);
+
+	bool uniform = true;
+	for (unsigned int channel_index = 0; channel_index < VoxelBuffer::MAX_CHANNELS; ++channel_index) {
+		if (buffer->get_channel_compression(channel_index) != VoxelBuffer::COMPRESSION_UNIFORM) {
+			uniform = false;
+			break;
+		}
+	}
+
+	const unsigned int block_index = get_block_index_in_region(bpos - (region_pos << _region_size_pow2), _region_size_pow2);
+	BlockLocation &location = region->blocks[block_index];
+
+	int uniform_index = -1;
+	if (uniform) {
+		UniformBlock uniform_block;
+		for (unsigned int channel_index = 0; channel_index < VoxelBuffer::MAX_CHANNELS; ++channel_index) {
+			uniform_block.formats[channel_index] = buffer->get_channel_format(channel_index);
+			uniform_block.values[channel_index] = buffer->get_channel_uniform_raw_value(channel_index);
+		}
+		uniform_index = find_or_add_uniform_block(*region, uniform_block);
+	}
+
+	FileAccess *f = region->file;
+
+	if (uniform_index >= 0) {
+		// Sectors the block used before are free again
+		location.sector_index = uniform_index;
+		location.size = 0;
+		location.compressed = false;
+		location.uniform = true;
+
+	} else {
+		// Uniform blocks are only a few bytes, they are stored uncompressed so loading them is cheaper
+		const std::vector<uint8_t> &data = uniform ? _serializer->serialize(**buffer) : _serializer->serialize_and_compress(**buffer);
+		ERR_FAIL_COND(data.empty());
+
+		const uint32_t sector_count = get_sector_count(data.size());
+
+		if (location.size == 0 || get_sector_count(location.size) < sector_count) {
+			location.sector_index = find_free_sectors(*region, block_index, sector_count);
+		}
+		location.size = data.size();
+		location.compressed = !uniform;
+		location.uniform = false;
+
+		f->seek(location.sector_index * SECTOR_SIZE);
+		f->store_buffer(data.data(), data.size());
+	}
+
+	f->seek(REGION_HEADER_SIZE + block_index * BLOCK_LOCATION_SIZE);
+	f->store_32(location.sector_index);
+	f->store_32(location.size | (location.compressed ? 0 : BLOCK_UNCOMPRESSED_BIT) | (location.uniform ? BLOCK_UNIFORM_BIT : 0));
+}
+
+void VoxelStreamRegionFiles::set_directory(String dirpath) {
+	MutexLock lock(_mutex);
+	if (_directory != dirpath) {
+		close_all_regions_internal();
+		_directory = dirpath;
+	}
+}
+
+String VoxelStreamRegionFiles::get_directory() const {
+	return _directory;
+}
+
+void VoxelStreamRegionFiles::set_fallback_stream(Ref<VoxelStream> stream) {
+	ERR_FAIL_COND(stream == this);
+	_fallback_stream = stream;
+}
+
+Ref<VoxelStream> VoxelStreamRegionFiles::get_fallback_stream() const {
+	return _fallback_stream;
+}
+
+void VoxelStreamRegionFiles::set_region_size_pow2(int p_region_size_pow2) {
+	// Tables of bigger regions would get too large
+	ERR_FAIL_COND(p_region_size_pow2 < 0 || p_region_size_pow2 > 8);
+	MutexLock lock(_mutex);
+	if (_region_size_pow2 != (unsigned int)p_region_size_pow2) {
+		close_all_regions_internal();
+		_region_size_pow2 = p_region_size_pow2;
+	}
+}
+
+int VoxelStreamRegionFiles::get_region_size_pow2() const {
+	return _region_size_pow2;
+}
+
+void VoxelStreamRegionFiles::set_read_only(bool read_only) {
+	MutexLock lock(_mutex);
+	if (_read_only != read_only) {
+		close_all_regions_internal();
+		_read_only = read_only;
+	}
+}
+
+bool VoxelStreamRegionFiles::is_read_only() const {
+	return _read_only;
+}
+
+void VoxelStreamRegionFiles::close_all_regions() {
+	MutexLock lock(_mutex);
+	close_all_regions_internal();
+}
+
+void VoxelStreamRegionFiles::close_all_regions_internal() {
+	while (!_open_regions.empty()) {
+		close_region(_open_regions.size() - 1);
+	}
+}
+
+void VoxelStreamRegionFiles::close_region(unsigned int i) {
+	CRASH_COND(i >= _open_regions.size());
+	free_region(_open_regions[i]);
+	_open_regions[i] = _open_regions.back();
+	_open_regions.pop_back();
+}
+
+VoxelStreamRegionFiles::Region *VoxelStreamRegionFiles::get_region(Vector3i region_pos, int lod, bool create, unsigned int block_size_pow2) {
+
+	for (unsigned int i = 0; i < _open_regions.size(); ++i) {
+		Region *region = _open_regions[i];
+		if (region->position == region_pos && region->lod == lod) {
+			ERR_FAIL_COND_V(region->block_size_pow2 != block_size_pow2, nullptr);
+			region->last_use = ++_region_use_counter;
+			return region;
+		}
+	}
+
+	if (_open_regions.size() >= MAX_OPEN_REGIONS) {
+		unsigned int oldest = 0;
+		for (unsigned int i = 1; i < _open_regions.size(); ++i) {
+			if (_open_regions[i]->last_use < _open_regions[oldest]->last_use) {
+				oldest = i;
+			}
+		}
+		close_region(oldest);
+	}
+
+	Region *region = open_region(region_pos, lod, create, block_size_pow2);
+	if (region != nullptr) {
+		region->last_use = ++_region_use_counter;
+		_open_regions.push_back(region);
+	}
+	return region;
+}
+
+VoxelStreamRegionFiles::Region *VoxelStreamRegionFiles::open_region(Vector3i region_pos, int lod, bool create, unsigned int block_size_pow2) {
+	ERR_FAIL_COND_V(_directory.empty(), nullptr);
+
+	const String fpath = get_region_file_path(region_pos, lod);
+
+	Region *region = memnew(Region);
+	region->position = region_pos;
+	region->lod = lod;
+	region->block_size_pow2 = block_size_pow2;
+	region->region_size_pow2 = _region_size_pow2;
+	region->blocks.resize(1 << (3 * _region_size_pow2));
+
+	const unsigned int header_size = get_header_size(_region_size_pow2);
+
+	if (FileAccess::exists(fpath)) {
+
+		const uint8_t *header = nullptr;
+		unsigned int available_size = 0;
+		std::vector<uint8_t> header_data;
+
+		if (_read_only) {
+			if (!load_region_data(fpath, *region)) {
+				ERR_PRINT(String("Could not read region file {0}").format(varray(fpath)));
+				free_region(region);
+				return nullptr;
+			}
+			header = region->data;
+			available_size = MIN(region->data_size, header_size);
+
+		} else {
+			Error err;
+			region->file = FileAccess::open(fpath, FileAccess::READ_WRITE, &err);
+			if (region->file == nullptr) {
+				ERR_PRINT(String("Could not open region file {0}").format(varray(fpath)));
+				free_region(region);
+				return nullptr;
+			}
+			header_data.resize(header_size);
+			available_size = region->file->get_buffer(header_data.data(), header_size);
+			header = header_data.data();
+		}
+
+		if (!parse_region_header(header, available_size, fpath, *region)) {
+			free_region(region);
+			return nullptr;
+		}
+
+		return region;
+	}
+
+	if (!create) {
+		free_region(region);
+		return nullptr;
+	}
+
+	DirAccess *da = DirAccess::create(DirAccess::ACCESS_FILESYSTEM);
+	Error err = da->make_dir_recursive(fpath.get_base_dir());
+	memdelete(da);
+	if (err != OK) {
+		ERR_PRINT(String("Could not create directory for region file {0}").format(varray(fpath)));
+		free_region(region);
+		return nullptr;
+	}
+
+	FileAccess *f = FileAccess::open(fpath, FileAccess::WRITE_READ, &err);
+	if (f == nullptr) {
+		ERR_PRINT(String("Could not create region file {0}").format(varray(fpath)));
+		free_region(region);
+		return nullptr;
+	}
+	region->file = f;
+
+	const uint8_t magic[4] = { 'V', 'X', 'R', '_' };
+	f->store_buffer(magic, 4);
+	f->store_8(REGION_FORMAT_VERSION);
+	f->store_8(block_size_pow2);
+	f->store_8(_region_size_pow2);
+	f->store_8(0);
+
+	for (unsigned int i = 0; i < region->blocks.size(); ++i) {
+		f->store_32(0);
+		f->store_32(0);
+	}
+
+	f->store_32(0);
+	for (unsigned int i = 0; i < MAX_UNIFORM_BLOCKS * UNIFORM_BLOCK_SIZE; ++i) {
+		f->store_8(0);
+	}
+
+	return region;
+}
+
+bool VoxelStreamRegionFiles::parse_region_header(const uint8_t *src, unsigned int src_size, const String &fpath, Region &region) {
+
+	const unsigned int header_size = get_header_size(region.region_size_pow2);
+	if (src_size < header_size) {
+		ERR_PRINT(String("Region file {0} is truncated").format(varray(fpath)));
+		return false;
+	}
+
+	const uint8_t version = src[4];
+	const uint8_t file_block_size_pow2 = src[5];
+	const uint8_t file_region_size_pow2 = src[6];
+
+	if (src[0] != 'V' || src[1] != 'X' || src[2] != 'R' || src[3] != '_' || version != REGION_FORMAT_VERSION) {
+		ERR_PRINT(String("Invalid region file {0}").format(varray(fpath)));
+		return false;
+	}
+	if (file_block_size_pow2 != region.block_size_pow2 || file_region_size_pow2 != region.region_size_pow2) {
+		ERR_PRINT(String("Region file {0} was saved with a different block or region size").format(varray(fpath)));
+		return false;
+	}
+
+	src += REGION_HEADER_SIZE;
+	for (unsigned int i = 0; i < region.blocks.size(); ++i) {
+		BlockLocation &location = region.blocks[i];
+		location.sector_index = decode_uint32(src);
+		const uint32_t size = decode_uint32(src + 4);
+		location.size = size & ~(BLOCK_UNCOMPRESSED_BIT | BLOCK_UNIFORM_BIT);
+		location.compressed = (size & BLOCK_UNCOMPRESSED_BIT) == 0;
+		location.uniform = (size & BLOCK_UNIFORM_BIT) != 0;
+		src += BLOCK_LOCATION_SIZE;
+	}
+
+	const uint32_t uniform_block_count = decode_uint32(src);
+	src += 4;
+	if (uniform_block_count > MAX_UNIFORM_BLOCKS) {
+		ERR_PRINT(String("Invalid region file {0}").format(varray(fpath)));
+		return false;
+	}
+
+	region.uniform_blocks.resize(uniform_block_count);
+	for (unsigned int i = 0; i < region.uniform_blocks.size(); ++i) {
+		UniformBlock &uniform_block = region.uniform_blocks[i];
+		for (unsigned int channel_index = 0; channel_index < VoxelBuffer::MAX_CHANNELS; ++channel_index) {
+			uniform_block.formats[channel_index] = src[0];
+			uniform_block.values[channel_index] = decode_uint32(src + 1);
+			src += 5;
+			if (uniform_block.formats[channel_index] >= VoxelBuffer::FORMAT_COUNT) {
+				ERR_PRINT(String("Invalid region file {0}").format(varray(fpath)));
+				return false;
+			}
+		}
+	}
+
+	for (unsigned int i = 0; i < region.blocks.size(); ++i) {
+		const BlockLocation &location = region.blocks[i];
+		if (location.uniform && location.sector_index >= uniform_block_count) {
+			ERR_PRINT(String("Invalid region file {0}").format(varray(fpath)));
+			return false;
+		}
+	}
+
+	return true;
+}
+
+bool VoxelStreamRegionFiles::load_region_data(const String &fpath, Region &region) {
+
+#ifdef UNIX_ENABLED
+	// Only files of the OS filesystem can be mapped, not those packed with the game
+	const String os_path = ProjectSettings::get_singleton()->globalize_path(fpath);
+	const int fd = ::open(os_path.utf8().get_data(), O_RDONLY);
+
+	if (fd >= 0) {
+		struct stat st;
+		void *mapping = MAP_FAILED;
+		if (fstat(fd, &st) == 0 && st.st_size > 0) {
+			mapping = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+		}
+		// The mapping remains valid after the file is closed
+		::close(fd);
+
+		if (mapping != MAP_FAILED) {
+			region.data = reinterpret_cast<const uint8_t *>(mapping);
+			region.data_size = st.st_size;
+			region.data_mapped = true;
+			return true;
+		}
+	}
+#endif
+
+	// Otherwise the whole file is loaded in memory
+	Error err;
+	FileAccess *f = FileAccess::open(fpath, FileAccess::READ, &err);
+	if (f == nullptr) {
+		return false;
+	}
+	region.loaded_data.resize(f->get_len());
+	const size_t read_size = f->get_buffer(region.loaded_data.data(), region.loaded_data.size());
+	memdelete(f);
+	ERR_FAIL_COND_V(read_size != region.loaded_data.size(), false);
+
+	region.data = region.loaded_data.data();
+	region.data_size = region.loaded_data.size();
+	return true;
+}
+
+void VoxelStreamRegionFiles::free_region(Region *region) {
+	if (region->file != nullptr) {
+		memdelete(region->file);
+	}
+#ifdef UNIX_ENABLED
+	if (region->data_mapped) {
+		munmap(const_cast<uint8_t *>(region->data), region->data_size);
+	}
+#endif
+	memdelete(region);
+}
+
+uint32_t VoxelStreamRegionFiles::find_free_sectors(const Region &region, unsigned int block_index, uint32_t sector_count) const {
+
+	// The block being saved gives its sectors back
+	std::vector<SectorSpan> spans;
+	for (unsigned int i = 0; i < region.blocks.size(); ++i) {
+		const BlockLocation &location = region.blocks[i];
+		if (location.size != 0 && i != block_index) {
+			SectorSpan span;
+			span.begin = location.sector_index;
+			span.end = location.sector_index + get_sector_count(location.size);
+			spans.push_back(span);
+		}
+	}
+
+	SortArray<SectorSpan, SectorSpanComparator> sorter;
+	sorter.sort(spans.data(), spans.size());
+
+	// First gap large enough, or the end of the file
+	uint32_t sector_index = get_header_sector_count(region.region_size_pow2);
+	for (unsigned int i = 0; i < spans.size(); ++i) {
+		const SectorSpan &span = spans[i];
+		if (span.begin >= sector_index + sector_count) {
+			break;
+		}
+		sector_index = MAX(sector_index, span.end);
+	}
+
+	return sector_index;
+}
+
+int VoxelStreamRegionFiles::find_or_add_uniform_block(Region &region, const UniformBlock &uniform_block) {
+
+	for (unsigned int i = 0; i < region.uniform_blocks.size(); ++i) {
+		if (region.uniform_blocks[i] == uniform_block) {
+			return i;
+		}
+	}
+
+	if (region.uniform_blocks.size() >= MAX_UNIFORM_BLOCKS) {
+		return -1;
+	}
+
+	const unsigned int index = region.uniform_blocks.size();
+	region.uniform_blocks.push_back(uniform_block);
+
+	FileAccess *f = region.file;
+	const unsigned int offset = get_uniform_blocks_offset(region.region_size_pow2);
+
+	f->seek(offset + 4 + index * UNIFORM_BLOCK_SIZE);
+	for (unsigned int channel_index = 0; channel_index < VoxelBuffer::MAX_CHANNELS; ++channel_index) {
+		f->store_8(uniform_block.formats[channel_index]);
+		f->store_32(uniform_block.values[channel_index]);
+	}
+
+	f->seek(offset);
+	f->store_32(region.uniform_blocks.size());
+
+	return index;
+}
+
+String VoxelStreamRegionFiles::get_region_file_path(Vector3i region_pos, int lod) const {
+	return _directory
+			.plus_file("regions")
+			.plus_file("lod" + itos(lod))
+			.plus_file(String("r.{0}.{1}.{2}.").format(varray(region_pos.x, region_pos.y, region_pos.z)) + REGION_FILE_EXTENSION);
+}
+
+void VoxelStreamRegionFiles::_bind_methods() {
+
+	ClassDB::bind_method(D_METHOD("set_directory", "directory"), &VoxelStreamRegionFiles::set_directory);
+	ClassDB::bind_method(D_METHOD("get_directory"), &VoxelStreamRegionFiles::get_directory);
+
+	ClassDB::bind_method(D_METHOD("set_fallback_stream", "stream"), &VoxelStreamRegionFiles::set_fallback_stream);
+	ClassDB::bind_method(D_METHOD("get_fallback_stream"), &VoxelStreamRegionFiles::get_fallback_stream);
+
+	ClassDB::bind_method(D_METHOD("set_region_size_pow2", "region_size_pow2"), &VoxelStreamRegionFiles::set_region_size_pow2);
+	ClassDB::bind_method(D_METHOD("get_region_size_pow2"), &VoxelStreamRegionFiles::get_region_size_pow2);
+
+	ClassDB::bind_method(D_METHOD("set_read_only", "read_only"), &VoxelStreamRegionFiles::set_read_only);
+	ClassDB::bind_method(D_METHOD("is_read_only"), &VoxelStreamRegionFiles::is_read_only);
+
+	ClassDB::bind_method(D_METHOD("close_all_regions"), &VoxelStreamRegionFiles::close_all_regions);
+
+	ADD_PROPERTY(PropertyInfo(Variant::STRING, "directory", PROPERTY_HINT_DIR), "set_directory", "get_directory");
+	ADD_PROPERTY(PropertyInfo(Variant::OBJECT, "fallback_stream", PROPERTY_HINT_RESOURCE_TYPE, "VoxelStream"), "set_fallback_stream", "get_fallback_stream");
+	ADD_PROPERTY(PropertyInfo(Variant::INT, "region_size_pow2"), "set_region_size_pow2", "get_region_size_pow2");
+	ADD_PROPERTY(PropertyInfo(Variant::BOOL, "read_only"), "set_read_only", "is_read_only");
+}
@@ -0,0 +1,130 @@
+#ifndef VOXEL_STREAM_REGION_FILES_H
+#define VOXEL_STREAM_REGION_FILES_H
+
+#include "voxel_block_serializer.h"
+#include "voxel_stream.h"
+#include <core/os/file_access.h>
+#include <core/os/mutex.h>
+#include <vector>
+
+// Saves and loads blocks in a directory, grouping them into region files holding a fixed number of blocks per axis.
+// A region file starts with a table telling where each of its blocks is, followed by compressed blocks aligned to sectors.
+// Blocks having only uniform channels are usually stored in the header, so loading them doesn't read any sector.
+// A block saved again is rewritten in place if it still fits in its sectors,
+// otherwise it moves to the first free space large enough, so files don't keep growing.
+// Each LOD has its own regions. Blocks that were never saved are generated by the fallback stream, if any.
+// In read-only mode, region files are mapped in memory when the platform allows it, and blocks are decoded from there.
+// Only one instance should access a given directory at a time, unless all of them are read-only.
+class VoxelStreamRegionFiles : public VoxelStream {
+	GDCLASS(VoxelStreamRegionFiles, VoxelStream)
+public:
+	VoxelStreamRegionFiles();
+	~VoxelStreamRegionFiles();
+
+	void emerge_block(Ref<VoxelBuffer> out_buffer, Vector3i origin_in_voxels, int lod);
+	void immerge_block(Ref<VoxelBuffer> buffer, Vector3i origin_in_voxels, int lod);
+
+	// Reads all blocks in one go, then gives those that were never saved to the fallback stream
+	void emerge_blocks(Vector<BlockRequest> &p_blocks);
+
+	void set_directory(String dirpath);
+	String get_directory() const;
+
+	void set_fallback_stream(Ref<VoxelStream> stream);
+	Ref<VoxelStream> get_fallback_stream() const;
+
+	// Only affects regions created afterwards, existing ones must have been created with the same size
+	void set_region_size_pow2(int p_region_size_pow2);
+	int get_region_size_pow2() const;
+
+	// Blocks can't be saved in this mode
+	void set_read_only(bool read_only);
+	bool is_read_only() const;
+
+	// Closes all region files. They are opened again when needed.
+	void close_all_regions();
+
+protected:
+	static void _bind_methods();
+
+private:
+	// A block is absent from the region if its size is zero and it is not uniform
+	struct BlockLocation {
+		// If the block is uniform, index of its values in the uniform blocks of the region
+		uint32_t sector_index = 0;
+		uint32_t size = 0;
+		bool compressed = true;
+		// Uniform blocks are entirely described by the header, they don't use sectors
+		bool uniform = false;
+
+		inline bool exists() const {
+			return size != 0 || uniform;
+		}
+	};
+
+	// Format and value of each channel of a block having only uniform channels
+	struct UniformBlock {
+		uint8_t formats[VoxelBuffer::MAX_CHANNELS];
+		uint32_t values[VoxelBuffer::MAX_CHANNELS];
+
+		bool operator==(const UniformBlock &other) const {
+			for (unsigned int i = 0; i < VoxelBuffer::MAX_CHANNELS; ++i) {
+				if (formats[i] != other.formats[i] || values[i] != other.values[i]) {
+					return false;
+				}
+			}
+			return true;
+		}
+	};
+
+	struct Region {
+		Vector3i position;
+		int lod = 0;
+		// Null if the region is read-only
+		FileAccess *file = nullptr;
+		// Contents of read-only regions, mapped or loaded in memory
+		const uint8_t *data = nullptr;
+		size_t data_size = 0;
+		bool data_mapped = false;
+		std::vector<uint8_t> loaded_data;
+		unsigned int block_size_pow2 = 0;
+		unsigned int region_size_pow2 = 0;
+		std::vector<BlockLocation> blocks;
+		std::vector<UniformBlock> uniform_blocks;
+		uint64_t last_use = 0;
+	};
+
+	// Returns false if the block was never saved
+	bool load_block(Ref<VoxelBuffer> out_buffer, Vector3i origin_in_voxels, int lod);
+
+	Region *get_region(Vector3i region_pos, int lod, bool create, unsigned int block_size_pow2);
+	Region *open_region(Vector3i region_pos, int lod, bool create, unsigned int block_size_pow2);
+	bool parse_region_header(const uint8_t *src, unsigned int src_size, const String &fpath, Region &region);
+	bool load_region_data(const String &fpath, Region &region);
+	void free_region(Region *region);
+	void close_region(unsigned int i);
+	void close_all_regions_internal();
+
+	uint32_t find_free_sectors(const Region &region, unsigned int block_index, uint32_t sector_count) const;
+	// Returns -1 if the region has no room left for another uniform block
+	int find_or_add_uniform_block(Region &region, const UniformBlock &uniform_block);
+
+	String get_region_file_path(Vector3i region_pos, int lod) const;
+
+	String _directory;
+	Ref<VoxelStream> _fallback_stream;
+	unsigned int _region_size_pow2 = 4;
+	bool _read_only = false;
+
+	// Region files are costly to open, so the most recently used ones are kept open
+	std::vector<Region *> _open_regions;
+	uint64_t _region_use_counter = 0;
+
+	Ref<VoxelBlockSerializer> _serializer;
+	std::vector<uint8_t> _payload;
+
+	// Blocks are loaded from a thread but can be saved from another
+	Mutex *_mutex = nullptr;
+};
+
+#endif // VOXEL_STREAM_REGION_FILES_H
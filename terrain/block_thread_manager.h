@@ -8,6 +8,27 @@
 #include <core/os/semaphore.h>
 #include <vector>
 
+// Specialization must be copyable
+template <typename InputBlockData_T>
+struct VoxelBlockThreadInputBlock {
+	InputBlockData_T data;
+	Vector3i position; // In LOD0 block coordinates
+	unsigned int lod = 0;
+	float sort_heuristic = 0; // Used internally, no need to be set
+};
+
+// Specialization must be copyable
+template <typename OutputBlockData_T>
+struct VoxelBlockThreadOutputBlock {
+	OutputBlockData_T data;
+	Vector3i position; // In LOD0 block coordinates
+	unsigned int lod = 0;
+	// True if the block was actually dropped.
+	// Ideally the requester will agree that it doesn't need that block anymore,
+	// but in cases it still does (bad case), it will have to query it again.
+	bool drop_hint = false;
+};
+
 // Base structure for an asynchronous block processing manager using threads.
 // It is the same for block loading and rendering, hence made a generic one.
 // - Push requests and pop requests in batch
@@ -17,30 +38,15 @@
 // - Merges duplicate requests
 // - Cancels requests that become out of range
 // - Takes some stats
+// - Gives blocks to processors in batches, so they can share work between blocks
 template <typename InputBlockData_T, typename OutputBlockData_T, typename Processor_T>
 class VoxelBlockThreadManager {
 public:
 	static const int MAX_LOD = 32; // Like VoxelLodTerrain
 	static const int MAX_JOBS = 8; // Arbitrary, should be enough
 
-	// Specialization must be copyable
-	struct InputBlock {
-		InputBlockData_T data;
-		Vector3i position; // In LOD0 block coordinates
-		unsigned int lod = 0;
-		float sort_heuristic = 0; // Used internally, no need to be set
-	};
-
-	// Specialization must be copyable
-	struct OutputBlock {
-		OutputBlockData_T data;
-		Vector3i position; // In LOD0 block coordinates
-		unsigned int lod = 0;
-		// True if the block was actually dropped.
-		// Ideally the requester will agree that it doesn't need that block anymore,
-		// but in cases it still does (bad case), it will have to query it again.
-		bool drop_hint = false;
-	};
+	typedef VoxelBlockThreadInputBlock<InputBlockData_T> InputBlock;
+	typedef VoxelBlockThreadOutputBlock<OutputBlockData_T> OutputBlock;
 
 	struct Input {
 		std::vector<InputBlock> blocks;
@@ -74,10 +80,14 @@ public:
 	// Creates and starts jobs.
 	// Processors are given as array because you could decide to either re-use the same one,
 	// or have clones depending on them being stateless or not.
-	VoxelBlockThreadManager(unsigned int job_count, unsigned int sync_interval_ms, Processor_T *processors, bool duplicate_rejection = true) {
+	// Processors get up to `batch_count` blocks at once. Bigger batches let them share more work,
+	// but results are posted and new requests are taken only between batches.
+	VoxelBlockThreadManager(unsigned int job_count, unsigned int sync_interval_ms, Processor_T *processors,
+			bool duplicate_rejection = true, unsigned int batch_count = 1) {
 
 		CRASH_COND(job_count < 1);
 		CRASH_COND(job_count >= MAX_JOBS);
+		CRASH_COND(batch_count < 1);
 		_job_count = job_count;
 
 		for (unsigned int i = 0; i < MAX_JOBS; ++i) {
@@ -85,6 +95,7 @@ public:
 			job.job_index = i;
 			job.duplicate_rejection = duplicate_rejection;
 			job.sync_interval_ms = sync_interval_ms;
+			job.batch_count = batch_count;
 		}
 
 		for (unsigned int i = 0; i < _job_count; ++i) {
@@ -272,6 +283,10 @@ private:
 		uint32_t sync_interval_ms = 100;
 		uint32_t job_index = -1;
 		bool duplicate_rejection = false;
+		uint32_t batch_count = 1;
+		// Only used by the thread, members so their capacity is reused
+		std::vector<InputBlock> batch_input;
+		std::vector<OutputBlock> batch_output;
 
 		Processor_T processor;
 	};
@@ -341,22 +356,26 @@ private:
 
 				if (!data.input.blocks.empty()) {
 
-					InputBlock block = data.input.blocks[queue_index];
-					++queue_index;
+					const unsigned int batch_count = MIN(data.batch_count, data.input.blocks.size() - queue_index);
+					data.batch_input.assign(
+							data.input.blocks.begin() + queue_index,
+							data.input.blocks.begin() + queue_index + batch_count);
+					queue_index += batch_count;
 
 					if (queue_index >= data.input.blocks.size()) {
 						data.input.blocks.clear();
 					}
 
+					data.batch_output.clear();
+					data.batch_output.resize(batch_count);
+
 					uint64_t time_before = OS::get_singleton()->get_ticks_usec();
 
-					OutputBlock ob;
 					// Implemented in specialization
-					data.processor.process_block(block.data, ob.data, block.position, block.lod);
-					ob.position = block.position;
-					ob.lod = block.lod;
+					data.processor.process_blocks(data.batch_input.data(), data.batch_output.data(), batch_count);
 
-					uint64_t time_taken = OS::get_singleton()->get_ticks_usec() - time_before;
+					// Time is measured per block
+					uint64_t time_taken = (OS::get_singleton()->get_ticks_usec() - time_before) / batch_count;
 
 					// Do some stats
 					if (stats.first) {
@@ -372,7 +391,12 @@ private:
 						}
 					}
 
-					data.output.blocks.push_back(ob);
+					for (unsigned int i = 0; i < batch_count; ++i) {
+						OutputBlock &ob = data.batch_output[i];
+						ob.position = data.batch_input[i].position;
+						ob.lod = data.batch_input[i].lod;
+						data.output.blocks.push_back(ob);
+					}
 				}
 
 				uint32_t time = OS::get_singleton()->get_ticks_msec();
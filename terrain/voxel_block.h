@@ -20,10 +20,41 @@ public:
 	Vector3i position;
 	unsigned int lod_index = 0;
 
+	// One bit per block of the 3x3x3 area centered on this one, including itself,
+	// telling which of them are present in the map. Maintained by VoxelMap.
+	uint32_t neighbor_mask = 0;
+
+	// Set when voxels were edited since the block was loaded. Maintained by VoxelMap.
+	bool modified = false;
+
+	// Set while the block has edits waiting to be consumed by the map. Maintained by VoxelMap.
+	bool modified_queued = false;
+
+	// When edits of the block were last consumed by the map, in microseconds. Maintained by VoxelMap.
+	uint64_t last_edit_time_usec = 0;
+
+	inline bool needs_saving() const {
+		// Edits queued but not consumed yet by the map count too
+		return modified || modified_queued;
+	}
+
+	static const uint32_t ALL_NEIGHBORS_MASK = (1 << 27) - 1;
+
+	// Offset components must be in [-1, 1]
+	static inline uint32_t get_neighbor_bit(Vector3i offset) {
+		return 1 << ((offset.x + 1) + 3 * (offset.y + 1) + 9 * (offset.z + 1));
+	}
+
+	inline bool is_surrounded() const {
+		return neighbor_mask == ALL_NEIGHBORS_MASK;
+	}
+
 	static VoxelBlock *create(Vector3i bpos, Ref<VoxelBuffer> buffer, unsigned int size, unsigned int p_lod_index);
 
 	~VoxelBlock();
 
+	inline Vector3i get_position_in_voxels() const { return _position_in_voxels; }
+
 	void set_mesh(Ref<Mesh> mesh, Ref<World> world);
 	bool has_mesh() const;
 
@@ -0,0 +1,130 @@
+#include "voxel_block_cache.h"
+#include "voxel_block.h"
+
+void VoxelBlockCache::StoreAction::operator()(VoxelBlock *block) {
+	if (cache.is_enabled() && block->voxels.is_valid()) {
+		cache.store(block->position, block->lod_index, **block->voxels);
+	}
+}
+
+VoxelBlockCache::VoxelBlockCache() {
+	_serializer.instance();
+}
+
+VoxelBlockCache::~VoxelBlockCache() {
+	clear();
+}
+
+void VoxelBlockCache::set_memory_budget(unsigned int bytes) {
+	_memory_budget = bytes;
+	evict_until_within_budget();
+}
+
+void VoxelBlockCache::store(Vector3i bpos, unsigned int lod_index, const VoxelBuffer &voxels) {
+	if (!is_enabled()) {
+		return;
+	}
+
+	const Key key(bpos, lod_index);
+
+	// Newer voxels replace the old ones
+	Entry **existing = _entries.getptr(key);
+	if (existing) {
+		remove_entry(*existing);
+	}
+
+	const std::vector<uint8_t> &data = _serializer->serialize_and_compress(voxels);
+	ERR_FAIL_COND(data.empty());
+
+	Entry *entry = memnew(Entry);
+	entry->key = key;
+	entry->data = data;
+
+	entry->next = _most_recent;
+	if (_most_recent) {
+		_most_recent->prev = entry;
+	} else {
+		_least_recent = entry;
+	}
+	_most_recent = entry;
+
+	_entries.set(key, entry);
+	_memory_usage += entry->data.size();
+
+	evict_until_within_budget();
+}
+
+Ref<VoxelBuffer> VoxelBlockCache::take(Vector3i bpos, unsigned int lod_index) {
+	if (!is_enabled()) {
+		return Ref<VoxelBuffer>();
+	}
+
+	Entry **pptr = _entries.getptr(Key(bpos, lod_index));
+	if (pptr == nullptr) {
+		++_misses;
+		return Ref<VoxelBuffer>();
+	}
+	Entry *entry = *pptr;
+
+	Ref<VoxelBuffer> voxels;
+	voxels.instance();
+	const bool success = _serializer->decompress_and_deserialize(entry->data, **voxels);
+	remove_entry(entry);
+
+	if (!success) {
+		ERR_PRINT("Failed to revive cached block");
+		++_misses;
+		return Ref<VoxelBuffer>();
+	}
+
+	++_hits;
+	return voxels;
+}
+
+void VoxelBlockCache::clear() {
+	Entry *entry = _most_recent;
+	while (entry) {
+		Entry *next = entry->next;
+		memdelete(entry);
+		entry = next;
+	}
+	_entries.clear();
+	_most_recent = nullptr;
+	_least_recent = nullptr;
+	_memory_usage = 0;
+}
+
+Dictionary VoxelBlockCache::get_statistics() const {
+	Dictionary d;
+	d["hits"] = _hits;
+	d["misses"] = _misses;
+	d["evictions"] = _evictions;
+	d["block_count"] = get_block_count();
+	d["memory_usage"] = _memory_usage;
+	d["memory_budget"] = _memory_budget;
+	return d;
+}
+
+void VoxelBlockCache::remove_entry(Entry *entry) {
+	if (entry->prev) {
+		entry->prev->next = entry->next;
+	} else {
+		_most_recent = entry->next;
+	}
+	if (entry->next) {
+		entry->next->prev = entry->prev;
+	} else {
+		_least_recent = entry->prev;
+	}
+
+	_memory_usage -= entry->data.size();
+	_entries.erase(entry->key);
+	memdelete(entry);
+}
+
+void VoxelBlockCache::evict_until_within_budget() {
+	while (_least_recent != nullptr && _memory_usage > _memory_budget) {
+		remove_entry(_least_recent);
+		++_evictions;
+	}
+}
@@ -0,0 +1,94 @@
+#ifndef VOXEL_BLOCK_CACHE_H
+#define VOXEL_BLOCK_CACHE_H
+
+#include "../math/vector3i.h"
+#include "../streams/voxel_block_serializer.h"
+#include <core/hash_map.h>
+
+class VoxelBlock;
+
+// Keeps voxels of recently unloaded blocks in memory, compressed, so they can be revived
+// without going through the stream again if they are needed before being evicted.
+// When the memory budget is exceeded, least recently stored blocks are evicted first.
+// A budget of zero disables the cache.
+class VoxelBlockCache {
+public:
+	// Can be used as pre-delete action of `VoxelMap::remove_block`
+	struct StoreAction {
+		VoxelBlockCache &cache;
+
+		StoreAction(VoxelBlockCache &p_cache) :
+				cache(p_cache) {}
+
+		void operator()(VoxelBlock *block);
+	};
+
+	VoxelBlockCache();
+	~VoxelBlockCache();
+
+	void set_memory_budget(unsigned int bytes);
+	unsigned int get_memory_budget() const { return _memory_budget; }
+
+	inline bool is_enabled() const { return _memory_budget > 0; }
+
+	void store(Vector3i bpos, unsigned int lod_index, const VoxelBuffer &voxels);
+
+	// Removes the block from the cache and returns its voxels, or null if it wasn't cached
+	Ref<VoxelBuffer> take(Vector3i bpos, unsigned int lod_index);
+
+	void clear();
+
+	unsigned int get_memory_usage() const { return _memory_usage; }
+	unsigned int get_block_count() const { return _entries.size(); }
+
+	Dictionary get_statistics() const;
+
+private:
+	struct Key {
+		Vector3i position;
+		unsigned int lod_index;
+
+		Key() :
+				lod_index(0) {}
+
+		Key(Vector3i p_position, unsigned int p_lod_index) :
+				position(p_position),
+				lod_index(p_lod_index) {}
+
+		inline bool operator==(const Key &other) const {
+			return position == other.position && lod_index == other.lod_index;
+		}
+	};
+
+	struct KeyHasher {
+		static _FORCE_INLINE_ uint32_t hash(const Key &key) {
+			return hash_djb2_one_32(key.lod_index, Vector3iHasher::hash(key.position));
+		}
+	};
+
+	// Entries are chained from most to least recently stored
+	struct Entry {
+		Key key;
+		std::vector<uint8_t> data;
+		Entry *prev = nullptr;
+		Entry *next = nullptr;
+	};
+
+	void remove_entry(Entry *entry);
+	void evict_until_within_budget();
+
+	HashMap<Key, Entry *, KeyHasher> _entries;
+	Entry *_most_recent = nullptr;
+	Entry *_least_recent = nullptr;
+
+	unsigned int _memory_budget = 0;
+	unsigned int _memory_usage = 0;
+
+	uint64_t _hits = 0;
+	uint64_t _misses = 0;
+	uint64_t _evictions = 0;
+
+	Ref<VoxelBlockSerializer> _serializer;
+};
+
+#endif // VOXEL_BLOCK_CACHE_H
@@ -1,9 +1,19 @@
 #include "voxel_data_loader.h"
-#include "../streams/voxel_stream.h"
 #include "../util/utility.h"
 
+namespace {
+
+// Blocks given to the stream at once
+const unsigned int BATCH_COUNT = 16;
+
+} // namespace
+
 VoxelDataLoader::VoxelDataLoader(int thread_count, Ref<VoxelStream> stream, int block_size_pow2) {
 
+	_stream = stream;
+	_block_size_pow2 = block_size_pow2;
+	_stream_mutex = Mutex::create();
+
 	Processor processors[Mgr::MAX_JOBS];
 
 	// Note: more than one thread can make sense for generators,
@@ -11,32 +21,179 @@ VoxelDataLoader::VoxelDataLoader(int thread_count, Ref<VoxelStream> stream, int
 	for (int i = 0; i < thread_count; ++i) {
 		Processor &p = processors[i];
 		p.block_size_pow2 = block_size_pow2;
+		p.loader = this;
 		if (i == 0) {
 			p.stream = stream;
+			p.stream_mutex = _stream_mutex;
 		} else {
 			p.stream = stream->duplicate();
 		}
 	}
 
 	// TODO Re-enable duplicate rejection, was turned off to investigate some bugs
-	_mgr = memnew(Mgr(thread_count, 500, processors, true));
+	_mgr = memnew(Mgr(thread_count, 500, processors, true, BATCH_COUNT));
+
+	_save_mutex = Mutex::create();
+	_save_semaphore = Semaphore::create();
+	_flush_semaphore = Semaphore::create();
+	_save_thread = Thread::create(_save_thread_func, this);
 }
 
 VoxelDataLoader::~VoxelDataLoader() {
 	if (_mgr) {
 		memdelete(_mgr);
 	}
+
+	// Pending saves are done before the thread exits
+	{
+		MutexLock lock(_save_mutex);
+		_save_thread_exit = true;
+	}
+	_save_semaphore->post();
+	Thread::wait_to_finish(_save_thread);
+
+	memdelete(_save_thread);
+	memdelete(_flush_semaphore);
+	memdelete(_save_semaphore);
+	memdelete(_save_mutex);
+	memdelete(_stream_mutex);
+}
+
+void VoxelDataLoader::push_saves(const std::vector<InputBlock> &blocks) {
+	if (blocks.empty()) {
+		return;
+	}
+	{
+		MutexLock lock(_save_mutex);
+		for (unsigned int i = 0; i < blocks.size(); ++i) {
+			const InputBlock &block = blocks[i];
+			CRASH_COND(block.lod >= Mgr::MAX_LOD);
+			ERR_CONTINUE(block.data.voxels_to_save.is_null());
+			_save_queue.push_back(block);
+			_voxels_to_save[block.lod].set(block.position, block.data.voxels_to_save);
+			++_pending_save_count;
+		}
+	}
+	_save_semaphore->post();
 }
 
-void VoxelDataLoader::Processor::process_block(const InputBlockData &input, OutputBlockData &output, Vector3i block_position, unsigned int lod) {
+void VoxelDataLoader::flush_saves() {
+	{
+		MutexLock lock(_save_mutex);
+		if (_pending_save_count == 0) {
+			return;
+		}
+		_waiting_for_flush = true;
+	}
+	// Saves are only pushed from the thread calling this, so the count can only go down until then
+	_flush_semaphore->wait();
+}
+
+unsigned int VoxelDataLoader::get_pending_save_count() const {
+	MutexLock lock(_save_mutex);
+	return _pending_save_count;
+}
+
+bool VoxelDataLoader::get_voxels_to_save(Vector3i block_position, unsigned int lod, VoxelBuffer &out_buffer) {
+	MutexLock lock(_save_mutex);
+
+	const Ref<VoxelBuffer> *voxels = _voxels_to_save[lod].getptr(block_position);
+	if (voxels == nullptr) {
+		return false;
+	}
+
+	// Channels are shared, the saving thread only reads them
+	for (unsigned int channel_index = 0; channel_index < VoxelBuffer::MAX_CHANNELS; ++channel_index) {
+		out_buffer.copy_from(***voxels, channel_index);
+	}
+	return true;
+}
+
+void VoxelDataLoader::_save_thread_func(void *p_loader) {
+	VoxelDataLoader *loader = reinterpret_cast<VoxelDataLoader *>(p_loader);
+	CRASH_COND(loader == nullptr);
+	loader->save_thread_func();
+}
 
-	int bs = 1 << block_size_pow2;
-	Ref<VoxelBuffer> buffer;
-	buffer.instance();
-	buffer->create(bs, bs, bs);
+void VoxelDataLoader::save_thread_func() {
 
-	Vector3i block_origin_in_voxels = block_position * (bs << lod);
-	stream->emerge_block(buffer, block_origin_in_voxels, lod);
+	std::vector<InputBlock> blocks;
+	const int bs = 1 << _block_size_pow2;
 
-	output.voxels_loaded = buffer;
+	while (true) {
+
+		_save_semaphore->wait();
+
+		{
+			MutexLock lock(_save_mutex);
+			if (_save_queue.empty() && _save_thread_exit) {
+				break;
+			}
+			blocks.swap(_save_queue);
+		}
+
+		for (unsigned int i = 0; i < blocks.size(); ++i) {
+			const InputBlock &block = blocks[i];
+
+			if (_stream.is_valid()) {
+				const Vector3i block_origin_in_voxels = block.position * (bs << block.lod);
+				MutexLock stream_lock(_stream_mutex);
+				_stream->immerge_block(block.data.voxels_to_save, block_origin_in_voxels, block.lod);
+			}
+
+			MutexLock lock(_save_mutex);
+
+			// The block may have been saved again since, in which case it still has to wait
+			const Ref<VoxelBuffer> *voxels = _voxels_to_save[block.lod].getptr(block.position);
+			if (voxels != nullptr && *voxels == block.data.voxels_to_save) {
+				_voxels_to_save[block.lod].erase(block.position);
+			}
+			--_pending_save_count;
+
+			if (_pending_save_count == 0 && _waiting_for_flush) {
+				_waiting_for_flush = false;
+				_flush_semaphore->post();
+			}
+		}
+
+		blocks.clear();
+	}
+}
+
+void VoxelDataLoader::Processor::process_blocks(const InputBlock *inputs, OutputBlock *outputs, unsigned int count) {
+
+	const int bs = 1 << block_size_pow2;
+	Vector<VoxelStream::BlockRequest> requests;
+
+	for (unsigned int i = 0; i < count; ++i) {
+		const InputBlock &ib = inputs[i];
+
+		Ref<VoxelBuffer> buffer;
+		buffer.instance();
+		buffer->create(bs, bs, bs);
+		outputs[i].data.voxels_loaded = buffer;
+
+		// Voxels waiting to be saved are more recent than what the stream has
+		if (!loader->get_voxels_to_save(ib.position, ib.lod, **buffer)) {
+			VoxelStream::BlockRequest r;
+			r.voxel_buffer = buffer;
+			r.origin_in_voxels = ib.position * (bs << ib.lod);
+			r.lod = ib.lod;
+			requests.push_back(r);
+		}
+	}
+
+	if (!requests.empty()) {
+		if (stream_mutex != nullptr) {
+			MutexLock lock(stream_mutex);
+			stream->emerge_blocks(requests);
+		} else {
+			stream->emerge_blocks(requests);
+		}
+	}
+
+	for (unsigned int i = 0; i < count; ++i) {
+		// Blocks are kept in memory for a long time and mostly read, so store them compactly
+		outputs[i].data.voxels_loaded->compress();
+	}
 }
@@ -1,11 +1,9 @@
 #ifndef VOXEL_DATA_LOADER_H
 #define VOXEL_DATA_LOADER_H
 
+#include "../streams/voxel_stream.h"
 #include "block_thread_manager.h"
 
-class VoxelStream;
-class VoxelBuffer;
-
 class VoxelDataLoader {
 public:
 	struct InputBlockData {
@@ -16,16 +14,20 @@ public:
 		Ref<VoxelBuffer> voxels_loaded;
 	};
 
+	typedef VoxelBlockThreadInputBlock<InputBlockData> InputBlock;
+	typedef VoxelBlockThreadOutputBlock<OutputBlockData> OutputBlock;
+
 	struct Processor {
-		void process_block(const InputBlockData &input, OutputBlockData &output, Vector3i block_position, unsigned int lod);
+		void process_blocks(const InputBlock *inputs, OutputBlock *outputs, unsigned int count);
 
 		Ref<VoxelStream> stream;
+		// Set if the stream is also used by the saving thread
+		Mutex *stream_mutex = nullptr;
 		int block_size_pow2 = 0;
+		VoxelDataLoader *loader = nullptr;
 	};
 
 	typedef VoxelBlockThreadManager<InputBlockData, OutputBlockData, Processor> Mgr;
-	typedef Mgr::InputBlock InputBlock;
-	typedef Mgr::OutputBlock OutputBlock;
 	typedef Mgr::Input Input;
 	typedef Mgr::Output Output;
 	typedef Mgr::Stats Stats;
@@ -36,8 +38,42 @@ public:
 	void push(const Input &input) { _mgr->push(input); }
 	void pop(Output &output) { _mgr->pop(output); }
 
+	// Saves `voxels_to_save` of the given blocks from a dedicated thread, in the order they are given.
+	// Buffers must not be modified afterwards, so pass duplicates of those still in use.
+	// Loading a block which is still waiting to be saved gives the voxels to save instead of reading the stream.
+	void push_saves(const std::vector<InputBlock> &blocks);
+
+	// Blocks until all saves pushed so far are done
+	void flush_saves();
+
+	unsigned int get_pending_save_count() const;
+
 private:
+	bool get_voxels_to_save(Vector3i block_position, unsigned int lod, VoxelBuffer &out_buffer);
+
+	static void _save_thread_func(void *p_loader);
+	void save_thread_func();
+
 	Mgr *_mgr = nullptr;
+
+	Ref<VoxelStream> _stream;
+	int _block_size_pow2 = 0;
+
+	// Streams are not expected to be thread-safe, and the first loading thread uses the same as the saving thread
+	Mutex *_stream_mutex = nullptr;
+
+	// Accessed by both threads, guarded by the mutex
+	std::vector<InputBlock> _save_queue;
+	HashMap<Vector3i, Ref<VoxelBuffer>, Vector3iHasher> _voxels_to_save[Mgr::MAX_LOD];
+	unsigned int _pending_save_count = 0;
+	bool _save_thread_exit = false;
+	bool _waiting_for_flush = false;
+	Mutex *_save_mutex = nullptr;
+
+	Semaphore *_save_semaphore = nullptr;
+	// Posted when all saves are done while `flush_saves` is waiting
+	Semaphore *_flush_semaphore = nullptr;
+	Thread *_save_thread = nullptr;
 };
 
 #endif // VOXEL_DATA_LOADER_H
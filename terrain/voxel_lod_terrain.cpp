@@ -1,5 +1,6 @@
 #include "voxel_lod_terrain.h"
 #include "../math/rect3i.h"
+#include "../voxel_memory_pool.h"
 #include "../util/profiling_clock.h"
 #include "voxel_map.h"
 #include "voxel_mesh_updater.h"
@@ -55,7 +56,11 @@ unsigned int VoxelLodTerrain::get_block_size_pow2() const {
 void VoxelLodTerrain::set_stream(Ref<VoxelStream> p_stream) {
 	if (p_stream != _stream) {
 
+		// Edits belong to the previous stream
+		save_modified_blocks();
+
 		if (_stream_thread) {
+			// Waits for saves to complete
 			memdelete(_stream_thread);
 			_stream_thread = nullptr;
 		}
@@ -63,6 +68,9 @@ void VoxelLodTerrain::set_stream(Ref<VoxelStream> p_stream) {
 		_stream = p_stream;
 		_stream_thread = memnew(VoxelDataLoader(1, _stream, get_block_size_pow2()));
 
+		// Cached blocks came from the previous stream
+		_block_cache.clear();
+
 		// The whole map might change, so make all area dirty
 		// TODO Actually, we should regenerate the whole map, not just update all its blocks
 		make_all_view_dirty_deferred();
@@ -73,6 +81,7 @@ void VoxelLodTerrain::make_all_view_dirty_deferred() {
 	for (unsigned int i = 0; i < get_lod_count(); ++i) {
 		Lod &lod = _lods[i];
 		lod.last_view_distance_blocks = 0;
+		lod.last_unload_margin_blocks = 0;
 	}
 }
 
@@ -110,8 +119,17 @@ void VoxelLodTerrain::immerge_block(Vector3i block_pos, unsigned int lod_index)
 
 	Lod &lod = _lods[lod_index];
 
-	// TODO Schedule block saving when supported
-	lod.map->remove_block(block_pos, VoxelMap::NoAction());
+	// Saving is done by the stream thread, requests are sent before loading requests
+	VoxelBlock *block = lod.map->get_block(block_pos);
+	if (block != nullptr && block->needs_saving() && _stream.is_valid()) {
+		VoxelDataLoader::InputBlock input_block;
+		input_block.data.voxels_to_save = block->voxels->duplicate();
+		input_block.position = block_pos;
+		input_block.lod = lod_index;
+		_blocks_to_save.push_back(input_block);
+	}
+
+	lod.map->remove_block(block_pos, VoxelBlockCache::StoreAction(_block_cache));
 
 	lod.loading_blocks.erase(block_pos);
 
@@ -167,6 +185,7 @@ void VoxelLodTerrain::set_lod_count(unsigned int p_lod_count) {
 				if (lod.map.is_null()) {
 					lod.map.instance();
 					lod.map->set_lod_index(lod_index);
+					lod.map->set_dedup_enabled(_block_dedup_enabled);
 				} else {
 					lod.map->clear();
 				}
@@ -193,6 +212,53 @@ NodePath VoxelLodTerrain::get_viewer_path() const {
 	return _viewer_path;
 }
 
+void VoxelLodTerrain::set_block_dedup_enabled(bool enabled) {
+	_block_dedup_enabled = enabled;
+	for (unsigned int lod_index = 0; lod_index < get_lod_count(); ++lod_index) {
+		_lods[lod_index].map->set_dedup_enabled(enabled);
+	}
+}
+
+bool VoxelLodTerrain::is_block_dedup_enabled() const {
+	return _block_dedup_enabled;
+}
+
+void VoxelLodTerrain::set_compaction_time_budget_usec(int usec) {
+	ERR_FAIL_COND(usec < 0);
+	_compaction_time_budget_usec = usec;
+}
+
+int VoxelLodTerrain::get_compaction_time_budget_usec() const {
+	return _compaction_time_budget_usec;
+}
+
+void VoxelLodTerrain::set_compaction_compress_enabled(bool enabled) {
+	_compaction_compress_enabled = enabled;
+}
+
+bool VoxelLodTerrain::is_compaction_compress_enabled() const {
+	return _compaction_compress_enabled;
+}
+
+int VoxelLodTerrain::get_unload_margin_blocks() const {
+	return _unload_margin_blocks;
+}
+
+void VoxelLodTerrain::set_unload_margin_blocks(int margin) {
+	ERR_FAIL_COND(margin < 0);
+	// Blocks beyond the new margin will be removed in _process
+	_unload_margin_blocks = margin;
+}
+
+void VoxelLodTerrain::set_block_cache_memory_budget(int bytes) {
+	ERR_FAIL_COND(bytes < 0);
+	_block_cache.set_memory_budget(bytes);
+}
+
+int VoxelLodTerrain::get_block_cache_memory_budget() const {
+	return _block_cache.get_memory_budget();
+}
+
 int VoxelLodTerrain::get_block_region_extent() const {
 	// This is the radius of blocks around the viewer in which we may load them.
 	// It depends on the LOD split scale, which tells how close to a block we need to be for it to subdivide.
@@ -242,6 +308,51 @@ Vector3 VoxelLodTerrain::voxel_to_block_position(Vector3 vpos, unsigned int lod_
 	return bpos.to_vec3();
 }
 
+void VoxelLodTerrain::save_modified_blocks() {
+
+	// Called from several threads, blocks are copied in parallel and only adding them to the list is serialized
+	struct SaveAction {
+		std::vector<VoxelDataLoader::InputBlock> *blocks_to_save;
+		Mutex *mutex;
+		void operator()(VoxelBlock *block) {
+			if (block->needs_saving()) {
+				VoxelDataLoader::InputBlock input_block;
+				input_block.data.voxels_to_save = block->voxels->duplicate();
+				input_block.position = block->position;
+				input_block.lod = block->lod_index;
+				block->modified = false;
+				MutexLock lock(mutex);
+				blocks_to_save->push_back(input_block);
+			}
+		}
+	};
+
+	if (_stream.is_valid()) {
+		SaveAction save_action;
+		save_action.blocks_to_save = &_blocks_to_save;
+		save_action.mutex = Mutex::create();
+		// Blocks checked per chunk of work
+		const unsigned int grain = 64;
+		parallel_for_all_blocks(save_action, grain);
+		memdelete(save_action.mutex);
+	}
+	send_blocks_to_save();
+}
+
+void VoxelLodTerrain::flush_saves() {
+	send_blocks_to_save();
+	if (_stream_thread) {
+		_stream_thread->flush_saves();
+	}
+}
+
+void VoxelLodTerrain::send_blocks_to_save() {
+	if (_stream_thread) {
+		_stream_thread->push_saves(_blocks_to_save);
+	}
+	_blocks_to_save.clear();
+}
+
 void VoxelLodTerrain::_notification(int p_what) {
 
 	struct EnterWorldAction {
@@ -281,6 +392,8 @@ void VoxelLodTerrain::_notification(int p_what) {
 			break;
 
 		case NOTIFICATION_EXIT_TREE:
+			save_modified_blocks();
+			flush_saves();
 			break;
 
 		case NOTIFICATION_ENTER_WORLD:
@@ -371,7 +484,7 @@ bool VoxelLodTerrain::check_block_loaded_and_updated(const Vector3i &p_bpos, uns
 
 	if (!block->has_been_meshed()) {
 		if (!block->is_mesh_update_scheduled()) {
-			if (lod.map->is_block_surrounded(block->position)) {
+			if (block->is_surrounded()) {
 
 				lod.blocks_pending_update.push_back(block->position);
 				block->set_mesh_state(VoxelBlock::MESH_UPDATE_NOT_SENT);
@@ -440,6 +553,11 @@ void VoxelLodTerrain::_process() {
 			Rect3i new_box = Rect3i::from_center_extents(viewer_block_pos_within_lod, Vector3i(block_region_extent));
 			Rect3i prev_box = Rect3i::from_center_extents(lod.last_viewer_block_pos, Vector3i(lod.last_view_distance_blocks));
 
+			// Blocks leaving the region are only unloaded once they get beyond the margin,
+			// so a viewer moving back and forth across a block boundary doesn't reload them every time
+			Rect3i new_keep_box = new_box.padded(_unload_margin_blocks);
+			Rect3i prev_keep_box = prev_box.padded(lod.last_unload_margin_blocks);
+
 			// Eliminate pending blocks that aren't needed
 
 			// No need to do it on those arrays, they are always clear at this point.
@@ -449,33 +567,66 @@ void VoxelLodTerrain::_process() {
 			//remove_positions_outside_box(lod.blocks_to_load, new_box, lod.loading_blocks);
 			//remove_positions_outside_box(lod.blocks_pending_update, new_box, lod.loading_blocks);
 
-			if (prev_box != new_box) {
+			if (prev_box != new_box || prev_keep_box != new_keep_box) {
 
-				Rect3i bounds = Rect3i::get_bounding_box(prev_box, new_box);
-				Vector3i max = bounds.pos + bounds.size;
+				// Only blocks in the difference between boxes are visited,
+				// so the cost doesn't depend on how far the viewer moved
 
-				// TODO This will explode if the player teleports!
-				// There is a smarter way to only iterate relevant blocks
+				struct UnloadAction {
+					VoxelLodTerrain *self;
+					unsigned int lod_index;
 
-				Vector3i pos;
-				for (pos.z = bounds.pos.z; pos.z < max.z; ++pos.z) {
-					for (pos.y = bounds.pos.y; pos.y < max.y; ++pos.y) {
-						for (pos.x = bounds.pos.x; pos.x < max.x; ++pos.x) {
-
-							bool prev_contains = prev_box.contains(pos);
-							bool new_contains = new_box.contains(pos);
-
-							if (prev_contains && !new_contains) {
-								// Unload block
-								immerge_block(pos, lod_index);
+					void operator()(const Rect3i &box) {
+						const Vector3i max = box.pos + box.size;
+						Vector3i pos;
+						for (pos.z = box.pos.z; pos.z < max.z; ++pos.z) {
+							for (pos.y = box.pos.y; pos.y < max.y; ++pos.y) {
+								for (pos.x = box.pos.x; pos.x < max.x; ++pos.x) {
+									self->immerge_block(pos, lod_index);
+								}
 							}
 						}
 					}
-				}
+				};
+
+				// Blocks entering the region are loaded on demand by the octree,
+				// this only counts those which were kept in the margin
+				struct EnterAction {
+					VoxelLodTerrain *self;
+					VoxelMap *map;
+					Rect3i prev_keep_box;
+
+					struct CountBlocks {
+						uint64_t *count;
+						void operator()(VoxelBlock *block) {
+							++(*count);
+						}
+					};
+
+					void operator()(const Rect3i &box) {
+						// Only the part which was in the margin can have kept blocks
+						map->for_blocks_in_box(box.clipped(prev_keep_box), CountBlocks{ &self->_stats.unloads_avoided });
+					}
+				};
+
+				UnloadAction unload_action;
+				unload_action.self = this;
+				unload_action.lod_index = lod_index;
+				prev_keep_box.difference(new_keep_box, unload_action);
+
+				EnterAction enter_action;
+				enter_action.self = this;
+				enter_action.map = *lod.map;
+				enter_action.prev_keep_box = prev_keep_box;
+				new_box.difference(prev_box, enter_action);
 			}
 
+			// Loaded blocks stay within that box, so they can be stored in a grid following it
+			lod.map->set_grid_region(new_keep_box);
+
 			lod.last_viewer_block_pos = viewer_block_pos_within_lod;
 			lod.last_view_distance_blocks = block_region_extent;
+			lod.last_unload_margin_blocks = _unload_margin_blocks;
 		}
 	}
 
@@ -548,6 +699,9 @@ void VoxelLodTerrain::_process() {
 		_stats.blocked_lods = subdivide_action.blocked_count + unsubdivide_action.blocked_count;
 	}
 
+	// Saves go first, so blocks loaded again right after being unloaded get their latest voxels
+	send_blocks_to_save();
+
 	// Send block loading requests
 	{
 		VoxelDataLoader::Input input;
@@ -560,8 +714,21 @@ void VoxelLodTerrain::_process() {
 			Lod &lod = _lods[lod_index];
 
 			for (unsigned int i = 0; i < lod.blocks_to_load.size(); ++i) {
+				const Vector3i block_pos = lod.blocks_to_load[i];
+
+				// Blocks unloaded recently can be revived without going through the stream
+				Ref<VoxelBuffer> cached_voxels = _block_cache.take(block_pos, lod_index);
+				if (cached_voxels.is_valid()) {
+					VoxelDataLoader::OutputBlock ob;
+					ob.position = block_pos;
+					ob.lod = lod_index;
+					ob.data.voxels_loaded = cached_voxels;
+					_blocks_revived_from_cache.push_back(ob);
+					continue;
+				}
+
 				VoxelDataLoader::InputBlock input_block;
-				input_block.position = lod.blocks_to_load[i];
+				input_block.position = block_pos;
 				input_block.lod = lod_index;
 				input.blocks.push_back(input_block);
 			}
@@ -583,6 +750,12 @@ void VoxelLodTerrain::_process() {
 		_stream_thread->pop(output);
 		_stats.stream = output.stats;
 
+		// Revived blocks are handled like loaded ones
+		for (unsigned int i = 0; i < _blocks_revived_from_cache.size(); ++i) {
+			output.blocks.push_back(_blocks_revived_from_cache[i]);
+		}
+		_blocks_revived_from_cache.clear();
+
 		//print_line(String("Loaded {0} blocks").format(varray(output.emerged_blocks.size())));
 
 		for (int i = 0; i < output.blocks.size(); ++i) {
@@ -668,6 +841,10 @@ void VoxelLodTerrain::_process() {
 						block_size + 2 * padding,
 						block_size + 2 * padding);
 
+				// Copies convert voxels to the format of the destination, so use the one of the block
+				nbuffer->set_channel_format(VoxelBuffer::CHANNEL_ISOLEVEL,
+						block->voxels->get_channel_format(VoxelBuffer::CHANNEL_ISOLEVEL));
+
 				unsigned int channels_mask = (1 << VoxelBuffer::CHANNEL_ISOLEVEL);
 				lod.map->get_buffer_copy(lod.map->block_to_voxel(block_pos) - Vector3i(padding), **nbuffer, channels_mask);
 
@@ -781,6 +958,26 @@ void VoxelLodTerrain::_process() {
 
 	_stats.time_process_update_responses = profiling_clock.restart();
 
+	// Use some of the remaining frame time to free memory blocks no longer need.
+	// All LODs share the same budget.
+	{
+		VoxelMap::CompactionStats compaction_stats;
+		const uint64_t time_before = OS::get_singleton()->get_ticks_usec();
+
+		for (unsigned int lod_index = 0; lod_index < get_lod_count(); ++lod_index) {
+			const uint64_t time_spent = OS::get_singleton()->get_ticks_usec() - time_before;
+			if (time_spent >= (uint64_t)_compaction_time_budget_usec) {
+				break;
+			}
+			_lods[lod_index].map->compact(_compaction_time_budget_usec - time_spent, _compaction_compress_enabled, compaction_stats);
+		}
+
+		_stats.compaction_processed_blocks = compaction_stats.processed_blocks;
+		_stats.compaction_reclaimed_bytes = compaction_stats.reclaimed_bytes;
+	}
+
+	_stats.time_compaction = profiling_clock.restart();
+
 	_stats.time_process_lod = profiling_clock.restart();
 }
 
@@ -792,14 +989,33 @@ Dictionary VoxelLodTerrain::get_stats() const {
 	process["time_request_blocks_to_update"] = _stats.time_request_blocks_to_update;
 	process["time_process_update_responses"] = _stats.time_process_update_responses;
 	process["time_process_lod"] = _stats.time_process_lod;
+	process["time_compaction"] = _stats.time_compaction;
+
+	Dictionary compaction;
+	compaction["processed_blocks"] = _stats.compaction_processed_blocks;
+	compaction["reclaimed_bytes"] = _stats.compaction_reclaimed_bytes;
+
+	Dictionary stream = VoxelDataLoader::Mgr::to_dictionary(_stats.stream);
+	stream["pending_saves"] = _stream_thread ? _stream_thread->get_pending_save_count() : 0;
 
 	Dictionary d;
-	d["stream"] = VoxelDataLoader::Mgr::to_dictionary(_stats.stream);
+	d["stream"] = stream;
 	d["updater"] = VoxelMeshUpdater::Mgr::to_dictionary(_stats.updater);
 	d["process"] = process;
 	d["blocked_lods"] = _stats.blocked_lods;
 	d["dropped_block_loads"] = _stats.dropped_block_loads;
 	d["dropped_block_meshs"] = _stats.dropped_block_meshs;
+	d["unloads_avoided"] = _stats.unloads_avoided;
+	d["compaction"] = compaction;
+
+	Array dedup;
+	for (unsigned int lod_index = 0; lod_index < get_lod_count(); ++lod_index) {
+		dedup.append(_lods[lod_index].map->get_dedup_statistics());
+	}
+	d["dedup"] = dedup;
+
+	d["memory_pool"] = VoxelMemoryPool::get_singleton()->get_stats();
+	d["block_cache"] = _block_cache.get_statistics();
 
 	return d;
 }
@@ -824,6 +1040,24 @@ void VoxelLodTerrain::_bind_methods() {
 	ClassDB::bind_method(D_METHOD("set_lod_split_scale", "lod_split_scale"), &VoxelLodTerrain::set_lod_split_scale);
 	ClassDB::bind_method(D_METHOD("get_lod_split_scale"), &VoxelLodTerrain::get_lod_split_scale);
 
+	ClassDB::bind_method(D_METHOD("set_unload_margin_blocks", "margin"), &VoxelLodTerrain::set_unload_margin_blocks);
+	ClassDB::bind_method(D_METHOD("get_unload_margin_blocks"), &VoxelLodTerrain::get_unload_margin_blocks);
+
+	ClassDB::bind_method(D_METHOD("set_block_dedup_enabled", "enabled"), &VoxelLodTerrain::set_block_dedup_enabled);
+	ClassDB::bind_method(D_METHOD("is_block_dedup_enabled"), &VoxelLodTerrain::is_block_dedup_enabled);
+
+	ClassDB::bind_method(D_METHOD("set_compaction_time_budget_usec", "usec"), &VoxelLodTerrain::set_compaction_time_budget_usec);
+	ClassDB::bind_method(D_METHOD("get_compaction_time_budget_usec"), &VoxelLodTerrain::get_compaction_time_budget_usec);
+
+	ClassDB::bind_method(D_METHOD("set_compaction_compress_enabled", "enabled"), &VoxelLodTerrain::set_compaction_compress_enabled);
+	ClassDB::bind_method(D_METHOD("is_compaction_compress_enabled"), &VoxelLodTerrain::is_compaction_compress_enabled);
+
+	ClassDB::bind_method(D_METHOD("save_modified_blocks"), &VoxelLodTerrain::save_modified_blocks);
+	ClassDB::bind_method(D_METHOD("flush_saves"), &VoxelLodTerrain::flush_saves);
+
+	ClassDB::bind_method(D_METHOD("set_block_cache_memory_budget", "bytes"), &VoxelLodTerrain::set_block_cache_memory_budget);
+	ClassDB::bind_method(D_METHOD("get_block_cache_memory_budget"), &VoxelLodTerrain::get_block_cache_memory_budget);
+
 	ClassDB::bind_method(D_METHOD("get_block_region_extent"), &VoxelLodTerrain::get_block_region_extent);
 	ClassDB::bind_method(D_METHOD("get_block_info", "block_pos", "lod"), &VoxelLodTerrain::get_block_info);
 	ClassDB::bind_method(D_METHOD("get_stats"), &VoxelLodTerrain::get_stats);
@@ -831,8 +1065,13 @@ void VoxelLodTerrain::_bind_methods() {
 
 	ADD_PROPERTY(PropertyInfo(Variant::OBJECT, "stream", PROPERTY_HINT_RESOURCE_TYPE, "VoxelStream"), "set_stream", "get_stream");
 	ADD_PROPERTY(PropertyInfo(Variant::INT, "view_distance"), "set_view_distance", "get_view_distance");
+	ADD_PROPERTY(PropertyInfo(Variant::INT, "unload_margin_blocks"), "set_unload_margin_blocks", "get_unload_margin_blocks");
 	ADD_PROPERTY(PropertyInfo(Variant::INT, "lod_count"), "set_lod_count", "get_lod_count");
 	ADD_PROPERTY(PropertyInfo(Variant::REAL, "lod_split_scale"), "set_lod_split_scale", "get_lod_split_scale");
 	ADD_PROPERTY(PropertyInfo(Variant::NODE_PATH, "viewer_path"), "set_viewer_path", "get_viewer_path");
 	ADD_PROPERTY(PropertyInfo(Variant::OBJECT, "material", PROPERTY_HINT_RESOURCE_TYPE, "Material"), "set_material", "get_material");
+	ADD_PROPERTY(PropertyInfo(Variant::INT, "block_cache_memory_budget"), "set_block_cache_memory_budget", "get_block_cache_memory_budget");
+	ADD_PROPERTY(PropertyInfo(Variant::BOOL, "block_dedup_enabled"), "set_block_dedup_enabled", "is_block_dedup_enabled");
+	ADD_PROPERTY(PropertyInfo(Variant::INT, "compaction_time_budget_usec"), "set_compaction_time_budget_usec", "get_compaction_time_budget_usec");
+	ADD_PROPERTY(PropertyInfo(Variant::BOOL, "compaction_compress_enabled"), "set_compaction_compress_enabled", "is_compaction_compress_enabled");
 }
@@ -3,6 +3,7 @@
 
 #include "../streams/voxel_stream.h"
 #include "lod_octree.h"
+#include "voxel_block_cache.h"
 #include "voxel_data_loader.h"
 #include "voxel_map.h"
 #include "voxel_mesh_updater.h"
@@ -41,6 +42,32 @@ public:
 	void set_viewer_path(NodePath path);
 	NodePath get_viewer_path() const;
 
+	// How many blocks beyond the region of each LOD are kept loaded before being unloaded
+	int get_unload_margin_blocks() const;
+	void set_unload_margin_blocks(int margin);
+
+	// Time spent each frame freeing memory blocks no longer need, in microseconds. 0 disables it
+	void set_compaction_time_budget_usec(int usec);
+	int get_compaction_time_budget_usec() const;
+
+	// If enabled, blocks which haven't been edited recently get compressed by the compaction
+	void set_compaction_compress_enabled(bool enabled);
+	bool is_compaction_compress_enabled() const;
+
+	// Loaded blocks with identical voxels share them, see VoxelMap::set_dedup_enabled
+	void set_block_dedup_enabled(bool enabled);
+	bool is_block_dedup_enabled() const;
+
+	// Saves blocks edited since they were loaded, without unloading them.
+	// Saving happens in the background, use `flush_saves` to wait for it.
+	void save_modified_blocks();
+	// Blocks until all blocks unloaded or saved so far are written by the stream
+	void flush_saves();
+
+	// Unloaded blocks of all LODs are kept compressed within this amount of bytes, 0 disables it
+	void set_block_cache_memory_budget(int bytes);
+	int get_block_cache_memory_budget() const;
+
 	int get_block_region_extent() const;
 	Dictionary get_block_info(Vector3 fbpos, unsigned int lod_index) const;
 	Vector3 voxel_to_block_position(Vector3 vpos, unsigned int lod_index) const;
@@ -53,9 +80,13 @@ public:
 		uint64_t time_request_blocks_to_update = 0;
 		uint64_t time_process_update_responses = 0;
 		uint64_t time_process_lod = 0;
+		uint64_t time_compaction = 0;
 		int blocked_lods = 0;
 		int dropped_block_loads = 0;
 		int dropped_block_meshs = 0;
+		uint64_t unloads_avoided = 0;
+		unsigned int compaction_processed_blocks = 0;
+		uint64_t compaction_reclaimed_bytes = 0;
 	};
 
 	Dictionary get_stats() const;
@@ -72,6 +103,7 @@ private:
 	void make_all_view_dirty_deferred();
 	Spatial *get_viewer() const;
 	void immerge_block(Vector3i block_pos, unsigned int lod_index);
+	void send_blocks_to_save();
 	void reset_updater();
 	Vector3 get_viewer_pos(Vector3 &out_direction) const;
 	void try_schedule_loading_with_neighbors(const Vector3i &p_bpos, unsigned int lod_index);
@@ -86,6 +118,18 @@ private:
 		}
 	}
 
+	// Calls `action(block)` for blocks of all LODs, in chunks of `grain` blocks processed by several threads
+	template <typename A>
+	void parallel_for_all_blocks(A action, unsigned int grain) {
+		std::vector<VoxelBlock *> blocks;
+		for (int lod_index = 0; lod_index < MAX_LOD; ++lod_index) {
+			if (_lods[lod_index].map.is_valid()) {
+				_lods[lod_index].map->get_all_blocks(blocks);
+			}
+		}
+		parallel_for_each(blocks.data(), blocks.size(), grain, action);
+	}
+
 	// TODO Dare having a grid of octrees for infinite world?
 	// This octree doesn't hold any data... hence bool.
 	LodOctree<bool> _lod_octree;
@@ -96,9 +140,19 @@ private:
 	VoxelDataLoader *_stream_thread = nullptr;
 	VoxelMeshUpdater *_block_updater = nullptr;
 	std::vector<VoxelMeshUpdater::OutputBlock> _blocks_pending_main_thread_update;
+	std::vector<VoxelDataLoader::OutputBlock> _blocks_revived_from_cache;
+	std::vector<VoxelDataLoader::InputBlock> _blocks_to_save;
+	VoxelBlockCache _block_cache;
 
 	Ref<Material> _material;
 
+	int _unload_margin_blocks = 0;
+
+	bool _block_dedup_enabled = false;
+
+	int _compaction_time_budget_usec = 500;
+	bool _compaction_compress_enabled = false;
+
 	// Each LOD works in a set of coordinates spanning 2x more voxels the higher their index is
 	struct Lod {
 		Ref<VoxelMap> map;
@@ -108,6 +162,7 @@ private:
 		// These are relative to this LOD, in block coordinates
 		Vector3i last_viewer_block_pos;
 		int last_view_distance_blocks = 0;
+		int last_unload_margin_blocks = 0;
 
 		// Members for memory caching
 		std::vector<Vector3i> blocks_to_load;
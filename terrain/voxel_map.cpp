@@ -1,8 +1,10 @@
 #include "voxel_map.h"
 #include "../cube_tables.h"
+#include "../voxel_memory_pool.h"
 #include "voxel_block.h"
 
 #include "core/os/os.h"
+#include <core/sort_array.h>
 
 VoxelMap::VoxelMap() :
 		_last_accessed_block(NULL) {
@@ -40,6 +42,118 @@ unsigned int VoxelMap::get_lod_index() const {
 	return _lod_index;
 }
 
+void VoxelMap::set_bricks_enabled(bool enabled) {
+	if (_bricks_enabled == enabled) {
+		return;
+	}
+	_bricks_enabled = enabled;
+
+	struct SetBricked {
+		bool enabled;
+		void operator()(VoxelBlock *block) {
+			block->voxels->set_bricked(enabled);
+		}
+	};
+	for_all_blocks(SetBricked{ enabled });
+
+	// Shared buffers were stored with the previous layout, and blocks don't share them anymore
+	_dedup_buffers.clear();
+}
+
+bool VoxelMap::is_bricks_enabled() const {
+	return _bricks_enabled;
+}
+
+void VoxelMap::set_dedup_enabled(bool enabled) {
+	_dedup_enabled = enabled;
+	if (!enabled) {
+		_dedup_buffers.clear();
+	}
+}
+
+bool VoxelMap::is_dedup_enabled() const {
+	return _dedup_enabled;
+}
+
+Dictionary VoxelMap::get_dedup_statistics() const {
+	Dictionary d;
+	d["unique_buffers"] = _dedup_buffers.size();
+	d["shared_blocks"] = _dedup_shared_count;
+	d["total_blocks"] = get_block_count();
+	return d;
+}
+
+void VoxelMap::dedup_buffer(VoxelBuffer &buffer) {
+
+	// Uniform buffers don't take memory already
+	bool has_data = false;
+	for (unsigned int i = 0; i < VoxelBuffer::MAX_CHANNELS; ++i) {
+		if (!buffer.is_uniform(i)) {
+			has_data = true;
+			break;
+		}
+	}
+	if (!has_data) {
+		return;
+	}
+
+	const uint32_t hash = buffer.get_content_hash();
+	Ref<VoxelBuffer> *pptr = _dedup_buffers.getptr(hash);
+
+	if (pptr == NULL) {
+		// First time this content is seen.
+		// Keep a buffer sharing its voxels, which will never write them.
+		Ref<VoxelBuffer> shared_buffer;
+		shared_buffer.instance();
+		shared_buffer->create(buffer.get_size().x, buffer.get_size().y, buffer.get_size().z);
+		for (unsigned int i = 0; i < VoxelBuffer::MAX_CHANNELS; ++i) {
+			shared_buffer->copy_from(buffer, i);
+		}
+		_dedup_buffers.set(hash, shared_buffer);
+
+		// Unloaded blocks leave unused buffers behind
+		if (_dedup_buffers.size() > 2 * get_block_count() + 64) {
+			prune_dedup_buffers();
+		}
+		return;
+	}
+
+	const VoxelBuffer &shared_buffer = **(*pptr);
+	// Hashes can collide, in which case the buffer is just not shared
+	if (!buffer.has_same_content(shared_buffer)) {
+		return;
+	}
+
+	for (unsigned int i = 0; i < VoxelBuffer::MAX_CHANNELS; ++i) {
+		buffer.copy_from(shared_buffer, i);
+	}
+	++_dedup_shared_count;
+}
+
+// Forgets shared buffers no block uses anymore
+void VoxelMap::prune_dedup_buffers() {
+	std::vector<uint32_t> unused_hashes;
+
+	const uint32_t *key = NULL;
+	while ((key = _dedup_buffers.next(key))) {
+		const VoxelBuffer &shared_buffer = **_dedup_buffers.get(*key);
+		bool used = false;
+		for (unsigned int i = 0; i < VoxelBuffer::MAX_CHANNELS; ++i) {
+			if (shared_buffer.is_channel_shared(i)) {
+				used = true;
+				break;
+			}
+		}
+		if (!used) {
+			unused_hashes.push_back(*key);
+		}
+	}
+
+	for (unsigned int i = 0; i < unused_hashes.size(); ++i) {
+		_dedup_buffers.erase(unused_hashes[i]);
+	}
+}
+
 int VoxelMap::get_voxel(Vector3i pos, unsigned int c) {
 	Vector3i bpos = voxel_to_block(pos);
 	VoxelBlock *block = get_block(bpos);
@@ -59,6 +173,7 @@ VoxelBlock *VoxelMap::get_or_create_block_at_voxel_pos(Vector3i pos) {
 		Ref<VoxelBuffer> buffer(memnew(VoxelBuffer));
 		buffer->create(_block_size, _block_size, _block_size);
 		buffer->set_default_values(_default_voxel);
+		buffer->set_bricked(_bricks_enabled);
 
 		block = VoxelBlock::create(bpos, buffer, _block_size, _lod_index);
 
@@ -72,6 +187,7 @@ void VoxelMap::set_voxel(int value, Vector3i pos, unsigned int c) {
 
 	VoxelBlock *block = get_or_create_block_at_voxel_pos(pos);
 	block->voxels->set_voxel(value, to_local(pos), c);
+	queue_modified_block(*block);
 }
 
 float VoxelMap::get_voxel_f(int x, int y, int z, unsigned int c) {
@@ -92,6 +208,100 @@ void VoxelMap::set_voxel_f(real_t value, int x, int y, int z, unsigned int c) {
 	VoxelBlock *block = get_or_create_block_at_voxel_pos(pos);
 	Vector3i lpos = to_local(pos);
 	block->voxels->set_voxel_f(value, lpos.x, lpos.y, lpos.z, c);
+	queue_modified_block(*block);
+}
+
+namespace {
+
+struct EditRef {
+	Vector3i block_pos;
+	unsigned int index;
+};
+
+// Groups edits by block, keeping their original order within each block
+struct EditRefComparator {
+	inline bool operator()(const EditRef &a, const EditRef &b) const {
+		if (a.block_pos.z != b.block_pos.z) {
+			return a.block_pos.z < b.block_pos.z;
+		}
+		if (a.block_pos.x != b.block_pos.x) {
+			return a.block_pos.x < b.block_pos.x;
+		}
+		if (a.block_pos.y != b.block_pos.y) {
+			return a.block_pos.y < b.block_pos.y;
+		}
+		return a.index < b.index;
+	}
+};
+
+} // namespace
+
+void VoxelMap::apply_edits(const Vector<Edit> &edits) {
+
+	if (edits.size() == 0) {
+		return;
+	}
+
+	std::vector<EditRef> refs;
+	refs.resize(edits.size());
+	for (int i = 0; i < edits.size(); ++i) {
+		EditRef &ref = refs[i];
+		ref.block_pos = voxel_to_block(edits[i].position);
+		ref.index = i;
+	}
+
+	SortArray<EditRef, EditRefComparator> sorter;
+	sorter.sort(refs.data(), refs.size());
+
+	VoxelBlock *block = NULL;
+
+	for (unsigned int i = 0; i < refs.size(); ++i) {
+		const EditRef &ref = refs[i];
+
+		if (block == NULL || block->position != ref.block_pos) {
+			if (block != NULL) {
+				queue_modified_block(*block);
+			}
+			block = get_or_create_block_at_voxel_pos(block_to_voxel(ref.block_pos));
+		}
+
+		const Edit &edit = edits[ref.index];
+		const Vector3i lpos = to_local(edit.position);
+		if (edit.is_float) {
+			block->voxels->set_voxel_f(edit.value_f, lpos.x, lpos.y, lpos.z, edit.channel);
+		} else {
+			block->voxels->set_voxel(edit.value, lpos, edit.channel);
+		}
+	}
+
+	queue_modified_block(*block);
+}
+
+void VoxelMap::do_sphere(Vector3 center, real_t radius, VoxelIsoSurfaceTool::Operation op) {
+
+	// The SDF changes beyond the radius, so blocks are taken with a margin
+	const Vector3 margin(radius + 2, radius + 2, radius + 2);
+	const Vector3i min_block_pos = voxel_to_block(Vector3i(center - margin));
+	const Vector3i max_block_pos = voxel_to_block(Vector3i(center + margin));
+
+	Ref<VoxelIsoSurfaceTool> tool;
+	tool.instance();
+
+	Vector3i bpos;
+	for (bpos.z = min_block_pos.z; bpos.z <= max_block_pos.z; ++bpos.z) {
+		for (bpos.x = min_block_pos.x; bpos.x <= max_block_pos.x; ++bpos.x) {
+			for (bpos.y = min_block_pos.y; bpos.y <= max_block_pos.y; ++bpos.y) {
+
+				VoxelBlock *block = get_or_create_block_at_voxel_pos(block_to_voxel(bpos));
+
+				tool->set_buffer(block->voxels);
+				tool->set_offset(-block_to_voxel(bpos).to_vec3());
+				tool->do_sphere(center, radius, op);
+
+				queue_modified_block(*block);
+			}
+		}
+	}
 }
 
 void VoxelMap::set_default_voxel(int value, unsigned int channel) {
@@ -108,6 +318,13 @@ VoxelBlock *VoxelMap::get_block(Vector3i bpos) {
 	if (_last_accessed_block && _last_accessed_block->position == bpos) {
 		return _last_accessed_block;
 	}
+	if (_grid_box.contains(bpos)) {
+		VoxelBlock *block = _grid[get_grid_index(bpos)];
+		if (block) {
+			_last_accessed_block = block;
+		}
+		return block;
+	}
 	VoxelBlock **p = _blocks.getptr(bpos);
 	if (p) {
 		_last_accessed_block = *p;
@@ -121,6 +338,9 @@ const VoxelBlock *VoxelMap::get_block(Vector3i bpos) const {
 	if (_last_accessed_block && _last_accessed_block->position == bpos) {
 		return _last_accessed_block;
 	}
+	if (_grid_box.contains(bpos)) {
+		return _grid[get_grid_index(bpos)];
+	}
 	const VoxelBlock *const *p = _blocks.getptr(bpos);
 	if (p) {
 		const VoxelBlock *block = *p;
@@ -135,89 +355,460 @@ void VoxelMap::set_block(Vector3i bpos, VoxelBlock *block) {
 	if (_last_accessed_block == NULL || _last_accessed_block->position == bpos) {
 		_last_accessed_block = block;
 	}
-	_blocks.set(bpos, block);
+	if (_grid_box.contains(bpos)) {
+		VoxelBlock *&slot = _grid[get_grid_index(bpos)];
+		if (slot == NULL) {
+			++_grid_block_count;
+		}
+		slot = block;
+	} else {
+		_blocks.set(bpos, block);
+	}
+	update_neighbor_masks(bpos, block);
 }
 
 void VoxelMap::remove_block_internal(Vector3i bpos) {
 	// This function assumes the block is already freed
-	_blocks.erase(bpos);
+	if (_grid_box.contains(bpos)) {
+		VoxelBlock *&slot = _grid[get_grid_index(bpos)];
+		if (slot == NULL) {
+			return;
+		}
+		slot = NULL;
+		--_grid_block_count;
+	} else {
+		if (!_blocks.erase(bpos)) {
+			return;
+		}
+	}
+	update_neighbor_masks(bpos, NULL);
+}
+
+// Updates neighbor masks after a block got added or removed.
+// This is the only place neighbors are looked up, so checking if a block is surrounded is cheap.
+void VoxelMap::update_neighbor_masks(Vector3i bpos, VoxelBlock *block) {
+	if (block != NULL) {
+		block->neighbor_mask = VoxelBlock::get_neighbor_bit(Vector3i());
+	}
+	for (unsigned int i = 0; i < Cube::MOORE_NEIGHBORING_3D_COUNT; ++i) {
+		const Vector3i offset = Cube::g_moore_neighboring_3d[i];
+		VoxelBlock *neighbor = get_block(bpos + offset);
+		if (neighbor == NULL) {
+			continue;
+		}
+		// Seen from the neighbor, this block is at the opposite offset
+		const uint32_t bit = VoxelBlock::get_neighbor_bit(-offset);
+		if (block != NULL) {
+			neighbor->neighbor_mask |= bit;
+			block->neighbor_mask |= VoxelBlock::get_neighbor_bit(offset);
+		} else {
+			neighbor->neighbor_mask &= ~bit;
+		}
+	}
+}
+
+void VoxelMap::set_grid_region(Rect3i box) {
+	if (box == _grid_box) {
+		return;
+	}
+
+	const Vector3i capacity = box.is_empty() ?
+									  Vector3i() :
+									  Vector3i(next_power_of_2(box.size.x), next_power_of_2(box.size.y), next_power_of_2(box.size.z));
+
+	if (capacity != _grid_capacity) {
+		// Slots change, so all blocks have to be moved
+		move_blocks_from_grid_to_map(_grid_box);
+
+		_grid_box = box;
+		_grid_capacity = capacity;
+		_grid_mask = capacity - Vector3i(1);
+		_grid.clear();
+		_grid.resize(capacity.x * capacity.y * capacity.z, NULL);
+
+		if (!box.is_empty()) {
+			if (_blocks.size() > 0) {
+				move_blocks_from_map_to_grid(box);
+			}
+		}
+		return;
+	}
+
+	// Blocks present in both boxes keep their slot, only slabs leaving or entering need to be moved.
+	// Leaving slabs go first, because their slots get reused by entering ones.
+	struct LeavingSlabAction {
+		VoxelMap *map;
+		void operator()(Rect3i slab) {
+			map->move_blocks_from_grid_to_map(slab);
+		}
+	};
+	struct EnteringSlabAction {
+		VoxelMap *map;
+		void operator()(Rect3i slab) {
+			map->move_blocks_from_map_to_grid(slab);
+		}
+	};
+
+	const Rect3i prev_box = _grid_box;
+	prev_box.difference(box, LeavingSlabAction{ this });
+
+	_grid_box = box;
+
+	if (_blocks.size() > 0) {
+		box.difference(prev_box, EnteringSlabAction{ this });
+	}
+}
+
+// Moves blocks of the grid found in the given box into the map. The grid box must not have changed yet.
+void VoxelMap::move_blocks_from_grid_to_map(Rect3i box) {
+	if (_grid_block_count == 0) {
+		return;
+	}
+	const Vector3i max = box.pos + box.size;
+	Vector3i bpos;
+	for (bpos.z = box.pos.z; bpos.z < max.z; ++bpos.z) {
+		for (bpos.x = box.pos.x; bpos.x < max.x; ++bpos.x) {
+			for (bpos.y = box.pos.y; bpos.y < max.y; ++bpos.y) {
+				VoxelBlock *&slot = _grid[get_grid_index(bpos)];
+				if (slot != NULL) {
+					_blocks.set(bpos, slot);
+					slot = NULL;
+					--_grid_block_count;
+				}
+			}
+		}
+	}
+}
+
+// Moves blocks of the map found in the given box into the grid. The grid box must already include it.
+void VoxelMap::move_blocks_from_map_to_grid(Rect3i box) {
+	const unsigned int volume = box.size.x * box.size.y * box.size.z;
+
+	if ((unsigned int)_blocks.size() < volume) {
+		// Fewer blocks than cells, iterate the map instead
+		Vector<Vector3i> moved_positions;
+		const Vector3i *key = NULL;
+		while ((key = _blocks.next(key))) {
+			if (box.contains(*key)) {
+				moved_positions.push_back(*key);
+			}
+		}
+		for (int i = 0; i < moved_positions.size(); ++i) {
+			const Vector3i bpos = moved_positions[i];
+			_grid[get_grid_index(bpos)] = _blocks.get(bpos);
+			_blocks.erase(bpos);
+			++_grid_block_count;
+		}
+
+	} else {
+		const Vector3i max = box.pos + box.size;
+		Vector3i bpos;
+		for (bpos.z = box.pos.z; bpos.z < max.z; ++bpos.z) {
+			for (bpos.x = box.pos.x; bpos.x < max.x; ++bpos.x) {
+				for (bpos.y = box.pos.y; bpos.y < max.y; ++bpos.y) {
+					VoxelBlock **pptr = _blocks.getptr(bpos);
+					if (pptr != NULL) {
+						_grid[get_grid_index(bpos)] = *pptr;
+						_blocks.erase(bpos);
+						++_grid_block_count;
+					}
+				}
+			}
+		}
+	}
 }
 
 VoxelBlock *VoxelMap::set_block_buffer(Vector3i bpos, Ref<VoxelBuffer> buffer) {
 	ERR_FAIL_COND_V(buffer.is_null(), nullptr);
+	// Bricked before sharing, so it won't allocate new bricks afterwards
+	if (_bricks_enabled) {
+		buffer->set_bricked(true);
+	}
+	if (_dedup_enabled) {
+		dedup_buffer(**buffer);
+	}
+	// Whatever wrote into the buffer before doesn't count as an edit of the map
+	buffer->clear_modified_box();
 	VoxelBlock *block = get_block(bpos);
 	if (block == NULL) {
 		block = VoxelBlock::create(bpos, *buffer, _block_size, _lod_index);
 		set_block(bpos, block);
 	} else {
 		block->voxels = buffer;
+		block->modified = false;
 	}
 	return block;
 }
 
 bool VoxelMap::has_block(Vector3i pos) const {
+	if (_grid_box.contains(pos)) {
+		return _grid[get_grid_index(pos)] != NULL;
+	}
 	return /*(_last_accessed_block != NULL && _last_accessed_block->pos == pos) ||*/ _blocks.has(pos);
 }
 
 bool VoxelMap::is_block_surrounded(Vector3i pos) const {
-	// TODO If that check proves to be too expensive with all blocks we deal with, cache it in VoxelBlocks
-	for (unsigned int i = 0; i < Cube::MOORE_NEIGHBORING_3D_COUNT; ++i) {
-		Vector3i bpos = pos + Cube::g_moore_neighboring_3d[i];
-		if (!has_block(bpos)) {
-			return false;
-		}
-	}
-	return true;
+	const VoxelBlock *block = get_block(pos);
+	return block != NULL && block->is_surrounded();
 }
 
 void VoxelMap::get_buffer_copy(Vector3i min_pos, VoxelBuffer &dst_buffer, unsigned int channels_mask) {
 
-	Vector3i max_pos = min_pos + dst_buffer.get_size();
+	const Rect3i area(min_pos, dst_buffer.get_size());
+	if (area.is_empty()) {
+		return;
+	}
 
-	Vector3i min_block_pos = voxel_to_block(min_pos);
-	Vector3i max_block_pos = voxel_to_block(max_pos - Vector3i(1, 1, 1)) + Vector3i(1, 1, 1);
-	// TODO Why is this function limited by this check?
-	ERR_FAIL_COND((max_block_pos - min_block_pos) != Vector3i(3, 3, 3));
+	const Vector3i min_block_pos = voxel_to_block(min_pos);
+	const Vector3i max_block_pos = voxel_to_block(min_pos + area.size - Vector3i(1));
+	const Vector3i block_size_v(_block_size);
 
-	const Vector3i block_size_v(_block_size, _block_size, _block_size);
+	Vector3i bpos;
+	for (bpos.z = min_block_pos.z; bpos.z <= max_block_pos.z; ++bpos.z) {
+		for (bpos.x = min_block_pos.x; bpos.x <= max_block_pos.x; ++bpos.x) {
+			for (bpos.y = min_block_pos.y; bpos.y <= max_block_pos.y; ++bpos.y) {
 
-	for (unsigned int channel = 0; channel < VoxelBuffer::MAX_CHANNELS; ++channel) {
+				const Vector3i offset = block_to_voxel(bpos);
+				// Part of the area covered by this block, in voxel coordinates
+				const Rect3i box = Rect3i(offset, block_size_v).clipped(area);
+				const Vector3i box_max = box.pos + box.size;
 
-		if (((1 << channel) & channels_mask) == 0) {
-			continue;
-		}
+				const VoxelBlock *block = get_block(bpos);
 
-		Vector3i bpos;
-		for (bpos.z = min_block_pos.z; bpos.z < max_block_pos.z; ++bpos.z) {
-			for (bpos.x = min_block_pos.x; bpos.x < max_block_pos.x; ++bpos.x) {
-				for (bpos.y = min_block_pos.y; bpos.y < max_block_pos.y; ++bpos.y) {
+				for (unsigned int channel = 0; channel < VoxelBuffer::MAX_CHANNELS; ++channel) {
+
+					if (((1 << channel) & channels_mask) == 0) {
+						continue;
+					}
 
-					VoxelBlock *block = get_block(bpos);
 					if (block) {
+						// Uniform channels are filled without reading voxels
+						dst_buffer.copy_from(**block->voxels, box.pos - offset, box_max - offset, box.pos - min_pos, channel);
+					} else {
+						dst_buffer.fill_area(_default_voxel[channel], box.pos - min_pos, box_max - min_pos, channel);
+					}
+				}
+			}
+		}
+	}
+}
 
-						VoxelBuffer &src_buffer = **block->voxels;
-						Vector3i offset = block_to_voxel(bpos);
-						// Note: copy_from takes care of clamping the area if it's on an edge
-						dst_buffer.copy_from(src_buffer,
-								min_pos - offset,
-								max_pos - offset,
-								offset - min_pos,
-								channel);
+void VoxelMap::set_buffer_region(Vector3i min_pos, const VoxelBuffer &src_buffer, unsigned int channels_mask) {
 
-					} else {
-						Vector3i offset = block_to_voxel(bpos);
-						dst_buffer.fill_area(
-								_default_voxel[channel],
-								offset - min_pos,
-								offset - min_pos + block_size_v,
-								channel);
+	const Rect3i area(min_pos, src_buffer.get_size());
+	if (area.is_empty()) {
+		return;
+	}
+
+	const Vector3i min_block_pos = voxel_to_block(min_pos);
+	const Vector3i max_block_pos = voxel_to_block(min_pos + area.size - Vector3i(1));
+	const Vector3i block_size_v(_block_size);
+
+	Vector3i bpos;
+	for (bpos.z = min_block_pos.z; bpos.z <= max_block_pos.z; ++bpos.z) {
+		for (bpos.x = min_block_pos.x; bpos.x <= max_block_pos.x; ++bpos.x) {
+			for (bpos.y = min_block_pos.y; bpos.y <= max_block_pos.y; ++bpos.y) {
+
+				const Vector3i offset = block_to_voxel(bpos);
+				const Rect3i box = Rect3i(offset, block_size_v).clipped(area);
+				const Vector3i box_max = box.pos + box.size;
+
+				VoxelBlock *block = get_or_create_block_at_voxel_pos(offset);
+				VoxelBuffer &dst_buffer = **block->voxels;
+
+				for (unsigned int channel = 0; channel < VoxelBuffer::MAX_CHANNELS; ++channel) {
+					if (((1 << channel) & channels_mask) != 0) {
+						dst_buffer.copy_from(src_buffer, box.pos - min_pos, box_max - min_pos, box.pos - offset, channel);
 					}
 				}
+
+				queue_modified_block(*block);
+			}
+		}
+	}
+}
+
+void VoxelMap::queue_modified_block(VoxelBlock &block) {
+	if (!block.modified_queued && !block.voxels->get_modified_box().is_empty()) {
+		block.modified_queued = true;
+		_modified_blocks.push_back(block.position);
+	}
+}
+
+void VoxelMap::consume_modified_areas(Vector<Rect3i> &out_boxes) {
+	if (_modified_blocks.size() == 0) {
+		return;
+	}
+
+	const uint64_t now = OS::get_singleton()->get_ticks_usec();
+
+	for (int i = 0; i < _modified_blocks.size(); ++i) {
+		Vector3i bpos = _modified_blocks[i];
+
+		// The block may have been removed since
+		VoxelBlock *block = get_block(bpos);
+		if (block == NULL) {
+			continue;
+		}
+		block->modified_queued = false;
+
+		Rect3i box = block->voxels->consume_modified_box();
+		if (box.is_empty()) {
+			continue;
+		}
+
+		box.pos += block_to_voxel(bpos);
+		out_boxes.push_back(box);
+
+		block->modified = true;
+		block->last_edit_time_usec = now;
+
+		// Edits can leave channels uniform
+		_edited_blocks_to_compact.push_back(bpos);
+	}
+
+	_modified_blocks.clear();
+}
+
+namespace {
+
+// All blocks don't need to be checked often, they rarely change on their own
+const uint64_t COLD_COMPACTION_INTERVAL_USEC = 10000000;
+// Blocks edited more recently than this are likely to be edited again, so they don't get compressed
+const uint64_t COLD_COMPACTION_MIN_EDIT_AGE_USEC = 10000000;
+
+void compact_block(VoxelBlock &block, bool compress, VoxelMap::CompactionStats &stats) {
+	VoxelBuffer &voxels = **block.voxels;
+	// Shared data is not counted, it isn't freed until all its users let it go
+	const unsigned int usage_before = voxels.get_owned_memory_usage();
+
+	for (unsigned int i = 0; i < VoxelBuffer::MAX_CHANNELS; ++i) {
+		// Shared channels are left alone, compressing them would allocate a copy for this block only
+		if (voxels.is_channel_shared(i)) {
+			continue;
+		}
+		if (compress) {
+			voxels.compress_channel(i);
+		} else {
+			voxels.compress_uniform_channel(i);
+		}
+	}
+
+	const unsigned int usage_after = voxels.get_owned_memory_usage();
+	if (usage_after < usage_before) {
+		stats.reclaimed_bytes += usage_before - usage_after;
+	}
+	++stats.processed_blocks;
+}
+
+struct CompactionItem {
+	VoxelBlock *block = nullptr;
+	VoxelMap::CompactionStats stats;
+};
+
+// Blocks are compacted independently, so this can run on several threads
+struct CompactAction {
+	bool compress;
+	void operator()(CompactionItem &item) const {
+		compact_block(*item.block, compress, item.stats);
+	}
+};
+
+} // namespace
+
+void VoxelMap::compact(uint64_t time_budget_usec, bool compress, CompactionStats &out_stats) {
+	const OS &os = *OS::get_singleton();
+	const uint64_t time_before = os.get_ticks_usec();
+
+	while (_edited_blocks_to_compact.size() > 0) {
+		if (os.get_ticks_usec() - time_before >= time_budget_usec) {
+			return;
+		}
+		const int last = _edited_blocks_to_compact.size() - 1;
+		const Vector3i bpos = _edited_blocks_to_compact[last];
+		_edited_blocks_to_compact.resize(last);
+
+		// The block may have been removed since
+		VoxelBlock *block = get_block(bpos);
+		if (block != NULL) {
+			compact_block(*block, false, out_stats);
+		}
+	}
+
+	if (_cold_blocks_to_compact.empty()) {
+		if (time_before - _last_cold_compaction_time < COLD_COMPACTION_INTERVAL_USEC) {
+			return;
+		}
+		_last_cold_compaction_time = time_before;
+
+		prune_dedup_buffers();
+
+		// Positions are used instead of pointers, because blocks can be removed until the pass is over
+		std::vector<VoxelBlock *> blocks;
+		get_all_blocks(blocks);
+		_cold_blocks_to_compact.resize(blocks.size());
+		for (unsigned int i = 0; i < blocks.size(); ++i) {
+			_cold_blocks_to_compact[i] = blocks[i]->position;
+		}
+	}
+
+	// Blocks are compacted in small batches spread over threads, checking the time budget between batches
+	const VoxelWorkerPool *worker_pool = VoxelWorkerPool::get_singleton();
+	const unsigned int batch_size = worker_pool != nullptr ? worker_pool->get_worker_count() + 1 : 1;
+	std::vector<CompactionItem> batch;
+
+	while (!_cold_blocks_to_compact.empty()) {
+		if (os.get_ticks_usec() - time_before >= time_budget_usec) {
+			return;
+		}
+
+		batch.clear();
+		while (batch.size() < batch_size && !_cold_blocks_to_compact.empty()) {
+			const Vector3i bpos = _cold_blocks_to_compact.back();
+			_cold_blocks_to_compact.pop_back();
+
+			VoxelBlock *block = get_block(bpos);
+			if (block == NULL || block->modified_queued) {
+				continue;
+			}
+			if (block->modified && time_before - block->last_edit_time_usec < COLD_COMPACTION_MIN_EDIT_AGE_USEC) {
+				continue;
 			}
+			CompactionItem item;
+			item.block = block;
+			batch.push_back(item);
+		}
+
+		parallel_for_each(batch.data(), batch.size(), 1, CompactAction{ compress });
+
+		for (unsigned int i = 0; i < batch.size(); ++i) {
+			out_stats.processed_blocks += batch[i].stats.processed_blocks;
+			out_stats.reclaimed_bytes += batch[i].stats.reclaimed_bytes;
 		}
 	}
 }
 
+void VoxelMap::snapshot(Snapshot &out_snapshot) const {
+
+	const int block_count = get_block_count();
+	out_snapshot.positions.resize(block_count);
+	out_snapshot.buffers.resize(block_count);
+	out_snapshot.block_size_pow2 = _block_size_pow2;
+	out_snapshot.lod_index = _lod_index;
+
+	struct AddToSnapshot {
+		Snapshot &snapshot;
+		int i;
+		void operator()(const VoxelBlock *block) {
+			CRASH_COND(block == NULL);
+			snapshot.positions.write[i] = block->position;
+			snapshot.buffers.write[i] = block->voxels->duplicate();
+			++i;
+		}
+	};
+	for_all_blocks_const(AddToSnapshot{ out_snapshot, 0 });
+}
+
 void VoxelMap::clear() {
 	const Vector3i *key = NULL;
 	while ((key = _blocks.next(key))) {
@@ -228,11 +819,38 @@ void VoxelMap::clear() {
 		memdelete(block_ptr);
 	}
 	_blocks.clear();
+	for (unsigned int i = 0; i < _grid.size(); ++i) {
+		if (_grid[i] != NULL) {
+			memdelete(_grid[i]);
+			_grid[i] = NULL;
+		}
+	}
+	_grid_block_count = 0;
+	_modified_blocks.clear();
+	_edited_blocks_to_compact.clear();
+	_cold_blocks_to_compact.clear();
+	_dedup_buffers.clear();
 	_last_accessed_block = NULL;
+
+	VoxelMemoryPool *pool = VoxelMemoryPool::get_singleton();
+	if (pool != nullptr) {
+		pool->clear_unused_blocks();
+	}
+}
+
+void VoxelMap::get_all_blocks(std::vector<VoxelBlock *> &out_blocks) {
+	struct Collect {
+		std::vector<VoxelBlock *> &blocks;
+		void operator()(VoxelBlock *block) {
+			blocks.push_back(block);
+		}
+	};
+	out_blocks.reserve(out_blocks.size() + get_block_count());
+	for_all_blocks(Collect{ out_blocks });
 }
 
 int VoxelMap::get_block_count() const {
-	return _blocks.size();
+	return _blocks.size() + _grid_block_count;
 }
 
 void VoxelMap::_bind_methods() {
@@ -246,16 +864,78 @@ void VoxelMap::_bind_methods() {
 	ClassDB::bind_method(D_METHOD("get_default_voxel", "channel"), &VoxelMap::get_default_voxel, DEFVAL(0));
 	ClassDB::bind_method(D_METHOD("set_default_voxel", "value", "channel"), &VoxelMap::set_default_voxel, DEFVAL(0));
 	ClassDB::bind_method(D_METHOD("has_block", "x", "y", "z"), &VoxelMap::_has_block_binding);
-	ClassDB::bind_method(D_METHOD("get_buffer_copy", "min_pos", "out_buffer", "channel"), &VoxelMap::_get_buffer_copy_binding, DEFVAL(0));
+	ClassDB::bind_method(D_METHOD("get_buffer_copy", "min_pos", "out_buffer", "channels_mask"), &VoxelMap::_get_buffer_copy_binding, DEFVAL(1));
+	ClassDB::bind_method(D_METHOD("set_buffer_region", "min_pos", "buffer", "channels_mask"), &VoxelMap::_set_buffer_region_binding, DEFVAL(1));
 	ClassDB::bind_method(D_METHOD("set_block_buffer", "block_pos", "buffer"), &VoxelMap::_set_block_buffer_binding);
+	ClassDB::bind_method(D_METHOD("set_voxels", "positions", "values", "channel"), &VoxelMap::_set_voxels_binding, DEFVAL(0));
+	ClassDB::bind_method(D_METHOD("set_voxels_f", "positions", "values", "channel"), &VoxelMap::_set_voxels_f_binding, DEFVAL(VoxelBuffer::CHANNEL_ISOLEVEL));
+	ClassDB::bind_method(D_METHOD("do_sphere", "center", "radius", "op"), &VoxelMap::do_sphere);
+	ClassDB::bind_method(D_METHOD("snapshot"), &VoxelMap::_snapshot_binding);
 	ClassDB::bind_method(D_METHOD("voxel_to_block", "voxel_pos"), &VoxelMap::_voxel_to_block_binding);
 	ClassDB::bind_method(D_METHOD("block_to_voxel", "block_pos"), &VoxelMap::_block_to_voxel_binding);
 	ClassDB::bind_method(D_METHOD("get_block_size"), &VoxelMap::get_block_size);
+	ClassDB::bind_method(D_METHOD("set_bricks_enabled", "enabled"), &VoxelMap::set_bricks_enabled);
+	ClassDB::bind_method(D_METHOD("is_bricks_enabled"), &VoxelMap::is_bricks_enabled);
+	ClassDB::bind_method(D_METHOD("set_dedup_enabled", "enabled"), &VoxelMap::set_dedup_enabled);
+	ClassDB::bind_method(D_METHOD("is_dedup_enabled"), &VoxelMap::is_dedup_enabled);
+	ClassDB::bind_method(D_METHOD("get_dedup_statistics"), &VoxelMap::get_dedup_statistics);
 
 	//ADD_PROPERTY(PropertyInfo(Variant::INT, "iterations"), _SCS("set_iterations"), _SCS("get_iterations"));
 }
 
-void VoxelMap::_get_buffer_copy_binding(Vector3 pos, Ref<VoxelBuffer> dst_buffer_ref, unsigned int channel) {
+void VoxelMap::_get_buffer_copy_binding(Vector3 pos, Ref<VoxelBuffer> dst_buffer_ref, unsigned int channels_mask) {
 	ERR_FAIL_COND(dst_buffer_ref.is_null());
-	get_buffer_copy(Vector3i(pos), **dst_buffer_ref, channel);
+	get_buffer_copy(Vector3i(pos), **dst_buffer_ref, channels_mask);
+}
+
+void VoxelMap::_set_voxels_binding(PoolVector3Array positions, PoolIntArray values, unsigned int channel) {
+	ERR_FAIL_COND(positions.size() != values.size());
+	ERR_FAIL_INDEX(channel, VoxelBuffer::MAX_CHANNELS);
+
+	Vector<Edit> edits;
+	edits.resize(positions.size());
+	PoolVector3Array::Read positions_read = positions.read();
+	PoolIntArray::Read values_read = values.read();
+	for (int i = 0; i < edits.size(); ++i) {
+		Edit &edit = edits.write[i];
+		edit.position = Vector3i(positions_read[i]);
+		edit.value = values_read[i];
+		edit.channel = channel;
+	}
+
+	apply_edits(edits);
+}
+
+void VoxelMap::_set_voxels_f_binding(PoolVector3Array positions, PoolRealArray values, unsigned int channel) {
+	ERR_FAIL_COND(positions.size() != values.size());
+	ERR_FAIL_INDEX(channel, VoxelBuffer::MAX_CHANNELS);
+
+	Vector<Edit> edits;
+	edits.resize(positions.size());
+	PoolVector3Array::Read positions_read = positions.read();
+	PoolRealArray::Read values_read = values.read();
+	for (int i = 0; i < edits.size(); ++i) {
+		Edit &edit = edits.write[i];
+		edit.position = Vector3i(positions_read[i]);
+		edit.value_f = values_read[i];
+		edit.channel = channel;
+		edit.is_float = true;
+	}
+
+	apply_edits(edits);
+}
+
+void VoxelMap::_set_buffer_region_binding(Vector3 pos, Ref<VoxelBuffer> src_buffer_ref, unsigned int channels_mask) {
+	ERR_FAIL_COND(src_buffer_ref.is_null());
+	set_buffer_region(Vector3i(pos), **src_buffer_ref, channels_mask);
+}
+
+Dictionary VoxelMap::_snapshot_binding() const {
+	Snapshot snapshot;
+	this->snapshot(snapshot);
+	Dictionary d;
+	for (int i = 0; i < snapshot.positions.size(); ++i) {
+		d[snapshot.positions[i].to_vec3()] = snapshot.buffers[i];
+	}
+	return d;
 }
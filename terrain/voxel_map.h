@@ -1,10 +1,13 @@
 #ifndef VOXEL_MAP_H
 #define VOXEL_MAP_H
 
+#include "../util/parallel_for.h"
+#include "../voxel_isosurface_tool.h"
 #include "voxel_block.h"
 
 #include <core/hash_map.h>
 #include <scene/main/node.h>
+#include <vector>
 
 // Infinite voxel storage by means of octants like Gridmap, within a constant LOD
 class VoxelMap : public Reference {
@@ -47,18 +50,90 @@ public:
 	void set_lod_index(int lod);
 	unsigned int get_lod_index() const;
 
+	// When enabled, blocks store their voxels as bricks, so mostly uniform blocks take little memory
+	// even if they are big or get edited.
+	void set_bricks_enabled(bool enabled);
+	bool is_bricks_enabled() const;
+
+	// When enabled, buffers given to `set_block_buffer` share their voxels with an identical buffer seen before,
+	// which helps with the many identical blocks found underground or in the sky.
+	// Shared voxels are copied only if one of the blocks gets edited.
+	void set_dedup_enabled(bool enabled);
+	bool is_dedup_enabled() const;
+	Dictionary get_dedup_statistics() const;
+
+	// Blocks inside this box (in block coordinates) are stored in a flat grid wrapping around as the box moves,
+	// so they can be accessed without hashing. Blocks outside of it are stored in a hash map.
+	// Moving the box only touches blocks of the slabs entering or leaving it.
+	void set_grid_region(Rect3i box);
+	_FORCE_INLINE_ const Rect3i &get_grid_region() const { return _grid_box; }
+
 	int get_voxel(Vector3i pos, unsigned int c = 0);
 	void set_voxel(int value, Vector3i pos, unsigned int c = 0);
 
 	float get_voxel_f(int x, int y, int z, unsigned int c = VoxelBuffer::CHANNEL_ISOLEVEL);
 	void set_voxel_f(real_t value, int x, int y, int z, unsigned int c = VoxelBuffer::CHANNEL_ISOLEVEL);
 
+	// Voxel change to apply with `apply_edits`
+	struct Edit {
+		Vector3i position;
+		// Kept apart from `value_f`, a float can't hold integers of 32-bit channels exactly
+		int value = 0;
+		real_t value_f = 0;
+		unsigned int channel = 0;
+		// If true, `value_f` is set like `set_voxel_f` does, otherwise `value` is set like `set_voxel` does
+		bool is_float = false;
+	};
+
+	// Applies many edits at once. They are grouped by block, so each block is looked up only once,
+	// and each modified block is reported once by `consume_modified_areas`.
+	// Edits of the same voxel are applied in the order they are given.
+	void apply_edits(const Vector<Edit> &edits);
+
+	// Applies a sphere on the isolevel channel, like VoxelIsoSurfaceTool does on a single buffer.
+	// Blocks touched by the sphere get created if missing.
+	void do_sphere(Vector3 center, real_t radius, VoxelIsoSurfaceTool::Operation op);
+
 	void set_default_voxel(int value, unsigned int channel = 0);
 	int get_default_voxel(unsigned int channel = 0);
 
 	// Gets a copy of all voxels in the area starting at min_pos having the same size as dst_buffer.
+	// Channels are selected with a bitmask, and missing blocks read as default voxels.
+	// Voxels are converted to the channel formats of dst_buffer.
 	void get_buffer_copy(Vector3i min_pos, VoxelBuffer &dst_buffer, unsigned int channels_mask = 1);
 
+	// Writes all voxels of src_buffer into the map, starting at min_pos. Missing blocks get created.
+	// Voxels are copied as-is, so written blocks take the channel formats of src_buffer.
+	void set_buffer_region(Vector3i min_pos, const VoxelBuffer &src_buffer, unsigned int channels_mask = 1);
+
+	// Immutable copy of all blocks of the map at a given time.
+	// Voxel data is shared with the map until it gets modified, so it is cheap to create,
+	// and can be read from another thread while the map keeps being edited.
+	struct Snapshot {
+		Vector<Vector3i> positions;
+		Vector<Ref<VoxelBuffer> > buffers;
+		unsigned int block_size_pow2 = 0;
+		unsigned int lod_index = 0;
+	};
+
+	void snapshot(Snapshot &out_snapshot) const;
+
+	// Gets the areas modified with `set_voxel` since the last call, in voxel coordinates.
+	// There is at most one box per block, so they can be used to update only what changed.
+	void consume_modified_areas(Vector<Rect3i> &out_boxes);
+
+	struct CompactionStats {
+		unsigned int processed_blocks = 0;
+		uint64_t reclaimed_bytes = 0;
+	};
+
+	// Frees memory blocks no longer need, spending at most the given time so it can run a little every frame.
+	// Blocks reported by `consume_modified_areas` are checked first, and only get their uniform channels dropped
+	// because they are likely to be edited again. Then all blocks not edited recently are checked in turn,
+	// at most once every few seconds, and get compressed if `compress` is true, several blocks at a time on worker threads.
+	// Channels shared with other buffers are left as they are.
+	void compact(uint64_t time_budget_usec, bool compress, CompactionStats &out_stats);
+
 	// Moves the given buffer into a block of the map. The buffer is referenced, no copy is made.
 	VoxelBlock *set_block_buffer(Vector3i bpos, Ref<VoxelBuffer> buffer);
 
@@ -68,12 +143,10 @@ public:
 
 	template <typename Action_T>
 	void remove_block(Vector3i bpos, Action_T pre_delete) {
-		if (_last_accessed_block && _last_accessed_block->position == bpos)
-			_last_accessed_block = NULL;
-		VoxelBlock **pptr = _blocks.getptr(bpos);
-		if (pptr) {
-			VoxelBlock *block = *pptr;
-			ERR_FAIL_COND(block == NULL);
+		VoxelBlock *block = get_block(bpos);
+		if (block) {
+			if (_last_accessed_block == block)
+				_last_accessed_block = NULL;
 			pre_delete(block);
 			memdelete(block);
 			remove_block_internal(bpos);
@@ -84,6 +157,7 @@ public:
 	const VoxelBlock *get_block(Vector3i bpos) const;
 
 	bool has_block(Vector3i pos) const;
+	// Tells if the block and all its 26 neighbors are present. This is a single lookup.
 	bool is_block_surrounded(Vector3i pos) const;
 
 	void clear();
@@ -92,6 +166,12 @@ public:
 
 	template <typename Op_T>
 	void for_all_blocks(Op_T op) {
+		for (unsigned int i = 0; i < _grid.size(); ++i) {
+			VoxelBlock *block = _grid[i];
+			if (block != NULL) {
+				op(block);
+			}
+		}
 		const Vector3i *key = NULL;
 		while ((key = _blocks.next(key))) {
 			VoxelBlock *block = _blocks.get(*key);
@@ -101,10 +181,89 @@ public:
 		}
 	}
 
+	void get_all_blocks(std::vector<VoxelBlock *> &out_blocks);
+
+	// Calls `op(block)` for all blocks, in chunks of `grain` blocks processed by several threads.
+	// Blocks must not be added or removed meanwhile, and `op` must be safe to call concurrently.
+	template <typename Op_T>
+	void parallel_for_blocks(Op_T op, unsigned int grain) {
+		std::vector<VoxelBlock *> blocks;
+		get_all_blocks(blocks);
+		parallel_for_each(blocks.data(), blocks.size(), grain, op);
+	}
+
+	// Calls `op(block)` for blocks within the given box, in block coordinates.
+	// Small boxes are looked up position by position, so the rest of the map isn't scanned.
+	// Boxes with more positions than there are blocks filter all blocks instead.
+	template <typename Op_T>
+	void for_blocks_in_box(Rect3i box, Op_T op) {
+		if (box.is_empty()) {
+			return;
+		}
+
+		const uint64_t box_volume = (uint64_t)box.size.x * (uint64_t)box.size.y * (uint64_t)box.size.z;
+		if (box_volume <= (uint64_t)get_block_count()) {
+			const Vector3i max = box.pos + box.size;
+			Vector3i bpos;
+			for (bpos.z = box.pos.z; bpos.z < max.z; ++bpos.z) {
+				for (bpos.x = box.pos.x; bpos.x < max.x; ++bpos.x) {
+					for (bpos.y = box.pos.y; bpos.y < max.y; ++bpos.y) {
+						VoxelBlock *block = get_block(bpos);
+						if (block != NULL) {
+							op(block);
+						}
+					}
+				}
+			}
+
+		} else {
+			for (unsigned int i = 0; i < _grid.size(); ++i) {
+				VoxelBlock *block = _grid[i];
+				if (block != NULL && box.contains(block->position)) {
+					op(block);
+				}
+			}
+			const Vector3i *key = NULL;
+			while ((key = _blocks.next(key))) {
+				if (box.contains(*key)) {
+					op(_blocks.get(*key));
+				}
+			}
+		}
+	}
+
 private:
 	void set_block(Vector3i bpos, VoxelBlock *block);
 	VoxelBlock *get_or_create_block_at_voxel_pos(Vector3i pos);
 	void remove_block_internal(Vector3i bpos);
+	void update_neighbor_masks(Vector3i bpos, VoxelBlock *block);
+	// Adds the block to those having edits to consume, if it has any and is not there already
+	void queue_modified_block(VoxelBlock &block);
+
+	template <typename Op_T>
+	void for_all_blocks_const(Op_T op) const {
+		for (unsigned int i = 0; i < _grid.size(); ++i) {
+			const VoxelBlock *block = _grid[i];
+			if (block != NULL) {
+				op(block);
+			}
+		}
+		const Vector3i *key = NULL;
+		while ((key = _blocks.next(key))) {
+			op(_blocks.get(*key));
+		}
+	}
+
+	// Position wraps around, so blocks keep their slot while the grid box moves
+	_FORCE_INLINE_ unsigned int get_grid_index(Vector3i bpos) const {
+		return (bpos.y & _grid_mask.y) + _grid_capacity.y * ((bpos.x & _grid_mask.x) + _grid_capacity.x * (bpos.z & _grid_mask.z));
+	}
+
+	void dedup_buffer(VoxelBuffer &buffer);
+	void prune_dedup_buffers();
+
+	void move_blocks_from_grid_to_map(Rect3i box);
+	void move_blocks_from_map_to_grid(Rect3i box);
 
 	void set_block_size_pow2(unsigned int p);
 
@@ -118,17 +277,28 @@ private:
 	_FORCE_INLINE_ Vector3 _voxel_to_block_binding(Vector3 pos) const { return voxel_to_block(Vector3i(pos)).to_vec3(); }
 	_FORCE_INLINE_ Vector3 _block_to_voxel_binding(Vector3 pos) const { return block_to_voxel(Vector3i(pos)).to_vec3(); }
 	bool _is_block_surrounded(Vector3 pos) const { return is_block_surrounded(Vector3i(pos)); }
-	void _get_buffer_copy_binding(Vector3 pos, Ref<VoxelBuffer> dst_buffer_ref, unsigned int channel = 0);
+	void _get_buffer_copy_binding(Vector3 pos, Ref<VoxelBuffer> dst_buffer_ref, unsigned int channels_mask);
+	void _set_buffer_region_binding(Vector3 pos, Ref<VoxelBuffer> src_buffer_ref, unsigned int channels_mask);
 	void _set_block_buffer_binding(Vector3 bpos, Ref<VoxelBuffer> buffer) { set_block_buffer(Vector3i(bpos), buffer); }
+	void _set_voxels_binding(PoolVector3Array positions, PoolIntArray values, unsigned int channel);
+	void _set_voxels_f_binding(PoolVector3Array positions, PoolRealArray values, unsigned int channel);
+	Dictionary _snapshot_binding() const;
 
 private:
 	// Voxel values that will be returned if access is out of map bounds
 	uint8_t _default_voxel[VoxelBuffer::MAX_CHANNELS];
 
 	// TODO Consider using OAHashMap
-	// Blocks stored with a spatial hash in all 3D directions
+	// Blocks outside of the grid region, stored with a spatial hash in all 3D directions
 	HashMap<Vector3i, VoxelBlock *, Vector3iHasher> _blocks;
 
+	// Blocks inside the grid region. Each axis has a power of two capacity so wrapping is a simple mask.
+	std::vector<VoxelBlock *> _grid;
+	Rect3i _grid_box;
+	Vector3i _grid_capacity;
+	Vector3i _grid_mask;
+	unsigned int _grid_block_count = 0;
+
 	// Voxel access will most frequently be in contiguous areas, so the same blocks are accessed.
 	// To prevent too much hashing, this reference is checked before.
 	VoxelBlock *_last_accessed_block;
@@ -138,6 +308,21 @@ private:
 	unsigned int _block_size_mask;
 
 	unsigned int _lod_index = 0;
+	bool _bricks_enabled = false;
+
+	// Buffers sharing their voxels with identical blocks, by content hash. They are never modified.
+	HashMap<uint32_t, Ref<VoxelBuffer> > _dedup_buffers;
+	bool _dedup_enabled = false;
+	uint64_t _dedup_shared_count = 0;
+
+	// Blocks whose buffer got a non-empty modified box since the last consumption.
+	// Their `modified_queued` flag is set while they are in this list.
+	Vector<Vector3i> _modified_blocks;
+
+	// Blocks left to check by `compact`
+	Vector<Vector3i> _edited_blocks_to_compact;
+	std::vector<Vector3i> _cold_blocks_to_compact;
+	uint64_t _last_cold_compaction_time = 0;
 };
 
 #endif // VOXEL_MAP_H
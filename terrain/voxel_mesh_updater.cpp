@@ -90,6 +90,12 @@ int VoxelMeshUpdater::Processor::get_required_padding() {
 	return padding;
 }
 
+void VoxelMeshUpdater::Processor::process_blocks(const InputBlock *inputs, OutputBlock *outputs, unsigned int count) {
+	for (unsigned int i = 0; i < count; ++i) {
+		process_block(inputs[i].data, outputs[i].data, inputs[i].position, inputs[i].lod);
+	}
+}
+
 void VoxelMeshUpdater::Processor::process_block(const InputBlockData &input, OutputBlockData &output, Vector3i block_position, unsigned int lod) {
 
 	const InputBlockData &block = input;
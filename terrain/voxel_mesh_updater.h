@@ -15,6 +15,9 @@ class VoxelMeshUpdater {
 public:
 	struct InputBlockData {
 		Ref<VoxelBuffer> voxels;
+		// Area of `voxels` that changed since the last time the block was meshed.
+		// Empty if the whole block has to be meshed. Meshers may use it to rebuild only part of the mesh.
+		Rect3i modified_box;
 	};
 
 	struct OutputBlockData {
@@ -22,7 +25,11 @@ public:
 		VoxelMesher::Output smooth_surfaces;
 	};
 
+	typedef VoxelBlockThreadInputBlock<InputBlockData> InputBlock;
+	typedef VoxelBlockThreadOutputBlock<OutputBlockData> OutputBlock;
+
 	struct Processor {
+		void process_blocks(const InputBlock *inputs, OutputBlock *outputs, unsigned int count);
 		void process_block(const InputBlockData &input, OutputBlockData &output, Vector3i block_position, unsigned int lod);
 		int get_required_padding();
 
@@ -38,8 +45,6 @@ public:
 	};
 
 	typedef VoxelBlockThreadManager<InputBlockData, OutputBlockData, Processor> Mgr;
-	typedef Mgr::InputBlock InputBlock;
-	typedef Mgr::OutputBlock OutputBlock;
 	typedef Mgr::Input Input;
 	typedef Mgr::Output Output;
 	typedef Mgr::Stats Stats;
@@ -3,6 +3,7 @@
 #include "../util/utility.h"
 #include "../util/voxel_raycast.h"
 #include "../util/profiling_clock.h"
+#include "../voxel_memory_pool.h"
 #include "voxel_block.h"
 #include "voxel_map.h"
 
@@ -16,6 +17,8 @@ VoxelTerrain::VoxelTerrain() {
 
 	_view_distance_blocks = 8;
 	_last_view_distance_blocks = 0;
+	_unload_margin_blocks = 0;
+	_last_unload_margin_blocks = 0;
 
 	_stream_thread = NULL;
 	_block_updater = NULL;
@@ -23,6 +26,9 @@ VoxelTerrain::VoxelTerrain() {
 	_generate_collisions = false;
 	_run_in_editor = false;
 	_smooth_meshing_enabled = false;
+
+	_compaction_time_budget_usec = 500;
+	_compaction_compress_enabled = false;
 }
 
 VoxelTerrain::~VoxelTerrain() {
@@ -71,7 +77,11 @@ void VoxelTerrain::_get_property_list(List<PropertyInfo> *p_list) const {
 void VoxelTerrain::set_stream(Ref<VoxelStream> stream) {
 	if (stream != _stream) {
 
+		// Edits belong to the previous stream
+		save_modified_blocks();
+
 		if (_stream_thread) {
+			// Waits for saves to complete
 			memdelete(_stream_thread);
 			_stream_thread = NULL;
 		}
@@ -79,6 +89,9 @@ void VoxelTerrain::set_stream(Ref<VoxelStream> stream) {
 		_stream = stream;
 		_stream_thread = memnew(VoxelDataLoader(1, _stream, _map->get_block_size_pow2()));
 
+		// Cached blocks came from the previous stream
+		_block_cache.clear();
+
 		// The whole map might change, so make all area dirty
 		// TODO Actually, we should regenerate the whole map, not just update all its blocks
 		make_all_view_dirty_deferred();
@@ -129,6 +142,41 @@ void VoxelTerrain::set_view_distance(int distance_in_voxels) {
 	}
 }
 
+void VoxelTerrain::set_block_dedup_enabled(bool enabled) {
+	_map->set_dedup_enabled(enabled);
+}
+
+bool VoxelTerrain::is_block_dedup_enabled() const {
+	return _map->is_dedup_enabled();
+}
+
+void VoxelTerrain::set_compaction_time_budget_usec(int usec) {
+	ERR_FAIL_COND(usec < 0);
+	_compaction_time_budget_usec = usec;
+}
+
+int VoxelTerrain::get_compaction_time_budget_usec() const {
+	return _compaction_time_budget_usec;
+}
+
+void VoxelTerrain::set_compaction_compress_enabled(bool enabled) {
+	_compaction_compress_enabled = enabled;
+}
+
+bool VoxelTerrain::is_compaction_compress_enabled() const {
+	return _compaction_compress_enabled;
+}
+
+int VoxelTerrain::get_unload_margin_blocks() const {
+	return _unload_margin_blocks;
+}
+
+void VoxelTerrain::set_unload_margin_blocks(int margin) {
+	ERR_FAIL_COND(margin < 0);
+	// Blocks beyond the new margin will be removed in _process
+	_unload_margin_blocks = margin;
+}
+
 void VoxelTerrain::set_viewer_path(NodePath path) {
 	_viewer_path = path;
 }
@@ -172,6 +220,9 @@ void VoxelTerrain::set_smooth_meshing_enabled(bool enabled) {
 void VoxelTerrain::make_block_dirty(Vector3i bpos) {
 	// TODO Immediate update viewer distance?
 
+	// We don't know what changed, so the whole block has to be remeshed
+	_blocks_modified_boxes.erase(bpos);
+
 	VoxelTerrain::BlockDirtyState *state = _dirty_blocks.getptr(bpos);
 
 	if (state == NULL) {
@@ -205,10 +256,20 @@ void VoxelTerrain::immerge_block(Vector3i bpos) {
 
 	ERR_FAIL_COND(_map.is_null());
 
-	// TODO Schedule block saving when supported
-	_map->remove_block(bpos, VoxelMap::NoAction());
+	// Saving is done by the stream thread, requests are sent before loading requests
+	VoxelBlock *block = _map->get_block(bpos);
+	if (block != NULL && block->needs_saving() && _stream.is_valid()) {
+		VoxelDataLoader::InputBlock input_block;
+		input_block.data.voxels_to_save = block->voxels->duplicate();
+		input_block.position = bpos;
+		input_block.lod = 0;
+		_blocks_to_save.push_back(input_block);
+	}
+
+	_map->remove_block(bpos, VoxelBlockCache::StoreAction(_block_cache));
 
 	_dirty_blocks.erase(bpos);
+	_blocks_modified_boxes.erase(bpos);
 	// Blocks in the update queue will be cancelled in _process,
 	// because it's too expensive to linear-search all blocks for each block
 }
@@ -217,6 +278,7 @@ Dictionary VoxelTerrain::get_statistics() const {
 
 	Dictionary stream = VoxelDataLoader::Mgr::to_dictionary(_stats.stream);
 	stream["dropped_blocks"] = _stats.dropped_stream_blocks;
+	stream["pending_saves"] = _stream_thread ? _stream_thread->get_pending_save_count() : 0;
 
 	Dictionary updater = VoxelMeshUpdater::Mgr::to_dictionary(_stats.updater);
 	updater["updated_blocks"] = _stats.updated_blocks;
@@ -235,9 +297,32 @@ Dictionary VoxelTerrain::get_statistics() const {
 	d["time_send_update_requests"] = _stats.time_send_update_requests;
 	d["time_process_update_responses"] = _stats.time_process_update_responses;
 
+	d["time_compaction"] = _stats.time_compaction;
+
+	d["unloads_avoided"] = _stats.unloads_avoided;
+
+	Dictionary compaction;
+	compaction["processed_blocks"] = _stats.compaction_processed_blocks;
+	compaction["reclaimed_bytes"] = _stats.compaction_reclaimed_bytes;
+	d["compaction"] = compaction;
+
+	d["dedup"] = _map->get_dedup_statistics();
+
+	d["memory_pool"] = VoxelMemoryPool::get_singleton()->get_stats();
+	d["block_cache"] = _block_cache.get_statistics();
+
 	return d;
 }
 
+void VoxelTerrain::set_block_cache_memory_budget(int bytes) {
+	ERR_FAIL_COND(bytes < 0);
+	_block_cache.set_memory_budget(bytes);
+}
+
+int VoxelTerrain::get_block_cache_memory_budget() const {
+	return _block_cache.get_memory_budget();
+}
+
 bool VoxelTerrain::is_block_dirty(Vector3i bpos) const {
 	return _dirty_blocks.has(bpos);
 }
@@ -259,6 +344,8 @@ void VoxelTerrain::make_all_view_dirty_deferred() {
 	// The point of doing this instead of immediately scheduling updates is that it will
 	// always use an up-to-date view distance, which is not necessarily loaded yet on initialization.
 	_last_view_distance_blocks = 0;
+	// Blocks kept in the margin must be updated too
+	_last_unload_margin_blocks = 0;
 
 	//	Vector3i radius(_view_distance_blocks, _view_distance_blocks, _view_distance_blocks);
 	//	make_blocks_dirty(-radius, 2*radius);
@@ -281,161 +368,55 @@ void VoxelTerrain::reset_updater() {
 	// TODO Revert any pending update states!
 }
 
-inline int get_border_index(int x, int max) {
-	return x == 0 ? 0 : x != max ? 1 : 2;
-}
-
 void VoxelTerrain::make_voxel_dirty(Vector3i pos) {
-
-	// Update the block in which the voxel is
-	Vector3i bpos = _map->voxel_to_block(pos);
-	make_block_dirty(bpos);
-	//OS::get_singleton()->print("Dirty (%i, %i, %i)\n", bpos.x, bpos.y, bpos.z);
-
-	// Update neighbor blocks if the voxel is touching a boundary
-
-	Vector3i rpos = _map->to_local(pos);
-
-	// TODO Thread-safe way of getting this parameter
-	bool check_corners = true; //_mesher->get_occlusion_enabled();
-
-	const int max = _map->get_block_size() - 1;
-
-	if (rpos.x == 0)
-		make_block_dirty(bpos - Vector3i(1, 0, 0));
-	else if (rpos.x == max)
-		make_block_dirty(bpos + Vector3i(1, 0, 0));
-
-	if (rpos.y == 0)
-		make_block_dirty(bpos - Vector3i(0, 1, 0));
-	else if (rpos.y == max)
-		make_block_dirty(bpos + Vector3i(0, 1, 0));
-
-	if (rpos.z == 0)
-		make_block_dirty(bpos - Vector3i(0, 0, 1));
-	else if (rpos.z == max)
-		make_block_dirty(bpos + Vector3i(0, 0, 1));
-
-	// We might want to update blocks in corners in order to update ambient occlusion
-	if (check_corners) {
-
-		//       24------25------26
-		//       /|              /|
-		//      / |             / |
-		//    21  |           23  |
-		//    /  15           /  17
-		//   /    |          /    |
-		// 18------19------20     |
-		//  |     |         |     |
-		//  |     6-------7-|-----8
-		//  |    /          |    /
-		//  9   /          11   /
-		//  |  3            |  5
-		//  | /             | /      y z
-		//  |/              |/       |/
-		//  0-------1-------2        o--x
-
-		// I'm not good at writing piles of ifs
-
-		static const int normals[27][3] = {
-			{ -1, -1, -1 }, { 0, -1, -1 }, { 1, -1, -1 },
-			{ -1, -1, 0 }, { 0, -1, 0 }, { 1, -1, 0 },
-			{ -1, -1, 1 }, { 0, -1, 1 }, { 1, -1, 1 },
-
-			{ -1, 0, -1 }, { 0, 0, -1 }, { 1, 0, -1 },
-			{ -1, 0, 0 }, { 0, 0, 0 }, { 1, 0, 0 },
-			{ -1, 0, 1 }, { 0, 0, 1 }, { 1, 0, 1 },
-
-			{ -1, 1, -1 }, { 0, 1, -1 }, { 1, 1, -1 },
-			{ -1, 1, 0 }, { 0, 1, 0 }, { 1, 1, 0 },
-			{ -1, 1, 1 }, { 0, 1, 1 }, { 1, 1, 1 }
-		};
-		static const int ce_counts[27] = {
-			4, 1, 4,
-			1, 0, 1,
-			4, 1, 4,
-
-			1, 0, 1,
-			0, 0, 0,
-			1, 0, 1,
-
-			4, 1, 4,
-			1, 0, 1,
-			4, 1, 4
-		};
-		static const int ce_indexes_lut[27][4] = {
-			{ 0, 1, 3, 9 }, { 1 }, { 2, 1, 5, 11 },
-			{ 3 }, {}, { 5 },
-			{ 6, 3, 7, 15 }, { 7 }, { 8, 7, 5, 17 },
-
-			{ 9 }, {}, { 11 },
-			{}, {}, {},
-			{ 15 }, {}, { 17 },
-
-			{ 18, 9, 19, 21 }, { 19 }, { 20, 11, 19, 23 },
-			{ 21 }, {}, { 23 },
-			{ 24, 15, 21, 25 }, { 25 }, { 26, 17, 23, 25 }
-		};
-
-		int m = get_border_index(rpos.x, max) + 3 * get_border_index(rpos.z, max) + 9 * get_border_index(rpos.y, max);
-
-		const int *ce_indexes = ce_indexes_lut[m];
-		int ce_count = ce_counts[m];
-		//OS::get_singleton()->print("m=%i, rpos=(%i, %i, %i)\n", m, rpos.x, rpos.y, rpos.z);
-
-		for (int i = 0; i < ce_count; ++i) {
-			// TODO Because it's about ambient occlusion across 1 voxel only,
-			// we could optimize it even more by looking at neighbor voxels,
-			// and discard the update if we know it won't change anything
-			const int *normal = normals[ce_indexes[i]];
-			Vector3i nbpos(bpos.x + normal[0], bpos.y + normal[1], bpos.z + normal[2]);
-			//OS::get_singleton()->print("Corner dirty (%i, %i, %i)\n", nbpos.x, nbpos.y, nbpos.z);
-			make_block_dirty(nbpos);
-		}
-	}
+	make_area_dirty(Rect3i(pos, Vector3i(1, 1, 1)));
 }
 
 void VoxelTerrain::make_area_dirty(Rect3i box) {
 
-	Vector3i min_pos = box.pos;
-	Vector3i max_pos = box.pos + box.size - Vector3(1, 1, 1);
-
-	// TODO Thread-safe way of getting this parameter
-	bool check_corners = true; //_mesher->get_occlusion_enabled();
-	if (check_corners) {
-
-		min_pos -= Vector3i(1, 1, 1);
-		max_pos += Vector3i(1, 1, 1);
-
-	} else {
-
-		Vector3i min_rpos = _map->to_local(min_pos);
-		if (min_rpos.x == 0)
-			--min_pos.x;
-		if (min_rpos.y == 0)
-			--min_pos.y;
-		if (min_rpos.z == 0)
-			--min_pos.z;
-
-		const int max = _map->get_block_size() - 1;
-		Vector3i max_rpos = _map->to_local(max_pos);
-		if (max_rpos.x == max)
-			++max_pos.x;
-		if (max_rpos.y == max)
-			++max_pos.y;
-		if (max_rpos.z == max)
-			++max_pos.z;
+	if (box.is_empty()) {
+		return;
 	}
 
-	Vector3i min_block_pos = _map->voxel_to_block(min_pos);
-	Vector3i max_block_pos = _map->voxel_to_block(max_pos);
+	// Blocks are meshed with a margin of voxels from their neighbors,
+	// so only the blocks whose padded area overlaps the edit need an update.
+	const int padding = _block_updater != NULL ? _block_updater->get_required_padding() : 1;
+	const int block_size = _map->get_block_size();
+	const Rect3i padded_block_box(Vector3i(), Vector3i(block_size + 2 * padding));
+
+	Vector3i min_block_pos = _map->voxel_to_block(box.pos - Vector3i(padding));
+	Vector3i max_block_pos = _map->voxel_to_block(box.pos + box.size - Vector3i(1) + Vector3i(padding));
 
 	Vector3i bpos;
 	for (bpos.z = min_block_pos.z; bpos.z <= max_block_pos.z; ++bpos.z) {
 		for (bpos.x = min_block_pos.x; bpos.x <= max_block_pos.x; ++bpos.x) {
 			for (bpos.y = min_block_pos.y; bpos.y <= max_block_pos.y; ++bpos.y) {
 
+				// Where the edit is in the padded buffer the mesher will receive
+				Rect3i local_box(box.pos - _map->block_to_voxel(bpos) + Vector3i(padding), box.size);
+				local_box = local_box.clipped(padded_block_box);
+
+				// Partial updates only make sense on top of an existing mesh,
+				// and if no full update was requested already
+				bool partial = false;
+				const VoxelTerrain::BlockDirtyState *state = _dirty_blocks.getptr(bpos);
+				if (state == NULL) {
+					const VoxelBlock *block = _map->get_block(bpos);
+					partial = block != NULL && block->has_been_meshed();
+
+				} else if (*state == BLOCK_UPDATE_NOT_SENT) {
+					const Rect3i *prev_box = _blocks_modified_boxes.getptr(bpos);
+					if (prev_box != NULL) {
+						local_box.merge_with(*prev_box);
+						partial = true;
+					}
+				}
+
 				make_block_dirty(bpos);
+
+				if (partial) {
+					_blocks_modified_boxes.set(bpos, local_box);
+				}
 			}
 		}
 	}
@@ -467,8 +448,54 @@ struct SetVisibilityAction {
 	}
 };
 
+// Called from several threads, blocks are copied in parallel and only adding them to the list is serialized
+struct SaveAction {
+	std::vector<VoxelDataLoader::InputBlock> &blocks_to_save;
+	Mutex *mutex;
+	SaveAction(std::vector<VoxelDataLoader::InputBlock> &b, Mutex *m) :
+			blocks_to_save(b),
+			mutex(m) {}
+	void operator()(VoxelBlock *block) {
+		if (block->needs_saving()) {
+			VoxelDataLoader::InputBlock input_block;
+			input_block.data.voxels_to_save = block->voxels->duplicate();
+			input_block.position = block->position;
+			input_block.lod = block->lod_index;
+			block->modified = false;
+			MutexLock lock(mutex);
+			blocks_to_save.push_back(input_block);
+		}
+	}
+};
+
+// Blocks checked per chunk of work when saving
+const unsigned int SAVE_GRAIN = 64;
+
 } // namespace
 
+void VoxelTerrain::save_modified_blocks() {
+	if (_stream.is_valid()) {
+		Mutex *mutex = Mutex::create();
+		_map->parallel_for_blocks(SaveAction(_blocks_to_save, mutex), SAVE_GRAIN);
+		memdelete(mutex);
+	}
+	send_blocks_to_save();
+}
+
+void VoxelTerrain::flush_saves() {
+	send_blocks_to_save();
+	if (_stream_thread) {
+		_stream_thread->flush_saves();
+	}
+}
+
+void VoxelTerrain::send_blocks_to_save() {
+	if (_stream_thread) {
+		_stream_thread->push_saves(_blocks_to_save);
+	}
+	_blocks_to_save.clear();
+}
+
 void VoxelTerrain::_notification(int p_what) {
 
 	switch (p_what) {
@@ -483,6 +510,8 @@ void VoxelTerrain::_notification(int p_what) {
 			break;
 
 		case NOTIFICATION_EXIT_TREE:
+			save_modified_blocks();
+			flush_saves();
 			break;
 
 		case NOTIFICATION_ENTER_WORLD: {
@@ -562,44 +591,85 @@ void VoxelTerrain::_process() {
 		Rect3i new_box = Rect3i::from_center_extents(viewer_block_pos, Vector3i(_view_distance_blocks));
 		Rect3i prev_box = Rect3i::from_center_extents(_last_viewer_block_pos, Vector3i(_last_view_distance_blocks));
 
-		if (prev_box != new_box) {
-			//print_line(String("Loaded area changed: from ") + prev_box.to_string() + String(" to ") + new_box.to_string());
+		// Blocks are loaded within the view distance, but only unloaded once they get beyond the margin,
+		// so a viewer moving back and forth across a block boundary doesn't reload them every time
+		Rect3i new_keep_box = new_box.padded(_unload_margin_blocks);
+		Rect3i prev_keep_box = prev_box.padded(_last_unload_margin_blocks);
 
-			Rect3i bounds = Rect3i::get_bounding_box(prev_box, new_box);
-			Vector3i max = bounds.pos + bounds.size;
-
-			// TODO There should be a way to only iterate relevant blocks
-			Vector3i pos;
-			for (pos.z = bounds.pos.z; pos.z < max.z; ++pos.z) {
-				for (pos.y = bounds.pos.y; pos.y < max.y; ++pos.y) {
-					for (pos.x = bounds.pos.x; pos.x < max.x; ++pos.x) {
+		if (prev_box != new_box || prev_keep_box != new_keep_box) {
+			//print_line(String("Loaded area changed: from ") + prev_box.to_string() + String(" to ") + new_box.to_string());
 
-						bool prev_contains = prev_box.contains(pos);
-						bool new_contains = new_box.contains(pos);
+			// Only blocks in the difference between boxes are visited, so the cost doesn't depend on how far
+			// the viewer moved. If the boxes don't intersect, it is a full unload followed by a full load.
 
-						if (prev_contains && !new_contains) {
-							// Unload block
-							immerge_block(pos);
+			struct UnloadAction {
+				VoxelTerrain *self;
 
-						} else if (!prev_contains && new_contains) {
-							// Load or update block
-							make_block_dirty(pos);
+				void operator()(const Rect3i &box) {
+					const Vector3i max = box.pos + box.size;
+					Vector3i pos;
+					for (pos.z = box.pos.z; pos.z < max.z; ++pos.z) {
+						for (pos.y = box.pos.y; pos.y < max.y; ++pos.y) {
+							for (pos.x = box.pos.x; pos.x < max.x; ++pos.x) {
+								self->immerge_block(pos);
+							}
 						}
 					}
 				}
-			}
+			};
+
+			struct LoadAction {
+				VoxelTerrain *self;
+				Rect3i prev_keep_box;
+
+				void operator()(const Rect3i &box) {
+					const Vector3i max = box.pos + box.size;
+					Vector3i pos;
+					for (pos.z = box.pos.z; pos.z < max.z; ++pos.z) {
+						for (pos.y = box.pos.y; pos.y < max.y; ++pos.y) {
+							for (pos.x = box.pos.x; pos.x < max.x; ++pos.x) {
+
+								const VoxelBlock *block = self->_map->get_block(pos);
+								if (prev_keep_box.contains(pos) && block != NULL && block->has_been_meshed()) {
+									// The block was kept in the margin, along with its pending updates
+									++self->_stats.unloads_avoided;
+								} else {
+									// Load or update block
+									self->make_block_dirty(pos);
+								}
+							}
+						}
+					}
+				}
+			};
+
+			UnloadAction unload_action;
+			unload_action.self = this;
+			prev_keep_box.difference(new_keep_box, unload_action);
+
+			LoadAction load_action;
+			load_action.self = this;
+			load_action.prev_keep_box = prev_keep_box;
+			new_box.difference(prev_box, load_action);
 		}
 
+		// Loaded blocks stay within that box, so they can be stored in a grid following it
+		_map->set_grid_region(new_keep_box);
+
 		// Eliminate pending blocks that aren't needed
-		remove_positions_outside_box(_blocks_pending_load, new_box, _dirty_blocks);
-		remove_positions_outside_box(_blocks_pending_update, new_box, _dirty_blocks);
+		remove_positions_outside_box(_blocks_pending_load, new_keep_box, _dirty_blocks);
+		remove_positions_outside_box(_blocks_pending_update, new_keep_box, _dirty_blocks);
 	}
 
 	_stats.time_detect_required_blocks = profiling_clock.restart(); 
 
 	_last_view_distance_blocks = _view_distance_blocks;
+	_last_unload_margin_blocks = _unload_margin_blocks;
 	_last_viewer_block_pos = viewer_block_pos;
 
+	// Saves go first, so blocks loaded again right after being unloaded get their latest voxels
+	send_blocks_to_save();
+
 	// Send block loading requests
 	{
 		VoxelDataLoader::Input input;
@@ -608,8 +678,21 @@ void VoxelTerrain::_process() {
 		input.priority_direction = viewer_direction;
 
 		for (int i = 0; i < _blocks_pending_load.size(); ++i) {
+			const Vector3i block_pos = _blocks_pending_load[i];
+
+			// Blocks unloaded recently can be revived without going through the stream
+			Ref<VoxelBuffer> cached_voxels = _block_cache.take(block_pos, 0);
+			if (cached_voxels.is_valid()) {
+				VoxelDataLoader::OutputBlock ob;
+				ob.position = block_pos;
+				ob.lod = 0;
+				ob.data.voxels_loaded = cached_voxels;
+				_blocks_revived_from_cache.push_back(ob);
+				continue;
+			}
+
 			VoxelDataLoader::InputBlock input_block;
-			input_block.position = _blocks_pending_load[i];
+			input_block.position = block_pos;
 			input_block.lod = 0;
 			input.blocks.push_back(input_block);
 		}
@@ -635,6 +718,12 @@ void VoxelTerrain::_process() {
 		_stats.stream = output.stats;
 		_stats.dropped_stream_blocks = 0;
 
+		// Revived blocks are handled like loaded ones
+		for (int i = 0; i < _blocks_revived_from_cache.size(); ++i) {
+			output.blocks.push_back(_blocks_revived_from_cache[i]);
+		}
+		_blocks_revived_from_cache.clear();
+
 		for (int i = 0; i < output.blocks.size(); ++i) {
 
 			const VoxelDataLoader::OutputBlock &ob = output.blocks[i];
@@ -688,6 +777,7 @@ void VoxelTerrain::_process() {
 								}
 
 								_dirty_blocks[npos] = BLOCK_UPDATE_NOT_SENT;
+								_blocks_modified_boxes.erase(npos);
 								_blocks_pending_update.push_back(npos);
 							}
 						}
@@ -697,6 +787,7 @@ void VoxelTerrain::_process() {
 			} else {
 				// Only update the block, neighbors will probably follow if needed
 				_dirty_blocks[block_pos] = BLOCK_UPDATE_NOT_SENT;
+				_blocks_modified_boxes.erase(block_pos);
 				_blocks_pending_update.push_back(block_pos);
 				//OS::get_singleton()->print("Update (%i, %i, %i)\n", block_pos.x, block_pos.y, block_pos.z);
 			}
@@ -705,6 +796,15 @@ void VoxelTerrain::_process() {
 
 	_stats.time_process_load_responses = profiling_clock.restart();
 
+	// Schedule updates for voxels edited through the map
+	{
+		Vector<Rect3i> modified_boxes;
+		_map->consume_modified_areas(modified_boxes);
+		for (int i = 0; i < modified_boxes.size(); ++i) {
+			make_area_dirty(modified_boxes[i]);
+		}
+	}
+
 	// Send mesh updates
 	{
 		VoxelMeshUpdater::Input input;
@@ -737,10 +837,13 @@ void VoxelTerrain::_process() {
 
 						// The block contains empty voxels
 						block->set_mesh(Ref<Mesh>(), Ref<World>());
+						block->mark_been_meshed();
 						_dirty_blocks.erase(block_pos);
+						_blocks_modified_boxes.erase(block_pos);
 
-						// Optional, but I guess it might spare some memory
-						block->voxels->clear_channel(Voxel::CHANNEL_TYPE, air_type);
+						// Optional, but I guess it might spare some memory.
+						// Doesn't count as an edit, so the block won't be saved for it.
+						block->voxels->compress_uniform_channels();
 
 						continue;
 					}
@@ -761,11 +864,27 @@ void VoxelTerrain::_process() {
 			nbuffer->create(block_size + 2 * padding, block_size + 2 * padding, block_size + 2 * padding);
 
 			unsigned int channels_mask = (1 << VoxelBuffer::CHANNEL_TYPE) | (1 << VoxelBuffer::CHANNEL_ISOLEVEL);
+
+			// Copies convert voxels to the format of the destination, so use the one of the block
+			const VoxelBlock *block = _map->get_block(block_pos);
+			if (block != NULL) {
+				const VoxelBuffer &block_voxels = **block->voxels;
+				nbuffer->set_channel_format(VoxelBuffer::CHANNEL_TYPE, block_voxels.get_channel_format(VoxelBuffer::CHANNEL_TYPE));
+				nbuffer->set_channel_format(VoxelBuffer::CHANNEL_ISOLEVEL, block_voxels.get_channel_format(VoxelBuffer::CHANNEL_ISOLEVEL));
+			}
+
 			_map->get_buffer_copy(_map->block_to_voxel(block_pos) - Vector3i(padding), **nbuffer, channels_mask);
 
 			VoxelMeshUpdater::InputBlock iblock;
 			iblock.data.voxels = nbuffer;
 			iblock.position = block_pos;
+
+			const Rect3i *modified_box = _blocks_modified_boxes.getptr(block_pos);
+			if (modified_box != NULL) {
+				iblock.data.modified_box = *modified_box;
+				_blocks_modified_boxes.erase(block_pos);
+			}
+
 			input.blocks.push_back(iblock);
 
 			*block_state = BLOCK_UPDATE_SENT;
@@ -859,6 +978,7 @@ void VoxelTerrain::_process() {
 			}
 
 			block->set_mesh(mesh, world);
+			block->mark_been_meshed();
 		}
 
 		shift_up(_blocks_pending_main_thread_update, queue_index);
@@ -868,6 +988,18 @@ void VoxelTerrain::_process() {
 
 	_stats.time_process_update_responses = profiling_clock.restart();
 
+	// Use some of the remaining frame time to free memory blocks no longer need
+	{
+		VoxelMap::CompactionStats compaction_stats;
+		if (_compaction_time_budget_usec > 0) {
+			_map->compact(_compaction_time_budget_usec, _compaction_compress_enabled, compaction_stats);
+		}
+		_stats.compaction_processed_blocks = compaction_stats.processed_blocks;
+		_stats.compaction_reclaimed_bytes = compaction_stats.reclaimed_bytes;
+	}
+
+	_stats.time_compaction = profiling_clock.restart();
+
 	//print_line(String("d:") + String::num(_dirty_blocks.size()) + String(", q:") + String::num(_block_update_queue.size()));
 }
 
@@ -972,12 +1104,30 @@ void VoxelTerrain::_bind_methods() {
 	ClassDB::bind_method(D_METHOD("get_generate_collisions"), &VoxelTerrain::get_generate_collisions);
 	ClassDB::bind_method(D_METHOD("set_generate_collisions", "enabled"), &VoxelTerrain::set_generate_collisions);
 
+	ClassDB::bind_method(D_METHOD("set_unload_margin_blocks", "margin"), &VoxelTerrain::set_unload_margin_blocks);
+	ClassDB::bind_method(D_METHOD("get_unload_margin_blocks"), &VoxelTerrain::get_unload_margin_blocks);
+
 	ClassDB::bind_method(D_METHOD("get_viewer_path"), &VoxelTerrain::get_viewer_path);
 	ClassDB::bind_method(D_METHOD("set_viewer_path", "path"), &VoxelTerrain::set_viewer_path);
 
 	ClassDB::bind_method(D_METHOD("is_smooth_meshing_enabled"), &VoxelTerrain::is_smooth_meshing_enabled);
 	ClassDB::bind_method(D_METHOD("set_smooth_meshing_enabled", "enabled"), &VoxelTerrain::set_smooth_meshing_enabled);
 
+	ClassDB::bind_method(D_METHOD("set_block_dedup_enabled", "enabled"), &VoxelTerrain::set_block_dedup_enabled);
+	ClassDB::bind_method(D_METHOD("is_block_dedup_enabled"), &VoxelTerrain::is_block_dedup_enabled);
+
+	ClassDB::bind_method(D_METHOD("set_compaction_time_budget_usec", "usec"), &VoxelTerrain::set_compaction_time_budget_usec);
+	ClassDB::bind_method(D_METHOD("get_compaction_time_budget_usec"), &VoxelTerrain::get_compaction_time_budget_usec);
+
+	ClassDB::bind_method(D_METHOD("set_compaction_compress_enabled", "enabled"), &VoxelTerrain::set_compaction_compress_enabled);
+	ClassDB::bind_method(D_METHOD("is_compaction_compress_enabled"), &VoxelTerrain::is_compaction_compress_enabled);
+
+	ClassDB::bind_method(D_METHOD("save_modified_blocks"), &VoxelTerrain::save_modified_blocks);
+	ClassDB::bind_method(D_METHOD("flush_saves"), &VoxelTerrain::flush_saves);
+
+	ClassDB::bind_method(D_METHOD("set_block_cache_memory_budget", "bytes"), &VoxelTerrain::set_block_cache_memory_budget);
+	ClassDB::bind_method(D_METHOD("get_block_cache_memory_budget"), &VoxelTerrain::get_block_cache_memory_budget);
+
 	ClassDB::bind_method(D_METHOD("get_storage"), &VoxelTerrain::get_map);
 
 	ClassDB::bind_method(D_METHOD("voxel_to_block", "voxel_pos"), &VoxelTerrain::_voxel_to_block_binding);
@@ -994,9 +1144,14 @@ void VoxelTerrain::_bind_methods() {
 	ADD_PROPERTY(PropertyInfo(Variant::OBJECT, "stream", PROPERTY_HINT_RESOURCE_TYPE, "VoxelStream"), "set_stream", "get_stream");
 	ADD_PROPERTY(PropertyInfo(Variant::OBJECT, "voxel_library", PROPERTY_HINT_RESOURCE_TYPE, "VoxelLibrary"), "set_voxel_library", "get_voxel_library");
 	ADD_PROPERTY(PropertyInfo(Variant::INT, "view_distance"), "set_view_distance", "get_view_distance");
+	ADD_PROPERTY(PropertyInfo(Variant::INT, "unload_margin_blocks"), "set_unload_margin_blocks", "get_unload_margin_blocks");
 	ADD_PROPERTY(PropertyInfo(Variant::NODE_PATH, "viewer_path"), "set_viewer_path", "get_viewer_path");
 	ADD_PROPERTY(PropertyInfo(Variant::BOOL, "generate_collisions"), "set_generate_collisions", "get_generate_collisions");
 	ADD_PROPERTY(PropertyInfo(Variant::BOOL, "smooth_meshing_enabled"), "set_smooth_meshing_enabled", "is_smooth_meshing_enabled");
+	ADD_PROPERTY(PropertyInfo(Variant::INT, "block_cache_memory_budget"), "set_block_cache_memory_budget", "get_block_cache_memory_budget");
+	ADD_PROPERTY(PropertyInfo(Variant::BOOL, "block_dedup_enabled"), "set_block_dedup_enabled", "is_block_dedup_enabled");
+	ADD_PROPERTY(PropertyInfo(Variant::INT, "compaction_time_budget_usec"), "set_compaction_time_budget_usec", "get_compaction_time_budget_usec");
+	ADD_PROPERTY(PropertyInfo(Variant::BOOL, "compaction_compress_enabled"), "set_compaction_compress_enabled", "is_compaction_compress_enabled");
 
 	BIND_ENUM_CONSTANT(BLOCK_NONE);
 	BIND_ENUM_CONSTANT(BLOCK_LOAD);
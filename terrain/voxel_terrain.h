@@ -5,6 +5,7 @@
 #include "../math/vector3i.h"
 #include "../streams/voxel_stream.h"
 #include "../util/zprofiling.h"
+#include "voxel_block_cache.h"
 #include "voxel_data_loader.h"
 #include "voxel_mesh_updater.h"
 
@@ -49,6 +50,10 @@ public:
 	int get_view_distance() const;
 	void set_view_distance(int distance_in_voxels);
 
+	// How many blocks beyond the view distance are kept loaded before being unloaded
+	int get_unload_margin_blocks() const;
+	void set_unload_margin_blocks(int margin);
+
 	void set_viewer_path(NodePath path);
 	NodePath get_viewer_path() const;
 
@@ -58,6 +63,28 @@ public:
 	bool is_smooth_meshing_enabled() const;
 	void set_smooth_meshing_enabled(bool enabled);
 
+	// Time spent each frame freeing memory blocks no longer need, in microseconds. 0 disables it
+	void set_compaction_time_budget_usec(int usec);
+	int get_compaction_time_budget_usec() const;
+
+	// If enabled, blocks which haven't been edited recently get compressed by the compaction
+	void set_compaction_compress_enabled(bool enabled);
+	bool is_compaction_compress_enabled() const;
+
+	// Loaded blocks with identical voxels share them, see VoxelMap::set_dedup_enabled
+	void set_block_dedup_enabled(bool enabled);
+	bool is_block_dedup_enabled() const;
+
+	// Saves blocks edited since they were loaded, without unloading them.
+	// Saving happens in the background, use `flush_saves` to wait for it.
+	void save_modified_blocks();
+	// Blocks until all blocks unloaded or saved so far are written by the stream
+	void flush_saves();
+
+	// Unloaded blocks are kept compressed within this amount of bytes, 0 disables it
+	void set_block_cache_memory_budget(int bytes);
+	int get_block_cache_memory_budget() const;
+
 	Ref<VoxelMap> get_map() { return _map; }
 
 	struct Stats {
@@ -73,6 +100,10 @@ public:
 		uint64_t time_process_load_responses;
 		uint64_t time_send_update_requests;
 		uint64_t time_process_update_responses;
+		uint64_t unloads_avoided;
+		uint64_t time_compaction;
+		unsigned int compaction_processed_blocks;
+		uint64_t compaction_reclaimed_bytes;
 
 		Stats() :
 				mesh_alloc_time(0),
@@ -84,7 +115,11 @@ public:
 				time_send_load_requests(0),
 				time_process_load_responses(0),
 				time_send_update_requests(0),
-				time_process_update_responses(0) {}
+				time_process_update_responses(0),
+				unloads_avoided(0),
+				time_compaction(0),
+				compaction_processed_blocks(0),
+				compaction_reclaimed_bytes(0) {}
 	};
 
 protected:
@@ -103,6 +138,7 @@ private:
 	Spatial *get_viewer(NodePath path) const;
 
 	void immerge_block(Vector3i bpos);
+	void send_blocks_to_save();
 
 	Dictionary get_statistics() const;
 
@@ -125,6 +161,8 @@ private:
 
 	// How many blocks to load around the viewer
 	int _view_distance_blocks;
+	int _unload_margin_blocks;
+	int _last_unload_margin_blocks;
 
 	// TODO Terrains only need to handle the visible portion of voxels, which reduces the bounds blocks to handle.
 	// Therefore, could a simple grid be better to use than a hashmap?
@@ -132,7 +170,13 @@ private:
 	Vector<Vector3i> _blocks_pending_load;
 	Vector<Vector3i> _blocks_pending_update;
 	HashMap<Vector3i, BlockDirtyState, Vector3iHasher> _dirty_blocks; // TODO Rename _block_states
+	// Parts of blocks pending update which actually changed, in padded buffer coordinates.
+	// Blocks pending update without an entry here need to be remeshed entirely.
+	HashMap<Vector3i, Rect3i, Vector3iHasher> _blocks_modified_boxes;
 	Vector<VoxelMeshUpdater::OutputBlock> _blocks_pending_main_thread_update;
+	Vector<VoxelDataLoader::OutputBlock> _blocks_revived_from_cache;
+	std::vector<VoxelDataLoader::InputBlock> _blocks_to_save;
+	VoxelBlockCache _block_cache;
 
 	Ref<VoxelStream> _stream;
 	VoxelDataLoader *_stream_thread;
@@ -148,6 +192,9 @@ private:
 	bool _run_in_editor;
 	bool _smooth_meshing_enabled;
 
+	int _compaction_time_budget_usec;
+	bool _compaction_compress_enabled;
+
 	Ref<Material> _materials[VoxelMesherBlocky::MAX_MATERIALS];
 
 	Stats _stats;
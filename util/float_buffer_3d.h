@@ -14,6 +14,9 @@ public:
 
 	inline const Vector3i &get_size() const { return _size; }
 
+	// Values are stored in the same order as VoxelBuffer, so they can be copied in bulk
+	inline const float *get_data() const { return _data; }
+
 	float get(int x, int y, int z) const;
 	float get_clamped(int x, int y, int z) const;
 	float get_trilinear(float x, float y, float z) const;
@@ -0,0 +1,70 @@
+#ifndef VOXEL_MORTON_H
+#define VOXEL_MORTON_H
+
+#include <core/typedefs.h>
+
+// Morton (Z-order) indexing of 3D grids.
+// Bits of X, Y and Z are interleaved, so voxels close in space are also close in memory,
+// which suits neighborhood reads better than a linear layout. Coordinates are limited to 10 bits.
+
+const uint32_t MORTON_MASK_X = 0x09249249;
+const uint32_t MORTON_MASK_Y = 0x12492492;
+const uint32_t MORTON_MASK_Z = 0x24924924;
+
+// Spreads the 10 lower bits of `a` so that there are two zero bits between each of them
+inline uint32_t morton_spread_bits(uint32_t a) {
+	a &= 0x3ff;
+	a = (a | (a << 16)) & 0x030000ff;
+	a = (a | (a << 8)) & 0x0300f00f;
+	a = (a | (a << 4)) & 0x030c30c3;
+	a = (a | (a << 2)) & 0x09249249;
+	return a;
+}
+
+inline uint32_t morton_compact_bits(uint32_t a) {
+	a &= 0x09249249;
+	a = (a | (a >> 2)) & 0x030c30c3;
+	a = (a | (a >> 4)) & 0x0300f00f;
+	a = (a | (a >> 8)) & 0x030000ff;
+	a = (a | (a >> 16)) & 0x000003ff;
+	return a;
+}
+
+inline uint32_t morton_encode(uint32_t x, uint32_t y, uint32_t z) {
+	return morton_spread_bits(x) | (morton_spread_bits(y) << 1) | (morton_spread_bits(z) << 2);
+}
+
+inline void morton_decode(uint32_t m, uint32_t &out_x, uint32_t &out_y, uint32_t &out_z) {
+	out_x = morton_compact_bits(m);
+	out_y = morton_compact_bits(m >> 1);
+	out_z = morton_compact_bits(m >> 2);
+}
+
+// Neighbor offsets, computed directly on the Morton code without decoding it.
+// The caller must make sure the neighbor coordinate doesn't go out of range.
+
+inline uint32_t morton_inc(uint32_t m, uint32_t axis_mask) {
+	return (((m | ~axis_mask) + 1) & axis_mask) | (m & ~axis_mask);
+}
+
+inline uint32_t morton_dec(uint32_t m, uint32_t axis_mask) {
+	return (((m & axis_mask) - 1) & axis_mask) | (m & ~axis_mask);
+}
+
+inline uint32_t morton_inc_x(uint32_t m) { return morton_inc(m, MORTON_MASK_X); }
+inline uint32_t morton_inc_y(uint32_t m) { return morton_inc(m, MORTON_MASK_Y); }
+inline uint32_t morton_inc_z(uint32_t m) { return morton_inc(m, MORTON_MASK_Z); }
+
+inline uint32_t morton_dec_x(uint32_t m) { return morton_dec(m, MORTON_MASK_X); }
+inline uint32_t morton_dec_y(uint32_t m) { return morton_dec(m, MORTON_MASK_Y); }
+inline uint32_t morton_dec_z(uint32_t m) { return morton_dec(m, MORTON_MASK_Z); }
+
+// Number of elements an array must have to be indexed by Morton codes of a grid of the given size
+inline uint32_t morton_get_volume(uint32_t sx, uint32_t sy, uint32_t sz) {
+	if (sx == 0 || sy == 0 || sz == 0) {
+		return 0;
+	}
+	return morton_encode(sx - 1, sy - 1, sz - 1) + 1;
+}
+
+#endif // VOXEL_MORTON_H
@@ -0,0 +1,78 @@
+#include "parallel_for.h"
+#include <core/os/os.h>
+
+namespace {
+VoxelWorkerPool *g_worker_pool = nullptr;
+} // namespace
+
+void VoxelWorkerPool::create_singleton() {
+	CRASH_COND(g_worker_pool != nullptr);
+	g_worker_pool = memnew(VoxelWorkerPool);
+}
+
+void VoxelWorkerPool::destroy_singleton() {
+	CRASH_COND(g_worker_pool == nullptr);
+	VoxelWorkerPool *pool = g_worker_pool;
+	g_worker_pool = nullptr;
+	memdelete(pool);
+}
+
+VoxelWorkerPool *VoxelWorkerPool::get_singleton() {
+	return g_worker_pool;
+}
+
+VoxelWorkerPool::VoxelWorkerPool() {
+	_mutex = Mutex::create();
+	_start_semaphore = Semaphore::create();
+	_done_semaphore = Semaphore::create();
+
+	// The thread calling `run` works too
+	const int worker_count = OS::get_singleton()->get_processor_count() - 1;
+	for (int i = 0; i < worker_count; ++i) {
+		_threads.push_back(Thread::create(_thread_func, this));
+	}
+}
+
+VoxelWorkerPool::~VoxelWorkerPool() {
+	_exit = true;
+	for (unsigned int i = 0; i < _threads.size(); ++i) {
+		_start_semaphore->post();
+	}
+	for (unsigned int i = 0; i < _threads.size(); ++i) {
+		Thread::wait_to_finish(_threads[i]);
+		memdelete(_threads[i]);
+	}
+	memdelete(_done_semaphore);
+	memdelete(_start_semaphore);
+	memdelete(_mutex);
+}
+
+void VoxelWorkerPool::run(Task &task, unsigned int worker_count) {
+	MutexLock lock(_mutex);
+
+	worker_count = MIN(worker_count, (unsigned int)_threads.size());
+	_task = &task;
+	for (unsigned int i = 0; i < worker_count; ++i) {
+		_start_semaphore->post();
+	}
+
+	task.run();
+
+	for (unsigned int i = 0; i < worker_count; ++i) {
+		_done_semaphore->wait();
+	}
+	_task = nullptr;
+}
+
+void VoxelWorkerPool::_thread_func(void *p_self) {
+	VoxelWorkerPool *self = (VoxelWorkerPool *)p_self;
+
+	while (true) {
+		self->_start_semaphore->wait();
+		if (self->_exit) {
+			break;
+		}
+		self->_task->run();
+		self->_done_semaphore->post();
+	}
+}
@@ -0,0 +1,101 @@
+#ifndef VOXEL_PARALLEL_FOR_H
+#define VOXEL_PARALLEL_FOR_H
+
+#include <core/os/mutex.h>
+#include <core/os/semaphore.h>
+#include <core/os/thread.h>
+#include <core/safe_refcount.h>
+#include <vector>
+
+// Threads running the work of `parallel_for_each`.
+// They are created once and wait for work, so parallel loops don't pay for creating threads every time.
+// Only one loop runs at a time, other callers wait for it to finish.
+class VoxelWorkerPool {
+public:
+	class Task {
+	public:
+		virtual ~Task() {}
+		// Called by each participating thread, returns once no work is left
+		virtual void run() = 0;
+	};
+
+	static void create_singleton();
+	static void destroy_singleton();
+	static VoxelWorkerPool *get_singleton();
+
+	VoxelWorkerPool();
+	~VoxelWorkerPool();
+
+	unsigned int get_worker_count() const { return _threads.size(); }
+
+	// Runs the task on the calling thread and on up to `worker_count` workers, and returns when all are done.
+	// Must not be called from within a task.
+	void run(Task &task, unsigned int worker_count);
+
+private:
+	static void _thread_func(void *p_self);
+
+	std::vector<Thread *> _threads;
+	Mutex *_mutex = nullptr;
+	Semaphore *_start_semaphore = nullptr;
+	Semaphore *_done_semaphore = nullptr;
+	Task *_task = nullptr;
+	bool _exit = false;
+};
+
+// Calls `op(item)` for every item of the array, using several threads.
+// Items are split in chunks of `grain` items, which threads pick one after the other until none are left.
+// The calling thread takes part in the work, and the function returns once all items were processed.
+// `op` is shared by all threads, so it must be safe to call concurrently.
+template <typename T, typename Op_T>
+void parallel_for_each(T *items, unsigned int count, unsigned int grain, Op_T op) {
+
+	if (count == 0) {
+		return;
+	}
+	if (grain == 0) {
+		grain = 1;
+	}
+
+	struct Context : VoxelWorkerPool::Task {
+		T *items;
+		unsigned int count;
+		unsigned int grain;
+		uint32_t chunk_count;
+		volatile uint32_t next_chunk;
+		Op_T *op;
+
+		void run() override {
+			while (true) {
+				const uint32_t chunk_index = atomic_increment(&next_chunk) - 1;
+				if (chunk_index >= chunk_count) {
+					break;
+				}
+				const unsigned int begin = chunk_index * grain;
+				const unsigned int end = MIN(begin + grain, count);
+				for (unsigned int i = begin; i < end; ++i) {
+					(*op)(items[i]);
+				}
+			}
+		}
+	};
+
+	Context context;
+	context.items = items;
+	context.count = count;
+	context.grain = grain;
+	context.chunk_count = (count + grain - 1) / grain;
+	context.next_chunk = 0;
+	context.op = &op;
+
+	VoxelWorkerPool *pool = VoxelWorkerPool::get_singleton();
+	if (pool == nullptr || context.chunk_count == 1) {
+		context.run();
+		return;
+	}
+
+	// No need for more threads than there are chunks
+	pool->run(context, MIN(pool->get_worker_count(), context.chunk_count - 1));
+}
+
+#endif // VOXEL_PARALLEL_FOR_H
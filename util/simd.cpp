@@ -0,0 +1,123 @@
+#include "simd.h"
+#include <string.h>
+
+#ifndef VOXEL_SIMD_DISABLED
+#if defined(__AVX2__)
+#include <immintrin.h>
+#define VOXEL_SIMD_AVX2
+#define VOXEL_SIMD_SSE2
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define VOXEL_SIMD_SSE2
+#endif
+#endif
+
+bool simd_is_uniform(const uint8_t *data, unsigned int count, unsigned int element_size) {
+
+	const unsigned int byte_count = count * element_size;
+	if (count <= 1) {
+		return true;
+	}
+
+	// Element sizes are powers of two up to 4, so repeating the first element fills vectors exactly.
+	// Comparing bytes with that pattern then works whatever the element size is.
+	uint8_t pattern[32];
+	for (unsigned int i = 0; i < 32; ++i) {
+		pattern[i] = data[i % element_size];
+	}
+
+	unsigned int i = 0;
+
+#ifdef VOXEL_SIMD_AVX2
+	const __m256i pattern256 = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(pattern));
+	for (; i + 32 <= byte_count; i += 32) {
+		const __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(data + i));
+		if (_mm256_movemask_epi8(_mm256_cmpeq_epi8(v, pattern256)) != -1) {
+			return false;
+		}
+	}
+#endif
+
+#ifdef VOXEL_SIMD_SSE2
+	const __m128i pattern128 = _mm_loadu_si128(reinterpret_cast<const __m128i *>(pattern));
+	for (; i + 16 <= byte_count; i += 16) {
+		const __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i *>(data + i));
+		if (_mm_movemask_epi8(_mm_cmpeq_epi8(v, pattern128)) != 0xffff) {
+			return false;
+		}
+	}
+#endif
+
+	// Scalar path compares 8 bytes at a time
+	uint64_t pattern64;
+	memcpy(&pattern64, pattern, sizeof(uint64_t));
+	for (; i + 8 <= byte_count; i += 8) {
+		uint64_t v;
+		memcpy(&v, data + i, sizeof(uint64_t));
+		if (v != pattern64) {
+			return false;
+		}
+	}
+
+	for (; i < byte_count; ++i) {
+		if (data[i] != pattern[i % element_size]) {
+			return false;
+		}
+	}
+
+	return true;
+}
+
+void simd_isos_to_bytes(const float *src, uint8_t *dst, unsigned int count) {
+
+	unsigned int i = 0;
+
+#ifdef VOXEL_SIMD_SSE2
+	const __m128 k128 = _mm_set1_ps(128.f);
+	for (; i + 16 <= count; i += 16) {
+		// Truncate like the scalar cast does, then saturating packs take care of clamping to 0..255
+		const __m128i a = _mm_cvttps_epi32(_mm_add_ps(_mm_mul_ps(_mm_loadu_ps(src + i), k128), k128));
+		const __m128i b = _mm_cvttps_epi32(_mm_add_ps(_mm_mul_ps(_mm_loadu_ps(src + i + 4), k128), k128));
+		const __m128i c = _mm_cvttps_epi32(_mm_add_ps(_mm_mul_ps(_mm_loadu_ps(src + i + 8), k128), k128));
+		const __m128i d = _mm_cvttps_epi32(_mm_add_ps(_mm_mul_ps(_mm_loadu_ps(src + i + 12), k128), k128));
+		const __m128i bytes = _mm_packus_epi16(_mm_packs_epi32(a, b), _mm_packs_epi32(c, d));
+		_mm_storeu_si128(reinterpret_cast<__m128i *>(dst + i), bytes);
+	}
+#endif
+
+	for (; i < count; ++i) {
+		const int v = static_cast<int>(128.f * src[i] + 128.f);
+		dst[i] = v > 255 ? 255 : v < 0 ? 0 : v;
+	}
+}
+
+void simd_bytes_to_isos(const uint8_t *src, float *dst, unsigned int count) {
+
+	unsigned int i = 0;
+
+#ifdef VOXEL_SIMD_SSE2
+	const __m128i zero = _mm_setzero_si128();
+	const __m128 k128 = _mm_set1_ps(128.f);
+	// Dividing by a power of two is exact, so multiplying gives the same results
+	const __m128 inv128 = _mm_set1_ps(1.f / 128.f);
+	for (; i + 16 <= count; i += 16) {
+		const __m128i bytes = _mm_loadu_si128(reinterpret_cast<const __m128i *>(src + i));
+		const __m128i lo = _mm_unpacklo_epi8(bytes, zero);
+		const __m128i hi = _mm_unpackhi_epi8(bytes, zero);
+		const __m128i words[4] = {
+			_mm_unpacklo_epi16(lo, zero),
+			_mm_unpackhi_epi16(lo, zero),
+			_mm_unpacklo_epi16(hi, zero),
+			_mm_unpackhi_epi16(hi, zero)
+		};
+		for (unsigned int j = 0; j < 4; ++j) {
+			const __m128 f = _mm_mul_ps(_mm_sub_ps(_mm_cvtepi32_ps(words[j]), k128), inv128);
+			_mm_storeu_ps(dst + i + j * 4, f);
+		}
+	}
+#endif
+
+	for (; i < count; ++i) {
+		dst[i] = static_cast<float>(src[i] - 128) / 128.f;
+	}
+}
@@ -0,0 +1,18 @@
+#ifndef VOXEL_SIMD_H
+#define VOXEL_SIMD_H
+
+#include <core/typedefs.h>
+
+// Bulk operations on voxel arrays, vectorized with SSE2 or AVX2 when the compiler targets them.
+// Define VOXEL_SIMD_DISABLED to build the scalar versions only, for comparison.
+
+// Tells if all `count` elements of `element_size` bytes are equal to the first one
+bool simd_is_uniform(const uint8_t *data, unsigned int count, unsigned int element_size);
+
+// Quantizes isolevels from -1..1 into 0..255, same as `VoxelBuffer::iso_to_byte`
+void simd_isos_to_bytes(const float *src, uint8_t *dst, unsigned int count);
+
+// Converts 0..255 bytes into -1..1 isolevels, same as `VoxelBuffer::byte_to_iso`
+void simd_bytes_to_isos(const uint8_t *src, float *dst, unsigned int count);
+
+#endif // VOXEL_SIMD_H
@@ -1,213 +1,1572 @@
 #include "voxel_buffer.h"
+#include "util/simd.h"
+#include "voxel_memory_pool.h"
 
 #include <core/math/math_funcs.h>
+#include <core/safe_refcount.h>
 #include <string.h>
 
 const char *VoxelBuffer::CHANNEL_ID_HINT_STRING = "Type,Sdf,Data2,Data3,Data4,Data5,Data6,Data7";
 
+namespace {
+
+// Channel data is refcounted, so buffers can share it and copy it only when one of them modifies it.
+// The header sits right before the voxels.
+struct ChannelDataHeader {
+	SafeRefCount refcount;
+	// Size of the data following the header, in bytes
+	uint32_t size;
+	// Flat arrays of terrain blocks come in only a few sizes so they are pooled. Compressed data is not.
+	bool pooled;
+};
+
+// Keeps voxels aligned
+const unsigned int CHANNEL_DATA_HEADER_SIZE = 16;
+
+inline ChannelDataHeader &get_channel_data_header(const uint8_t *data) {
+	return *reinterpret_cast<ChannelDataHeader *>(const_cast<uint8_t *>(data) - CHANNEL_DATA_HEADER_SIZE);
+}
+
+uint8_t *alloc_channel_data(unsigned int size, bool pooled) {
+	uint8_t *block;
+	VoxelMemoryPool *pool = VoxelMemoryPool::get_singleton();
+	if (pooled && pool != nullptr) {
+		block = pool->allocate(CHANNEL_DATA_HEADER_SIZE + size);
+	} else {
+		block = (uint8_t *)memalloc(CHANNEL_DATA_HEADER_SIZE + size);
+		pooled = false;
+	}
+	ChannelDataHeader *header = reinterpret_cast<ChannelDataHeader *>(block);
+	header->refcount.init();
+	header->size = size;
+	header->pooled = pooled;
+	return block + CHANNEL_DATA_HEADER_SIZE;
+}
+
+inline void ref_channel_data(uint8_t *data) {
+	get_channel_data_header(data).refcount.ref();
+}
+
+void free_channel_data(uint8_t *data) {
+	ChannelDataHeader &header = get_channel_data_header(data);
+	uint8_t *block = data - CHANNEL_DATA_HEADER_SIZE;
+	VoxelMemoryPool *pool = VoxelMemoryPool::get_singleton();
+	if (header.pooled && pool != nullptr) {
+		pool->recycle(block, CHANNEL_DATA_HEADER_SIZE + header.size);
+	} else {
+		// Also happens if the pool was destroyed before the buffer
+		memfree(block);
+	}
+}
+
+void unref_channel_data(uint8_t *data) {
+	if (get_channel_data_header(data).refcount.unref()) {
+		free_channel_data(data);
+	}
+}
+
+inline bool is_channel_data_shared(const uint8_t *data) {
+	return get_channel_data_header(data).refcount.get() > 1;
+}
+
+uint8_t *duplicate_channel_data(const uint8_t *data) {
+	const ChannelDataHeader &header = get_channel_data_header(data);
+	uint8_t *copy = alloc_channel_data(header.size, header.pooled);
+	memcpy(copy, data, header.size);
+	return copy;
+}
+
+// Raw voxel access, where the size of a voxel is only known at runtime
+
+inline uint32_t read_raw(const uint8_t *data, unsigned int format_size, unsigned int i) {
+	switch (format_size) {
+		case 1:
+			return data[i];
+		case 2:
+			return reinterpret_cast<const uint16_t *>(data)[i];
+		case 4:
+			return reinterpret_cast<const uint32_t *>(data)[i];
+		default:
+			CRASH_NOW();
+			return 0;
+	}
+}
+
+inline void write_raw(uint8_t *data, unsigned int format_size, unsigned int i, uint32_t value) {
+	switch (format_size) {
+		case 1:
+			data[i] = value;
+			break;
+		case 2:
+			reinterpret_cast<uint16_t *>(data)[i] = value;
+			break;
+		case 4:
+			reinterpret_cast<uint32_t *>(data)[i] = value;
+			break;
+		default:
+			CRASH_NOW();
+	}
+}
+
+template <typename T>
+inline void fill_typed(T *dst, unsigned int count, T value) {
+	for (unsigned int i = 0; i < count; ++i) {
+		dst[i] = value;
+	}
+}
+
+// Sets `count` voxels starting at `dst`
+void fill_voxels_raw(uint8_t *dst, unsigned int format_size, unsigned int count, uint32_t value) {
+	switch (format_size) {
+		case 1:
+			memset(dst, value, count);
+			break;
+		case 2:
+			fill_typed(reinterpret_cast<uint16_t *>(dst), count, (uint16_t)value);
+			break;
+		case 4:
+			fill_typed(reinterpret_cast<uint32_t *>(dst), count, value);
+			break;
+		default:
+			CRASH_NOW();
+	}
+}
+
+// Conversions between raw values and the values exposed by the API
+
+union FloatBits {
+	float f;
+	uint32_t u;
+};
+
+real_t float_from_raw(VoxelBuffer::ChannelFormat format, uint32_t raw) {
+	switch (format) {
+		case VoxelBuffer::FORMAT_U8:
+			return VoxelBuffer::byte_to_iso(raw);
+		case VoxelBuffer::FORMAT_U16:
+			return (static_cast<real_t>(raw) - 32768.f) / 32768.f;
+		case VoxelBuffer::FORMAT_U32:
+			return (static_cast<double>(raw) - 2147483648.0) / 2147483648.0;
+		case VoxelBuffer::FORMAT_F16:
+			return Math::half_to_float(raw);
+		case VoxelBuffer::FORMAT_F32: {
+			FloatBits b;
+			b.u = raw;
+			return b.f;
+		}
+		default:
+			CRASH_NOW();
+			return 0;
+	}
+}
+
+uint32_t raw_from_float(VoxelBuffer::ChannelFormat format, real_t value) {
+	switch (format) {
+		case VoxelBuffer::FORMAT_U8:
+			return VoxelBuffer::iso_to_byte(value);
+		case VoxelBuffer::FORMAT_U16:
+			return CLAMP(static_cast<int>(32768.f * value + 32768.f), 0, 65535);
+		case VoxelBuffer::FORMAT_U32:
+			return CLAMP(static_cast<int64_t>(2147483648.0 * value + 2147483648.0), (int64_t)0, (int64_t)0xffffffff);
+		case VoxelBuffer::FORMAT_F16:
+			return Math::make_half_float(value);
+		case VoxelBuffer::FORMAT_F32: {
+			FloatBits b;
+			b.f = value;
+			return b.u;
+		}
+		default:
+			CRASH_NOW();
+			return 0;
+	}
+}
+
+inline int int_from_raw(VoxelBuffer::ChannelFormat format, uint32_t raw) {
+	if (VoxelBuffer::is_format_float(format)) {
+		return VoxelBuffer::iso_to_byte(float_from_raw(format, raw));
+	}
+	return raw;
+}
+
+inline uint32_t raw_from_int(VoxelBuffer::ChannelFormat format, int value) {
+	switch (format) {
+		case VoxelBuffer::FORMAT_U8:
+			return value & 0xff;
+		case VoxelBuffer::FORMAT_U16:
+			return value & 0xffff;
+		case VoxelBuffer::FORMAT_U32:
+			return value;
+		default:
+			return raw_from_float(format, VoxelBuffer::byte_to_iso(value));
+	}
+}
+
+// Converts a raw value from a format to another.
+// Isolevels keep their meaning as distances, other channels keep their integer value.
+inline uint32_t convert_raw(uint32_t raw, VoxelBuffer::ChannelFormat src_format, VoxelBuffer::ChannelFormat dst_format, bool as_float) {
+	if (as_float) {
+		return raw_from_float(dst_format, float_from_raw(src_format, raw));
+	}
+	return raw_from_int(dst_format, raw);
+}
+
+void convert_voxels_raw(const uint8_t *src, VoxelBuffer::ChannelFormat src_format,
+		uint8_t *dst, VoxelBuffer::ChannelFormat dst_format, unsigned int count, bool as_float) {
+	const unsigned int src_format_size = VoxelBuffer::get_format_size(src_format);
+	const unsigned int dst_format_size = VoxelBuffer::get_format_size(dst_format);
+	for (unsigned int i = 0; i < count; ++i) {
+		write_raw(dst, dst_format_size, i, convert_raw(read_raw(src, src_format_size, i), src_format, dst_format, as_float));
+	}
+}
+
+// Palette RLE channels are stored in a single allocation, laid out like this:
+// - RleHeader
+// - uint32_t palette[palette_size], holding raw voxel values
+// - uint16_t row_starts[row_count + 1]: index of the first run of each [z][x] row, plus one marking the end
+// - RleRun runs[run_count]
+struct RleHeader {
+	uint32_t palette_size;
+	uint32_t run_count;
+};
+
+// Consecutive voxels along Y having the same value
+struct RleRun {
+	uint8_t palette_index;
+	uint8_t length;
+};
+
+const unsigned int RLE_MAX_PALETTE_SIZE = 256;
+const unsigned int RLE_MAX_RUN_LENGTH = 255;
+// Because row starts are 16-bit
+const unsigned int RLE_MAX_RUN_COUNT = 65535;
+
+inline unsigned int rle_get_size(unsigned int palette_size, unsigned int row_count, unsigned int run_count) {
+	return sizeof(RleHeader) + palette_size * sizeof(uint32_t) + (row_count + 1) * sizeof(uint16_t) + run_count * sizeof(RleRun);
+}
+
+inline const RleHeader &rle_header(const uint8_t *data) {
+	return *reinterpret_cast<const RleHeader *>(data);
+}
+
+inline const uint32_t *rle_palette(const uint8_t *data) {
+	return reinterpret_cast<const uint32_t *>(data + sizeof(RleHeader));
+}
+
+inline const uint16_t *rle_row_starts(const uint8_t *data) {
+	return reinterpret_cast<const uint16_t *>(rle_palette(data) + rle_header(data).palette_size);
+}
+
+inline const RleRun *rle_runs(const uint8_t *data, unsigned int row_count) {
+	return reinterpret_cast<const RleRun *>(rle_row_starts(data) + row_count + 1);
+}
+
+uint32_t rle_get_voxel(const uint8_t *data, unsigned int row_count, unsigned int row, unsigned int y) {
+	const uint16_t *row_starts = rle_row_starts(data);
+	const RleRun *runs = rle_runs(data, row_count);
+	const uint32_t *palette = rle_palette(data);
+
+	const unsigned int end = row_starts[row + 1];
+	for (unsigned int i = row_starts[row]; i < end; ++i) {
+		const RleRun &run = runs[i];
+		if (y < run.length) {
+			return palette[run.palette_index];
+		}
+		y -= run.length;
+	}
+
+	CRASH_NOW(); // Row is shorter than the buffer, the data is corrupted
+	return 0;
+}
+
+// Decodes `count` voxels of a row starting from `y` into a flat destination
+void rle_read_row(const uint8_t *data, unsigned int row_count, unsigned int row, unsigned int y, unsigned int count,
+		uint8_t *dst, unsigned int format_size) {
+
+	const uint16_t *row_starts = rle_row_starts(data);
+	const RleRun *runs = rle_runs(data, row_count);
+	const uint32_t *palette = rle_palette(data);
+
+	const unsigned int end = row_starts[row + 1];
+	unsigned int run_begin = 0;
+
+	for (unsigned int i = row_starts[row]; i < end && count > 0; ++i) {
+		const RleRun &run = runs[i];
+		const unsigned int run_end = run_begin + run.length;
+
+		if (y < run_end) {
+			unsigned int n = MIN(run_end - y, count);
+			fill_voxels_raw(dst, format_size, n, palette[run.palette_index]);
+			dst += n * format_size;
+			y += n;
+			count -= n;
+		}
+
+		run_begin = run_end;
+	}
+
+	CRASH_COND(count != 0);
+}
+
+int rle_find_or_add(uint32_t *palette, unsigned int &palette_size, uint32_t v) {
+	for (unsigned int i = 0; i < palette_size; ++i) {
+		if (palette[i] == v) {
+			return i;
+		}
+	}
+	if (palette_size == RLE_MAX_PALETTE_SIZE) {
+		return -1;
+	}
+	palette[palette_size] = v;
+	return palette_size++;
+}
+
+// Returns a newly allocated palette RLE block, or null if it would not take less memory than the flat array
+template <typename T>
+uint8_t *rle_encode(const T *src, unsigned int row_count, unsigned int row_length) {
+
+	// First pass: find palette and count runs, so we can allocate once
+
+	uint32_t palette[RLE_MAX_PALETTE_SIZE];
+	unsigned int palette_size = 0;
+	unsigned int run_count = 0;
+
+	for (unsigned int row = 0; row < row_count; ++row) {
+		const T *row_src = src + row * row_length;
+		unsigned int length = 0;
+
+		for (unsigned int y = 0; y < row_length; ++y) {
+			const T v = row_src[y];
+
+			if (y == 0 || v != row_src[y - 1] || length == RLE_MAX_RUN_LENGTH) {
+				if (rle_find_or_add(palette, palette_size, v) == -1) {
+					// Too many different values
+					return NULL;
+				}
+				++run_count;
+				length = 0;
+			}
+			++length;
+		}
+	}
+
+	if (run_count > RLE_MAX_RUN_COUNT) {
+		return NULL;
+	}
+
+	const unsigned int size = rle_get_size(palette_size, row_count, run_count);
+	if (size >= row_count * row_length * sizeof(T)) {
+		// Not worth it
+		return NULL;
+	}
+
+	// Second pass: write runs
+
+	uint8_t *data = alloc_channel_data(size, false);
+	memset(data, 0, size);
+
+	RleHeader &header = *reinterpret_cast<RleHeader *>(data);
+	header.palette_size = palette_size;
+	header.run_count = run_count;
+
+	memcpy(data + sizeof(RleHeader), palette, palette_size * sizeof(uint32_t));
+
+	uint16_t *row_starts = const_cast<uint16_t *>(rle_row_starts(data));
+	RleRun *runs = const_cast<RleRun *>(rle_runs(data, row_count));
+	unsigned int run_index = 0;
+
+	for (unsigned int row = 0; row < row_count; ++row) {
+		const T *row_src = src + row * row_length;
+		row_starts[row] = run_index;
+
+		for (unsigned int y = 0; y < row_length; ++y) {
+			const T v = row_src[y];
+
+			if (y == 0 || v != row_src[y - 1] || runs[run_index - 1].length == RLE_MAX_RUN_LENGTH) {
+				RleRun &run = runs[run_index];
+				run.palette_index = rle_find_or_add(palette, palette_size, v);
+				run.length = 0;
+				++run_index;
+			}
+			++runs[run_index - 1].length;
+		}
+	}
+
+	row_starts[row_count] = run_index;
+	CRASH_COND(run_index != run_count);
+
+	return data;
+}
+
+// Bricks
+
+const unsigned int BRICK_SIZE_PO2 = 3;
+const unsigned int BRICK_SIZE = 1 << BRICK_SIZE_PO2;
+const unsigned int BRICK_MASK = BRICK_SIZE - 1;
+const unsigned int BRICK_VOLUME = BRICK_SIZE * BRICK_SIZE * BRICK_SIZE;
+
+// A bricked channel is a table of these, in order [z][x][y] like voxels.
+// Bricks on the positive edges of the buffer may be partially outside, such voxels are never read.
+struct Brick {
+	// Flat array of BRICK_VOLUME voxels, refcounted like channel data so tables can share bricks.
+	// Null if the brick is uniform.
+	uint8_t *data;
+	// Value of all voxels if the brick is uniform, in raw representation
+	uint32_t value;
+};
+
+inline Vector3i get_brick_grid_size(const Vector3i &size) {
+	return Vector3i(
+			(size.x + BRICK_MASK) >> BRICK_SIZE_PO2,
+			(size.y + BRICK_MASK) >> BRICK_SIZE_PO2,
+			(size.z + BRICK_MASK) >> BRICK_SIZE_PO2);
+}
+
+// Index of the brick containing a voxel
+inline unsigned int get_brick_index(const Vector3i &grid_size, unsigned int x, unsigned int y, unsigned int z) {
+	return (y >> BRICK_SIZE_PO2) + grid_size.y * ((x >> BRICK_SIZE_PO2) + grid_size.x * (z >> BRICK_SIZE_PO2));
+}
+
+// Index of a voxel inside its brick
+inline unsigned int get_index_in_brick(unsigned int x, unsigned int y, unsigned int z) {
+	return (y & BRICK_MASK) + BRICK_SIZE * ((x & BRICK_MASK) + BRICK_SIZE * (z & BRICK_MASK));
+}
+
+inline Brick *get_bricks(uint8_t *data) {
+	return reinterpret_cast<Brick *>(data);
+}
+
+inline const Brick *get_bricks(const uint8_t *data) {
+	return reinterpret_cast<const Brick *>(data);
+}
+
+inline unsigned int get_brick_count(const uint8_t *data) {
+	return get_channel_data_header(data).size / sizeof(Brick);
+}
+
+uint8_t *alloc_brick_table(unsigned int brick_count, uint32_t value) {
+	uint8_t *data = alloc_channel_data(brick_count * sizeof(Brick), false);
+	Brick *bricks = get_bricks(data);
+	for (unsigned int i = 0; i < brick_count; ++i) {
+		bricks[i].data = NULL;
+		bricks[i].value = value;
+	}
+	return data;
+}
+
+// Bricks all have the same size, so they are pooled
+inline uint8_t *alloc_brick_data(unsigned int format_size) {
+	return alloc_channel_data(BRICK_VOLUME * format_size, true);
+}
+
+void unref_brick_table(uint8_t *data) {
+	if (get_channel_data_header(data).refcount.unref()) {
+		Brick *bricks = get_bricks(data);
+		const unsigned int brick_count = get_brick_count(data);
+		for (unsigned int i = 0; i < brick_count; ++i) {
+			if (bricks[i].data) {
+				unref_channel_data(bricks[i].data);
+			}
+		}
+		free_channel_data(data);
+	}
+}
+
+// The copy shares dense bricks with the original
+uint8_t *duplicate_brick_table(const uint8_t *data) {
+	uint8_t *copy = duplicate_channel_data(data);
+	Brick *bricks = get_bricks(copy);
+	const unsigned int brick_count = get_brick_count(copy);
+	for (unsigned int i = 0; i < brick_count; ++i) {
+		if (bricks[i].data) {
+			ref_channel_data(bricks[i].data);
+		}
+	}
+	return copy;
+}
+
+// Makes the brick dense and not shared, so its voxels can be written.
+// The table containing it must not be shared either.
+void make_brick_writable(Brick &brick, unsigned int format_size) {
+	if (brick.data == NULL) {
+		brick.data = alloc_brick_data(format_size);
+		fill_voxels_raw(brick.data, format_size, BRICK_VOLUME, brick.value);
+	} else if (is_channel_data_shared(brick.data)) {
+		uint8_t *copy = duplicate_channel_data(brick.data);
+		unref_channel_data(brick.data);
+		brick.data = copy;
+	}
+}
+
+inline void make_brick_uniform(Brick &brick, uint32_t value) {
+	if (brick.data) {
+		unref_channel_data(brick.data);
+		brick.data = NULL;
+	}
+	brick.value = value;
+}
+
+inline uint32_t bricks_get_voxel(const uint8_t *data, const Vector3i &grid_size, unsigned int format_size,
+		unsigned int x, unsigned int y, unsigned int z) {
+	const Brick &brick = get_bricks(data)[get_brick_index(grid_size, x, y, z)];
+	if (brick.data == NULL) {
+		return brick.value;
+	}
+	return read_raw(brick.data, format_size, get_index_in_brick(x, y, z));
+}
+
+// Decodes `count` voxels along Y into a flat destination
+void bricks_read_row(const uint8_t *data, const Vector3i &grid_size, unsigned int format_size,
+		unsigned int x, unsigned int y, unsigned int z, unsigned int count, uint8_t *dst) {
+
+	const Brick *bricks = get_bricks(data);
+
+	while (count > 0) {
+		const Brick &brick = bricks[get_brick_index(grid_size, x, y, z)];
+		const unsigned int n = MIN(BRICK_SIZE - (y & BRICK_MASK), count);
+
+		if (brick.data == NULL) {
+			fill_voxels_raw(dst, format_size, n, brick.value);
+		} else {
+			memcpy(dst, brick.data + get_index_in_brick(x, y, z) * format_size, n * format_size);
+		}
+
+		dst += n * format_size;
+		y += n;
+		count -= n;
+	}
+}
+
+// Tells if the voxels of the brick lying inside the buffer all have the same value
+bool is_brick_uniform(const Brick &brick, unsigned int format_size, const Vector3i &extent, uint32_t &out_value) {
+	if (brick.data == NULL) {
+		out_value = brick.value;
+		return true;
+	}
+	const uint32_t v = read_raw(brick.data, format_size, 0);
+	if (extent == Vector3i(BRICK_SIZE)) {
+		if (!simd_is_uniform(brick.data, BRICK_VOLUME, format_size)) {
+			return false;
+		}
+		out_value = v;
+		return true;
+	}
+	for (int z = 0; z < extent.z; ++z) {
+		for (int x = 0; x < extent.x; ++x) {
+			for (int y = 0; y < extent.y; ++y) {
+				if (read_raw(brick.data, format_size, get_index_in_brick(x, y, z)) != v) {
+					return false;
+				}
+			}
+		}
+	}
+	out_value = v;
+	return true;
+}
+
+// How many voxels of the brick lie inside the buffer
+inline Vector3i get_brick_extent(const Vector3i &size, const Vector3i &brick_pos) {
+	return Vector3i(
+			MIN((int)BRICK_SIZE, size.x - (brick_pos.x << BRICK_SIZE_PO2)),
+			MIN((int)BRICK_SIZE, size.y - (brick_pos.y << BRICK_SIZE_PO2)),
+			MIN((int)BRICK_SIZE, size.z - (brick_pos.z << BRICK_SIZE_PO2)));
+}
+
+// Range of bricks overlapped by the area between `min` and `max` (exclusive), kept inside the grid
+inline void get_brick_range(const Vector3i &grid_size, const Vector3i &min, const Vector3i &max,
+		Vector3i &out_min_brick, Vector3i &out_max_brick) {
+	out_min_brick = min >> BRICK_SIZE_PO2;
+	out_max_brick = (max - Vector3i(1, 1, 1)) >> BRICK_SIZE_PO2;
+	out_max_brick.x = MIN(out_max_brick.x, grid_size.x - 1);
+	out_max_brick.y = MIN(out_max_brick.y, grid_size.y - 1);
+	out_max_brick.z = MIN(out_max_brick.z, grid_size.z - 1);
+}
+
+// Clamps an exclusive bound so it doesn't go past the buffer
+inline void clamp_to_size(Vector3i &v, const Vector3i &size) {
+	v.x = CLAMP(v.x, 0, size.x);
+	v.y = CLAMP(v.y, 0, size.y);
+	v.z = CLAMP(v.z, 0, size.z);
+}
+
+} // namespace
+
 VoxelBuffer::VoxelBuffer() {
 	_channels[CHANNEL_ISOLEVEL].defval = 255;
 }
 
-VoxelBuffer::~VoxelBuffer() {
-	clear();
+VoxelBuffer::~VoxelBuffer() {
+	clear();
+}
+
+void VoxelBuffer::create(int sx, int sy, int sz) {
+	if (sx <= 0 || sy <= 0 || sz <= 0) {
+		return;
+	}
+	Vector3i new_size(sx, sy, sz);
+	if (new_size != _size) {
+		for (unsigned int i = 0; i < MAX_CHANNELS; ++i) {
+			Channel &channel = _channels[i];
+			if (channel.data) {
+				// Channel already contained data
+				// TODO Optimize with realloc
+				delete_channel(i);
+				create_channel(i, new_size, channel.defval);
+			}
+		}
+		_size = new_size;
+		// Previous edits don't mean anything after a resize
+		_modified_box = Rect3i();
+	}
+}
+
+void VoxelBuffer::clear() {
+	for (unsigned int i = 0; i < MAX_CHANNELS; ++i) {
+		Channel &channel = _channels[i];
+		if (channel.data) {
+			delete_channel(i);
+		}
+	}
+}
+
+void VoxelBuffer::clear_channel(unsigned int channel_index, int clear_value) {
+	ERR_FAIL_INDEX(channel_index, MAX_CHANNELS);
+	clear_channel_raw(channel_index, raw_from_int(_channels[channel_index].format, clear_value));
+	mark_modified(Rect3i(Vector3i(), _size));
+}
+
+void VoxelBuffer::clear_channel_f(unsigned int channel_index, real_t clear_value) {
+	ERR_FAIL_INDEX(channel_index, MAX_CHANNELS);
+	clear_channel_raw(channel_index, raw_from_float(_channels[channel_index].format, clear_value));
+	mark_modified(Rect3i(Vector3i(), _size));
+}
+
+void VoxelBuffer::clear_channel_raw(int i, uint32_t raw_value) {
+	if (_channels[i].data) {
+		delete_channel(i);
+	}
+	_channels[i].defval = raw_value;
+}
+
+void VoxelBuffer::set_default_values(uint8_t values[VoxelBuffer::MAX_CHANNELS]) {
+	for (unsigned int i = 0; i < MAX_CHANNELS; ++i) {
+		_channels[i].defval = raw_from_int(_channels[i].format, values[i]);
+	}
+}
+
+uint32_t VoxelBuffer::get_voxel_raw(int x, int y, int z, unsigned int channel_index) const {
+	const Channel &channel = _channels[channel_index];
+
+	if (validate_pos(x, y, z) && channel.data) {
+		if (channel.compression == COMPRESSION_PALETTE_RLE) {
+			return rle_get_voxel(channel.data, _size.x * _size.z, x + _size.x * z, y);
+		}
+		if (channel.compression == COMPRESSION_BRICKS) {
+			return bricks_get_voxel(channel.data, get_brick_grid_size(_size), get_format_size(channel.format), x, y, z);
+		}
+		return read_raw(channel.data, get_format_size(channel.format), index(x, y, z));
+	} else {
+		return channel.defval;
+	}
+}
+
+void VoxelBuffer::set_voxel_raw(uint32_t raw_value, int x, int y, int z, unsigned int channel_index) {
+	Channel &channel = _channels[channel_index];
+
+	if (get_voxel_raw(x, y, z, channel_index) == raw_value) {
+		return;
+	}
+
+	make_channel_writable(channel_index);
+	const unsigned int format_size = get_format_size(channel.format);
+
+	if (channel.compression == COMPRESSION_BRICKS) {
+		Brick &brick = get_bricks(channel.data)[get_brick_index(get_brick_grid_size(_size), x, y, z)];
+		make_brick_writable(brick, format_size);
+		write_raw(brick.data, format_size, get_index_in_brick(x, y, z), raw_value);
+	} else {
+		write_raw(channel.data, format_size, index(x, y, z), raw_value);
+	}
+
+	mark_modified(Rect3i(Vector3i(x, y, z), Vector3i(1, 1, 1)));
+}
+
+int VoxelBuffer::get_voxel(int x, int y, int z, unsigned int channel_index) const {
+	ERR_FAIL_INDEX_V(channel_index, MAX_CHANNELS, 0);
+	return int_from_raw(_channels[channel_index].format, get_voxel_raw(x, y, z, channel_index));
+}
+
+void VoxelBuffer::set_voxel(int value, int x, int y, int z, unsigned int channel_index) {
+	ERR_FAIL_INDEX(channel_index, MAX_CHANNELS);
+	ERR_FAIL_COND(!validate_pos(x, y, z));
+	set_voxel_raw(raw_from_int(_channels[channel_index].format, value), x, y, z, channel_index);
+}
+
+real_t VoxelBuffer::get_voxel_f(int x, int y, int z, unsigned int channel_index) const {
+	ERR_FAIL_INDEX_V(channel_index, MAX_CHANNELS, 0);
+	return float_from_raw(_channels[channel_index].format, get_voxel_raw(x, y, z, channel_index));
+}
+
+void VoxelBuffer::set_voxel_f(real_t value, int x, int y, int z, unsigned int channel_index) {
+	ERR_FAIL_INDEX(channel_index, MAX_CHANNELS);
+	ERR_FAIL_COND(!validate_pos(x, y, z));
+	set_voxel_raw(raw_from_float(_channels[channel_index].format, value), x, y, z, channel_index);
+}
+
+// This version does not cause errors if out of bounds. Use only if it's okay to be outside.
+void VoxelBuffer::try_set_voxel(int x, int y, int z, int value, unsigned int channel_index) {
+	ERR_FAIL_INDEX(channel_index, MAX_CHANNELS);
+	if (!validate_pos(x, y, z)) {
+		return;
+	}
+	set_voxel(value, x, y, z, channel_index);
+}
+
+void VoxelBuffer::set_voxel_v(int value, Vector3 pos, unsigned int channel_index) {
+	set_voxel(value, pos.x, pos.y, pos.z, channel_index);
+}
+
+void VoxelBuffer::fill(int defval, unsigned int channel_index) {
+	ERR_FAIL_INDEX(channel_index, MAX_CHANNELS);
+	fill_raw(raw_from_int(_channels[channel_index].format, defval), channel_index);
+}
+
+void VoxelBuffer::fill_f(real_t value, unsigned int channel_index) {
+	ERR_FAIL_INDEX(channel_index, MAX_CHANNELS);
+	fill_raw(raw_from_float(_channels[channel_index].format, value), channel_index);
+}
+
+void VoxelBuffer::fill_raw(uint32_t raw_value, unsigned int channel_index) {
+
+	Channel &channel = _channels[channel_index];
+	mark_modified(Rect3i(Vector3i(), _size));
+
+	if (channel.data == NULL) {
+		// Channel is already optimized and uniform
+		channel.defval = raw_value;
+		return;
+	}
+
+	if (channel.compression != COMPRESSION_NONE || is_channel_data_shared(channel.data)) {
+		// No need to keep runs, bricks or a copy around, the channel will be uniform
+		clear_channel_raw(channel_index, raw_value);
+		return;
+	}
+
+	fill_voxels_raw(channel.data, get_format_size(channel.format), get_volume(), raw_value);
+}
+
+void VoxelBuffer::fill_area(int defval, Vector3i min, Vector3i max, unsigned int channel_index) {
+	ERR_FAIL_INDEX(channel_index, MAX_CHANNELS);
+
+	Vector3i::sort_min_max(min, max);
+
+	clamp_to_size(min, _size);
+	clamp_to_size(max, _size);
+
+	fill_area_raw(raw_from_int(_channels[channel_index].format, defval), min, max, channel_index);
+}
+
+void VoxelBuffer::fill_area_raw(uint32_t raw_value, Vector3i min, Vector3i max, unsigned int channel_index) {
+
+	Vector3i area_size = max - min;
+
+	if (area_size.x == 0 || area_size.y == 0 || area_size.z == 0) {
+		return;
+	}
+
+	if (area_size == _size) {
+		fill_raw(raw_value, channel_index);
+		return;
+	}
+
+	Channel &channel = _channels[channel_index];
+
+	if (channel.data == NULL && channel.defval == raw_value) {
+		return;
+	}
+
+	make_channel_writable(channel_index);
+	const unsigned int format_size = get_format_size(channel.format);
+
+	if (channel.compression == COMPRESSION_BRICKS) {
+		// Bricks fully covered by the area become uniform, others get filled where they overlap it
+		const Vector3i grid_size = get_brick_grid_size(_size);
+		Vector3i min_brick;
+		Vector3i max_brick;
+		get_brick_range(grid_size, min, max, min_brick, max_brick);
+		const Rect3i area = Rect3i::from_min_max(min, max);
+		Brick *bricks = get_bricks(channel.data);
+
+		Vector3i bpos;
+		for (bpos.z = min_brick.z; bpos.z <= max_brick.z; ++bpos.z) {
+			for (bpos.x = min_brick.x; bpos.x <= max_brick.x; ++bpos.x) {
+				for (bpos.y = min_brick.y; bpos.y <= max_brick.y; ++bpos.y) {
+
+					const Vector3i origin = bpos << BRICK_SIZE_PO2;
+					const Rect3i brick_box(origin, get_brick_extent(_size, bpos));
+					const Rect3i box = brick_box.clipped(area);
+					Brick &brick = bricks[bpos.y + grid_size.y * (bpos.x + grid_size.x * bpos.z)];
+
+					if (box == brick_box) {
+						make_brick_uniform(brick, raw_value);
+						continue;
+					}
+					if (brick.data == NULL && brick.value == raw_value) {
+						continue;
+					}
+
+					make_brick_writable(brick, format_size);
+					Vector3i pos;
+					for (pos.z = box.pos.z; pos.z < box.pos.z + box.size.z; ++pos.z) {
+						for (pos.x = box.pos.x; pos.x < box.pos.x + box.size.x; ++pos.x) {
+							unsigned int i = get_index_in_brick(pos.x, box.pos.y, pos.z);
+							fill_voxels_raw(&brick.data[i * format_size], format_size, box.size.y, raw_value);
+						}
+					}
+				}
+			}
+		}
+
+	} else {
+		Vector3i pos;
+		unsigned int volume = get_volume();
+		for (pos.z = min.z; pos.z < max.z; ++pos.z) {
+			for (pos.x = min.x; pos.x < max.x; ++pos.x) {
+				unsigned int dst_ri = index(pos.x, pos.y + min.y, pos.z);
+				CRASH_COND(dst_ri >= volume);
+				fill_voxels_raw(&channel.data[dst_ri * format_size], format_size, area_size.y, raw_value);
+			}
+		}
+	}
+
+	mark_modified(Rect3i(min, area_size));
+}
+
+void VoxelBuffer::set_channel_f(unsigned int channel_index, const float *values) {
+	ERR_FAIL_INDEX(channel_index, MAX_CHANNELS);
+	ERR_FAIL_COND(values == NULL);
+
+	Channel &channel = _channels[channel_index];
+
+	// All voxels get overwritten, so previous data doesn't need to be kept
+	if (channel.data) {
+		delete_channel(channel_index);
+	}
+	create_channel_noinit(channel_index, _size);
+
+	const unsigned int volume = get_volume();
+	switch (channel.format) {
+		case FORMAT_U8:
+			simd_isos_to_bytes(values, channel.data, volume);
+			break;
+		case FORMAT_F32:
+			memcpy(channel.data, values, volume * sizeof(float));
+			break;
+		default: {
+			const unsigned int format_size = get_format_size(channel.format);
+			for (unsigned int i = 0; i < volume; ++i) {
+				write_raw(channel.data, format_size, i, raw_from_float(channel.format, values[i]));
+			}
+		} break;
+	}
+
+	if (_bricked) {
+		compress_channel_bricks(channel_index);
+	}
+
+	mark_modified(Rect3i(Vector3i(), _size));
+}
+
+void VoxelBuffer::get_channel_f(unsigned int channel_index, float *out_values) const {
+	ERR_FAIL_INDEX(channel_index, MAX_CHANNELS);
+	ERR_FAIL_COND(out_values == NULL);
+	get_region_f(channel_index, Rect3i(Vector3i(), _size), out_values);
+}
+
+void VoxelBuffer::get_region_f(unsigned int channel_index, Rect3i box, float *out_values) const {
+
+	const Channel &channel = _channels[channel_index];
+	const unsigned int volume = box.size.x * box.size.y * box.size.z;
+
+	if (channel.data == NULL) {
+		const float v = float_from_raw(channel.format, channel.defval);
+		for (unsigned int i = 0; i < volume; ++i) {
+			out_values[i] = v;
+		}
+		return;
+	}
+
+	const unsigned int format_size = get_format_size(channel.format);
+	const unsigned int row_size = box.size.y;
+
+	// Compressed channels are decoded one row at a time
+	Vector<uint8_t> row_buffer;
+	if (channel.compression != COMPRESSION_NONE) {
+		row_buffer.resize(row_size * format_size);
+	}
+
+	for (int z = 0; z < box.size.z; ++z) {
+		for (int x = 0; x < box.size.x; ++x) {
+
+			const uint8_t *src;
+			if (channel.compression == COMPRESSION_NONE) {
+				src = &channel.data[index(box.pos.x + x, box.pos.y, box.pos.z + z) * format_size];
+			} else {
+				read_row_raw(channel_index, box.pos.x + x, box.pos.y, box.pos.z + z, row_size, row_buffer.ptrw());
+				src = row_buffer.ptr();
+			}
+
+			float *dst = out_values + row_size * (x + box.size.x * z);
+			switch (channel.format) {
+				case FORMAT_U8:
+					simd_bytes_to_isos(src, dst, row_size);
+					break;
+				case FORMAT_F32:
+					memcpy(dst, src, row_size * sizeof(float));
+					break;
+				default:
+					for (unsigned int i = 0; i < row_size; ++i) {
+						dst[i] = float_from_raw(channel.format, read_raw(src, format_size, i));
+					}
+					break;
+			}
+		}
+	}
+}
+
+PoolByteArray VoxelBuffer::get_channel_as_bytes(unsigned int channel_index) const {
+	return get_region_as_bytes(channel_index, Vector3i(), _size);
+}
+
+void VoxelBuffer::set_channel_from_bytes(unsigned int channel_index, PoolByteArray bytes) {
+	ERR_FAIL_INDEX(channel_index, MAX_CHANNELS);
+	ERR_FAIL_COND(bytes.size() != (int)(get_volume() * get_format_size(_channels[channel_index].format)));
+
+	PoolByteArray::Read r = bytes.read();
+	set_channel_raw_bytes(channel_index, r.ptr());
+}
+
+void VoxelBuffer::get_channel_raw_bytes(unsigned int channel_index, uint8_t *dst) const {
+	ERR_FAIL_INDEX(channel_index, MAX_CHANNELS);
+	ERR_FAIL_COND(dst == NULL);
+
+	const Channel &channel = _channels[channel_index];
+	const unsigned int format_size = get_format_size(channel.format);
+
+	if (channel.data && channel.compression == COMPRESSION_NONE) {
+		memcpy(dst, channel.data, get_volume() * format_size);
+		return;
+	}
+
+	const unsigned int row_size_in_bytes = _size.y * format_size;
+	for (int z = 0; z < _size.z; ++z) {
+		for (int x = 0; x < _size.x; ++x) {
+			read_row_raw(channel_index, x, 0, z, _size.y, dst + row_size_in_bytes * (x + _size.x * z));
+		}
+	}
+}
+
+void VoxelBuffer::set_channel_raw_bytes(unsigned int channel_index, const uint8_t *src) {
+	ERR_FAIL_INDEX(channel_index, MAX_CHANNELS);
+	ERR_FAIL_COND(src == NULL);
+
+	Channel &channel = _channels[channel_index];
+
+	// All voxels get overwritten, so previous data doesn't need to be kept
+	if (channel.data) {
+		delete_channel(channel_index);
+	}
+	create_channel_noinit(channel_index, _size);
+
+	memcpy(channel.data, src, get_volume() * get_format_size(channel.format));
+
+	if (_bricked) {
+		compress_channel_bricks(channel_index);
+	}
+
+	mark_modified(Rect3i(Vector3i(), _size));
+}
+
+uint32_t VoxelBuffer::get_channel_uniform_raw_value(unsigned int channel_index) const {
+	ERR_FAIL_INDEX_V(channel_index, MAX_CHANNELS, 0);
+	ERR_FAIL_COND_V(_channels[channel_index].data != NULL, 0);
+	return _channels[channel_index].defval;
+}
+
+void VoxelBuffer::set_channel_uniform_raw_value(unsigned int channel_index, uint32_t raw_value) {
+	ERR_FAIL_INDEX(channel_index, MAX_CHANNELS);
+	clear_channel_raw(channel_index, raw_value);
+	mark_modified(Rect3i(Vector3i(), _size));
+}
+
+PoolRealArray VoxelBuffer::get_channel_as_floats(unsigned int channel_index) const {
+	return get_region_as_floats(channel_index, Vector3i(), _size);
+}
+
+void VoxelBuffer::set_channel_from_floats(unsigned int channel_index, PoolRealArray values) {
+	ERR_FAIL_INDEX(channel_index, MAX_CHANNELS);
+	ERR_FAIL_COND(values.size() != (int)get_volume());
+
+	PoolRealArray::Read r = values.read();
+#ifdef REAL_T_IS_DOUBLE
+	Vector<float> floats;
+	floats.resize(values.size());
+	for (int i = 0; i < values.size(); ++i) {
+		floats.write[i] = r[i];
+	}
+	set_channel_f(channel_index, floats.ptr());
+#else
+	set_channel_f(channel_index, r.ptr());
+#endif
+}
+
+// Sorts the corners of a region, and checks it is not empty and inside the buffer
+bool VoxelBuffer::validate_region(Vector3i &min, Vector3i &max) const {
+	Vector3i::sort_min_max(min, max);
+	const Rect3i box = Rect3i::from_min_max(min, max);
+	ERR_FAIL_COND_V(box.is_empty(), false);
+	ERR_FAIL_COND_V(box.clipped(Rect3i(Vector3i(), _size)) != box, false);
+	return true;
+}
+
+PoolByteArray VoxelBuffer::get_region_as_bytes(unsigned int channel_index, Vector3i min, Vector3i max) const {
+	PoolByteArray bytes;
+	ERR_FAIL_INDEX_V(channel_index, MAX_CHANNELS, bytes);
+	if (!validate_region(min, max)) {
+		return bytes;
+	}
+
+	const Vector3i size = max - min;
+	const unsigned int format_size = get_format_size(_channels[channel_index].format);
+	bytes.resize(size.x * size.y * size.z * format_size);
+
+	PoolByteArray::Write w = bytes.write();
+	const unsigned int row_size_in_bytes = size.y * format_size;
+	for (int z = 0; z < size.z; ++z) {
+		for (int x = 0; x < size.x; ++x) {
+			read_row_raw(channel_index, min.x + x, min.y, min.z + z, size.y, w.ptr() + row_size_in_bytes * (x + size.x * z));
+		}
+	}
+
+	return bytes;
+}
+
+void VoxelBuffer::set_region_from_bytes(unsigned int channel_index, Vector3i min, Vector3i max, PoolByteArray bytes) {
+	ERR_FAIL_INDEX(channel_index, MAX_CHANNELS);
+	if (!validate_region(min, max)) {
+		return;
+	}
+
+	const Vector3i size = max - min;
+	const ChannelFormat format = _channels[channel_index].format;
+	ERR_FAIL_COND(bytes.size() != size.x * size.y * size.z * (int)get_format_size(format));
+
+	// Go through a temporary buffer so copy_from takes care of the representation of the channel
+	Ref<VoxelBuffer> tmp;
+	tmp.instance();
+	tmp->create(size.x, size.y, size.z);
+	tmp->set_channel_format(channel_index, format);
+	tmp->set_channel_from_bytes(channel_index, bytes);
+
+	copy_from(**tmp, Vector3i(), size, min, channel_index);
+}
+
+PoolRealArray VoxelBuffer::get_region_as_floats(unsigned int channel_index, Vector3i min, Vector3i max) const {
+	PoolRealArray values;
+	ERR_FAIL_INDEX_V(channel_index, MAX_CHANNELS, values);
+	if (!validate_region(min, max)) {
+		return values;
+	}
+
+	const Vector3i size = max - min;
+	values.resize(size.x * size.y * size.z);
+	PoolRealArray::Write w = values.write();
+
+#ifdef REAL_T_IS_DOUBLE
+	Vector<float> floats;
+	floats.resize(values.size());
+	get_region_f(channel_index, Rect3i(min, size), floats.ptrw());
+	for (int i = 0; i < values.size(); ++i) {
+		w[i] = floats[i];
+	}
+#else
+	get_region_f(channel_index, Rect3i(min, size), w.ptr());
+#endif
+
+	return values;
+}
+
+void VoxelBuffer::set_region_from_floats(unsigned int channel_index, Vector3i min, Vector3i max, PoolRealArray values) {
+	ERR_FAIL_INDEX(channel_index, MAX_CHANNELS);
+	if (!validate_region(min, max)) {
+		return;
+	}
+
+	const Vector3i size = max - min;
+	ERR_FAIL_COND(values.size() != size.x * size.y * size.z);
+
+	Ref<VoxelBuffer> tmp;
+	tmp.instance();
+	tmp->create(size.x, size.y, size.z);
+	tmp->set_channel_format(channel_index, _channels[channel_index].format);
+	tmp->set_channel_from_floats(channel_index, values);
+
+	copy_from(**tmp, Vector3i(), size, min, channel_index);
+}
+
+void VoxelBuffer::read_row_raw(unsigned int channel_index, int x, int y, int z, unsigned int count, uint8_t *dst) const {
+	const Channel &channel = _channels[channel_index];
+	const unsigned int format_size = get_format_size(channel.format);
+
+	if (channel.data == NULL) {
+		fill_voxels_raw(dst, format_size, count, channel.defval);
+		return;
+	}
+
+	switch (channel.compression) {
+		case COMPRESSION_PALETTE_RLE:
+			rle_read_row(channel.data, _size.x * _size.z, x + _size.x * z, y, count, dst, format_size);
+			break;
+		case COMPRESSION_BRICKS:
+			bricks_read_row(channel.data, get_brick_grid_size(_size), format_size, x, y, z, count, dst);
+			break;
+		default:
+			memcpy(dst, &channel.data[index(x, y, z) * format_size], count * format_size);
+			break;
+	}
 }
 
-void VoxelBuffer::create(int sx, int sy, int sz) {
-	if (sx <= 0 || sy <= 0 || sz <= 0) {
-		return;
+bool VoxelBuffer::is_uniform(unsigned int channel_index) const {
+	ERR_FAIL_INDEX_V(channel_index, MAX_CHANNELS, true);
+
+	const Channel &channel = _channels[channel_index];
+	if (channel.data == NULL) {
+		// Channel has been optimized
+		return true;
 	}
-	Vector3i new_size(sx, sy, sz);
-	if (new_size != _size) {
-		for (unsigned int i = 0; i < MAX_CHANNELS; ++i) {
-			Channel &channel = _channels[i];
-			if (channel.data) {
-				// Channel already contained data
-				// TODO Optimize with realloc
-				delete_channel(i);
-				create_channel(i, new_size, channel.defval);
+
+	if (channel.compression == COMPRESSION_PALETTE_RLE) {
+		return rle_header(channel.data).palette_size == 1;
+	}
+
+	if (channel.compression == COMPRESSION_BRICKS) {
+		// Most bricks are expected to be uniform, so only dense ones need to be looked at
+		const unsigned int format_size = get_format_size(channel.format);
+		const Vector3i grid_size = get_brick_grid_size(_size);
+		const Brick *bricks = get_bricks(channel.data);
+		uint32_t first_value = 0;
+
+		Vector3i bpos;
+		for (bpos.z = 0; bpos.z < grid_size.z; ++bpos.z) {
+			for (bpos.x = 0; bpos.x < grid_size.x; ++bpos.x) {
+				for (bpos.y = 0; bpos.y < grid_size.y; ++bpos.y) {
+					const Brick &brick = bricks[bpos.y + grid_size.y * (bpos.x + grid_size.x * bpos.z)];
+					uint32_t value;
+					if (!is_brick_uniform(brick, format_size, get_brick_extent(_size, bpos), value)) {
+						return false;
+					}
+					if (bpos == Vector3i()) {
+						first_value = value;
+					} else if (value != first_value) {
+						return false;
+					}
+				}
 			}
 		}
-		_size = new_size;
+		return true;
+	}
+
+	// Channel isn't optimized, so must look at each voxel
+	return simd_is_uniform(channel.data, get_volume(), get_format_size(channel.format));
+}
+
+void VoxelBuffer::compress_uniform_channel(unsigned int channel_index) {
+	ERR_FAIL_INDEX(channel_index, MAX_CHANNELS);
+	if (_channels[channel_index].data && is_uniform(channel_index)) {
+		clear_channel_raw(channel_index, get_voxel_raw(0, 0, 0, channel_index));
 	}
 }
 
-void VoxelBuffer::clear() {
+void VoxelBuffer::compress_uniform_channels() {
 	for (unsigned int i = 0; i < MAX_CHANNELS; ++i) {
-		Channel &channel = _channels[i];
-		if (channel.data) {
-			delete_channel(i);
-		}
+		compress_uniform_channel(i);
 	}
 }
 
-void VoxelBuffer::clear_channel(unsigned int channel_index, int clear_value) {
+void VoxelBuffer::compress_channel(unsigned int channel_index) {
 	ERR_FAIL_INDEX(channel_index, MAX_CHANNELS);
-	if (_channels[channel_index].data) {
-		delete_channel(channel_index);
+
+	Channel &channel = _channels[channel_index];
+	if (channel.data == NULL || channel.compression == COMPRESSION_PALETTE_RLE) {
+		return;
+	}
+
+	if (is_uniform(channel_index)) {
+		clear_channel_raw(channel_index, get_voxel_raw(0, 0, 0, channel_index));
+		return;
+	}
+
+	if (channel.compression == COMPRESSION_BRICKS) {
+		optimize_bricks(channel_index);
+	} else if (_bricked) {
+		compress_channel_bricks(channel_index);
+	} else {
+		compress_channel_rle(channel_index);
 	}
-	_channels[channel_index].defval = clear_value;
 }
 
-void VoxelBuffer::set_default_values(uint8_t values[VoxelBuffer::MAX_CHANNELS]) {
+void VoxelBuffer::compress() {
 	for (unsigned int i = 0; i < MAX_CHANNELS; ++i) {
-		_channels[i].defval = values[i];
+		compress_channel(i);
 	}
 }
 
-int VoxelBuffer::get_voxel(int x, int y, int z, unsigned int channel_index) const {
-	ERR_FAIL_INDEX_V(channel_index, MAX_CHANNELS, 0);
+bool VoxelBuffer::compress_channel_rle(int i) {
+	Channel &channel = _channels[i];
+	CRASH_COND(channel.data == NULL);
+	CRASH_COND(channel.compression != COMPRESSION_NONE);
 
-	const Channel &channel = _channels[channel_index];
+	const unsigned int row_count = _size.x * _size.z;
+	uint8_t *rle_data = NULL;
 
-	if (validate_pos(x, y, z) && channel.data) {
-		return channel.data[index(x, y, z)];
-	} else {
-		return channel.defval;
+	switch (get_format_size(channel.format)) {
+		case 1:
+			rle_data = rle_encode(channel.data, row_count, _size.y);
+			break;
+		case 2:
+			rle_data = rle_encode(reinterpret_cast<const uint16_t *>(channel.data), row_count, _size.y);
+			break;
+		case 4:
+			rle_data = rle_encode(reinterpret_cast<const uint32_t *>(channel.data), row_count, _size.y);
+			break;
+		default:
+			CRASH_NOW();
+	}
+
+	if (rle_data == NULL) {
+		return false;
 	}
+
+	delete_channel(i);
+	channel.data = rle_data;
+	channel.compression = COMPRESSION_PALETTE_RLE;
+	return true;
 }
 
-void VoxelBuffer::set_voxel(int value, int x, int y, int z, unsigned int channel_index) {
-	ERR_FAIL_INDEX(channel_index, MAX_CHANNELS);
-	ERR_FAIL_COND(!validate_pos(x, y, z));
+// Converts a dense or palette RLE channel into bricks
+void VoxelBuffer::compress_channel_bricks(int i) {
+	Channel &channel = _channels[i];
+	CRASH_COND(channel.data == NULL);
+	CRASH_COND(channel.compression == COMPRESSION_BRICKS);
 
-	Channel &channel = _channels[channel_index];
+	const unsigned int format_size = get_format_size(channel.format);
+	const Vector3i grid_size = get_brick_grid_size(_size);
+	uint8_t *table = alloc_brick_table(grid_size.x * grid_size.y * grid_size.z, channel.defval);
+	Brick *bricks = get_bricks(table);
 
-	if (channel.data == NULL) {
-		if (channel.defval != value) {
-			// Allocate channel with same initial values as defval
-			create_channel(channel_index, _size, channel.defval);
-			channel.data[index(x, y, z)] = value;
+	Vector3i bpos;
+	for (bpos.z = 0; bpos.z < grid_size.z; ++bpos.z) {
+		for (bpos.x = 0; bpos.x < grid_size.x; ++bpos.x) {
+			for (bpos.y = 0; bpos.y < grid_size.y; ++bpos.y) {
+
+				Brick &brick = bricks[bpos.y + grid_size.y * (bpos.x + grid_size.x * bpos.z)];
+				const Vector3i origin = bpos << BRICK_SIZE_PO2;
+				const Vector3i extent = get_brick_extent(_size, bpos);
+
+				brick.data = alloc_brick_data(format_size);
+				Vector3i pos;
+				for (pos.z = 0; pos.z < extent.z; ++pos.z) {
+					for (pos.x = 0; pos.x < extent.x; ++pos.x) {
+						read_row_raw(i, origin.x + pos.x, origin.y, origin.z + pos.z, extent.y,
+								&brick.data[get_index_in_brick(pos.x, 0, pos.z) * format_size]);
+					}
+				}
+
+				uint32_t value;
+				if (is_brick_uniform(brick, format_size, extent, value)) {
+					make_brick_uniform(brick, value);
+				}
+			}
 		}
-	} else {
-		channel.data[index(x, y, z)] = value;
 	}
+
+	delete_channel(i);
+	channel.data = table;
+	channel.compression = COMPRESSION_BRICKS;
 }
 
-// This version does not cause errors if out of bounds. Use only if it's okay to be outside.
-void VoxelBuffer::try_set_voxel(int x, int y, int z, int value, unsigned int channel_index) {
+// Turns dense bricks that became uniform back into single values
+void VoxelBuffer::optimize_bricks(int i) {
+	Channel &channel = _channels[i];
+	CRASH_COND(channel.compression != COMPRESSION_BRICKS);
+
+	const unsigned int format_size = get_format_size(channel.format);
+	const Vector3i grid_size = get_brick_grid_size(_size);
+	bool unique = false;
+
+	Vector3i bpos;
+	for (bpos.z = 0; bpos.z < grid_size.z; ++bpos.z) {
+		for (bpos.x = 0; bpos.x < grid_size.x; ++bpos.x) {
+			for (bpos.y = 0; bpos.y < grid_size.y; ++bpos.y) {
+
+				const unsigned int bi = bpos.y + grid_size.y * (bpos.x + grid_size.x * bpos.z);
+				uint32_t value;
+				if (get_bricks(channel.data)[bi].data == NULL ||
+						!is_brick_uniform(get_bricks(channel.data)[bi], format_size, get_brick_extent(_size, bpos), value)) {
+					continue;
+				}
+
+				// Only copy the table if there is something to change
+				if (!unique) {
+					ensure_unique(i);
+					unique = true;
+				}
+				make_brick_uniform(get_bricks(channel.data)[bi], value);
+			}
+		}
+	}
+}
+
+void VoxelBuffer::decompress_channel(unsigned int channel_index) {
 	ERR_FAIL_INDEX(channel_index, MAX_CHANNELS);
-	if (!validate_pos(x, y, z)) {
+
+	Channel &channel = _channels[channel_index];
+	if (channel.compression != COMPRESSION_PALETTE_RLE && channel.compression != COMPRESSION_BRICKS) {
 		return;
 	}
 
-	Channel &channel = _channels[channel_index];
+	uint8_t *dense_data = alloc_channel_data(get_volume() * get_format_size(channel.format), true);
 
-	if (channel.data == NULL) {
-		if (channel.defval != value) {
-			create_channel(channel_index, _size, channel.defval);
-			channel.data[index(x, y, z)] = value;
+	const unsigned int format_size = get_format_size(channel.format);
+	Vector3i pos;
+	for (pos.z = 0; pos.z < _size.z; ++pos.z) {
+		for (pos.x = 0; pos.x < _size.x; ++pos.x) {
+			read_row_raw(channel_index, pos.x, 0, pos.z, _size.y, &dense_data[index(pos.x, 0, pos.z) * format_size]);
 		}
-	} else {
-		channel.data[index(x, y, z)] = value;
 	}
+
+	delete_channel(channel_index);
+	channel.data = dense_data;
+	channel.compression = COMPRESSION_NONE;
 }
 
-void VoxelBuffer::set_voxel_v(int value, Vector3 pos, unsigned int channel_index) {
-	set_voxel(value, pos.x, pos.y, pos.z, channel_index);
+void VoxelBuffer::decompress() {
+	for (unsigned int i = 0; i < MAX_CHANNELS; ++i) {
+		decompress_channel(i);
+	}
 }
 
-void VoxelBuffer::fill(int defval, unsigned int channel_index) {
-	ERR_FAIL_INDEX(channel_index, MAX_CHANNELS);
+namespace {
 
-	Channel &channel = _channels[channel_index];
-	if (channel.data == NULL) {
-		// Channel is already optimized and uniform
-		if (channel.defval == defval) {
-			// No change
-			return;
-		} else {
-			// Just change default value
-			channel.defval = defval;
-			return;
+inline unsigned int get_channel_data_usage(const uint8_t *data, bool owned_only) {
+	if (owned_only && is_channel_data_shared(data)) {
+		return 0;
+	}
+	return CHANNEL_DATA_HEADER_SIZE + get_channel_data_header(data).size;
+}
+
+} // namespace
+
+unsigned int VoxelBuffer::compute_memory_usage(bool owned_only) const {
+	unsigned int usage = 0;
+	for (unsigned int i = 0; i < MAX_CHANNELS; ++i) {
+		const Channel &channel = _channels[i];
+		if (channel.data == NULL) {
+			continue;
+		}
+		if (owned_only && is_channel_data_shared(channel.data)) {
+			// Bricks of shared brick arrays are shared too
+			continue;
+		}
+		usage += get_channel_data_usage(channel.data, owned_only);
+		if (channel.compression == COMPRESSION_BRICKS) {
+			const Brick *bricks = get_bricks(channel.data);
+			const unsigned int brick_count = get_brick_count(channel.data);
+			for (unsigned int j = 0; j < brick_count; ++j) {
+				if (bricks[j].data) {
+					usage += get_channel_data_usage(bricks[j].data, owned_only);
+				}
+			}
 		}
-	} else {
-		create_channel_noinit(channel_index, _size);
 	}
+	return usage;
+}
 
-	unsigned int volume = get_volume();
-	memset(channel.data, defval, volume);
+unsigned int VoxelBuffer::get_memory_usage() const {
+	return compute_memory_usage(false);
 }
 
-void VoxelBuffer::fill_area(int defval, Vector3i min, Vector3i max, unsigned int channel_index) {
-	ERR_FAIL_INDEX(channel_index, MAX_CHANNELS);
+unsigned int VoxelBuffer::get_owned_memory_usage() const {
+	return compute_memory_usage(true);
+}
 
-	Vector3i::sort_min_max(min, max);
+bool VoxelBuffer::is_channel_shared(unsigned int channel_index) const {
+	ERR_FAIL_INDEX_V(channel_index, MAX_CHANNELS, false);
+	const Channel &channel = _channels[channel_index];
+	return channel.data != NULL && is_channel_data_shared(channel.data);
+}
 
-	min.clamp_to(Vector3i(0, 0, 0), _size + Vector3i(1, 1, 1));
-	max.clamp_to(Vector3i(0, 0, 0), _size + Vector3i(1, 1, 1));
-	Vector3i area_size = max - min;
+uint32_t VoxelBuffer::get_content_hash() const {
+	uint32_t hash = hash_djb2_one_32(_size.x);
+	hash = hash_djb2_one_32(_size.y, hash);
+	hash = hash_djb2_one_32(_size.z, hash);
 
-	if (area_size.x == 0 || area_size.y == 0 || area_size.z == 0) {
-		return;
-	}
+	Vector<uint8_t> row;
 
-	Channel &channel = _channels[channel_index];
-	if (channel.data == NULL) {
-		if (channel.defval == defval) {
-			return;
-		} else {
-			create_channel(channel_index, _size, channel.defval);
+	for (unsigned int i = 0; i < MAX_CHANNELS; ++i) {
+		const Channel &channel = _channels[i];
+		hash = hash_djb2_one_32(channel.format, hash);
+
+		if (channel.data == NULL) {
+			hash = hash_djb2_one_32(channel.defval, hash);
+			continue;
 		}
-	}
 
-	Vector3i pos;
-	unsigned int volume = get_volume();
-	for (pos.z = min.z; pos.z < max.z; ++pos.z) {
-		for (pos.x = min.x; pos.x < max.x; ++pos.x) {
-			unsigned int dst_ri = index(pos.x, pos.y + min.y, pos.z);
-			CRASH_COND(dst_ri >= volume);
-			memset(&channel.data[dst_ri], defval, area_size.y * sizeof(uint8_t));
+		const unsigned int format_size = get_format_size(channel.format);
+
+		if (channel.compression == COMPRESSION_NONE) {
+			hash = hash_djb2_buffer(channel.data, get_volume() * format_size, hash);
+			continue;
+		}
+
+		// Compressed channels are hashed decoded, in the same order as flat arrays, so they match however they are stored
+		row.resize(_size.y * format_size);
+		for (int z = 0; z < _size.z; ++z) {
+			for (int x = 0; x < _size.x; ++x) {
+				read_row_raw(i, x, 0, z, _size.y, row.ptrw());
+				hash = hash_djb2_buffer(row.ptr(), row.size(), hash);
+			}
 		}
 	}
-}
 
-bool VoxelBuffer::is_uniform(unsigned int channel_index) const {
-	ERR_FAIL_INDEX_V(channel_index, MAX_CHANNELS, true);
+	return hash;
+}
 
-	const Channel &channel = _channels[channel_index];
-	if (channel.data == NULL) {
-		// Channel has been optimized
-		return true;
+bool VoxelBuffer::has_same_content(const VoxelBuffer &other) const {
+	if (other._size != _size) {
+		return false;
 	}
 
-	// Channel isn't optimized, so must look at each voxel
-	uint8_t voxel = channel.data[0];
-	unsigned int volume = get_volume();
-	for (unsigned int i = 1; i < volume; ++i) {
-		if (channel.data[i] != voxel) {
+	Vector<uint8_t> row;
+	Vector<uint8_t> other_row;
+
+	for (unsigned int i = 0; i < MAX_CHANNELS; ++i) {
+		const Channel &channel = _channels[i];
+		const Channel &other_channel = other._channels[i];
+
+		if (channel.format != other_channel.format) {
 			return false;
 		}
+
+		if (channel.data == other_channel.data) {
+			if (channel.data == NULL && channel.defval != other_channel.defval) {
+				return false;
+			}
+			continue;
+		}
+
+		const unsigned int format_size = get_format_size(channel.format);
+
+		if (channel.compression == COMPRESSION_NONE && other_channel.compression == COMPRESSION_NONE) {
+			if (memcmp(channel.data, other_channel.data, get_volume() * format_size) != 0) {
+				return false;
+			}
+			continue;
+		}
+
+		// Representations differ, compare decoded rows
+		row.resize(_size.y * format_size);
+		other_row.resize(row.size());
+		for (int z = 0; z < _size.z; ++z) {
+			for (int x = 0; x < _size.x; ++x) {
+				read_row_raw(i, x, 0, z, _size.y, row.ptrw());
+				other.read_row_raw(i, x, 0, z, _size.y, other_row.ptrw());
+				if (memcmp(row.ptr(), other_row.ptr(), row.size()) != 0) {
+					return false;
+				}
+			}
+		}
 	}
 
 	return true;
 }
 
-void VoxelBuffer::compress_uniform_channels() {
-	for (unsigned int i = 0; i < MAX_CHANNELS; ++i) {
-		if (_channels[i].data && is_uniform(i)) {
-			clear_channel(i, _channels[i].data[0]);
-		}
+VoxelBuffer::Compression VoxelBuffer::get_channel_compression(unsigned int channel_index) const {
+	ERR_FAIL_INDEX_V(channel_index, MAX_CHANNELS, COMPRESSION_NONE);
+	return _channels[channel_index].compression;
+}
+
+void VoxelBuffer::set_channel_format(unsigned int channel_index, ChannelFormat format) {
+	ERR_FAIL_INDEX(channel_index, MAX_CHANNELS);
+	ERR_FAIL_INDEX(format, FORMAT_COUNT);
+	// Floats only make sense for distance fields
+	ERR_FAIL_COND(is_format_float(format) && channel_index != CHANNEL_ISOLEVEL);
+
+	Channel &channel = _channels[channel_index];
+	const ChannelFormat old_format = channel.format;
+	if (old_format == format) {
+		return;
+	}
+
+	const bool as_float = channel_index == CHANNEL_ISOLEVEL;
+	channel.defval = convert_raw(channel.defval, old_format, format, as_float);
+
+	if (channel.data == NULL) {
+		channel.format = format;
+		return;
+	}
+
+	decompress_channel(channel_index);
+
+	uint8_t *old_data = channel.data;
+	const unsigned int old_format_size = get_format_size(old_format);
+
+	channel.data = NULL;
+	channel.format = format;
+	create_channel_noinit(channel_index, _size);
+
+	const unsigned int format_size = get_format_size(format);
+	const unsigned int volume = get_volume();
+	for (unsigned int i = 0; i < volume; ++i) {
+		uint32_t raw = read_raw(old_data, old_format_size, i);
+		write_raw(channel.data, format_size, i, convert_raw(raw, old_format, format, as_float));
+	}
+
+	unref_channel_data(old_data);
+
+	if (_bricked) {
+		compress_channel_bricks(channel_index);
 	}
 }
 
+VoxelBuffer::ChannelFormat VoxelBuffer::get_channel_format(unsigned int channel_index) const {
+	ERR_FAIL_INDEX_V(channel_index, MAX_CHANNELS, FORMAT_U8);
+	return _channels[channel_index].format;
+}
+
 void VoxelBuffer::copy_from(const VoxelBuffer &other, unsigned int channel_index) {
 	ERR_FAIL_INDEX(channel_index, MAX_CHANNELS);
-	ERR_FAIL_COND(other._size == _size);
+	ERR_FAIL_COND(other._size != _size);
+	ERR_FAIL_COND(&other == this);
 
 	Channel &channel = _channels[channel_index];
 	const Channel &other_channel = other._channels[channel_index];
 
-	if (other_channel.data) {
-		if (channel.data == NULL) {
-			create_channel_noinit(channel_index, _size);
-		}
-		memcpy(channel.data, other_channel.data, get_volume() * sizeof(uint8_t));
-	} else if (channel.data) {
+	if (channel.data) {
 		delete_channel(channel_index);
 	}
 
+	channel.format = other_channel.format;
+
+	if (other_channel.data) {
+		// Share the data, it will be copied only if one of the buffers modifies it
+		ref_channel_data(other_channel.data);
+		channel.data = other_channel.data;
+		channel.compression = other_channel.compression;
+	}
+
 	channel.defval = other_channel.defval;
+	mark_modified(Rect3i(Vector3i(), _size));
 }
 
 void VoxelBuffer::copy_from(const VoxelBuffer &other, Vector3i src_min, Vector3i src_max, Vector3i dst_min, unsigned int channel_index) {
@@ -220,67 +1579,201 @@ void VoxelBuffer::copy_from(const VoxelBuffer &other, Vector3i src_min, Vector3i
 	Vector3i::sort_min_max(src_min, src_max);
 
 	src_min.clamp_to(Vector3i(0, 0, 0), other._size);
-	src_max.clamp_to(Vector3i(0, 0, 0), other._size + Vector3i(1, 1, 1));
+	clamp_to_size(src_max, other._size);
 
 	dst_min.clamp_to(Vector3i(0, 0, 0), _size);
 	Vector3i area_size = src_max - src_min;
-	//Vector3i dst_max = dst_min + area_size;
 
-	if (area_size == _size) {
+	// Parts of the source area overhanging the destination are not copied
+	area_size.x = MIN(area_size.x, _size.x - dst_min.x);
+	area_size.y = MIN(area_size.y, _size.y - dst_min.y);
+	area_size.z = MIN(area_size.z, _size.z - dst_min.z);
+
+	const ChannelFormat src_format = other_channel.format;
+	const bool convert = src_format != channel.format;
+	const bool as_float = channel_index == CHANNEL_ISOLEVEL;
+
+	if (area_size == _size && area_size == other._size && !convert) {
 		copy_from(other, channel_index);
-	} else {
-		if (other_channel.data) {
-			if (channel.data == NULL) {
-				create_channel(channel_index, _size, channel.defval);
+	} else if (area_size.x > 0 && area_size.y > 0 && area_size.z > 0) {
+		const unsigned int format_size = get_format_size(channel.format);
+
+		if (other_channel.data == NULL) {
+			fill_area_raw(convert_raw(other_channel.defval, src_format, channel.format, as_float),
+					dst_min, dst_min + area_size, channel_index);
+
+		} else {
+			make_channel_writable(channel_index);
+
+			// Rows are read in the source format first if they need conversion
+			Vector<uint8_t> row;
+			if (convert) {
+				row.resize(area_size.y * get_format_size(src_format));
 			}
-			// Copy row by row
-			Vector3i pos;
-			for (pos.z = 0; pos.z < area_size.z; ++pos.z) {
-				for (pos.x = 0; pos.x < area_size.x; ++pos.x) {
-					// Row direction is Y
-					unsigned int src_ri = other.index(pos.x + src_min.x, pos.y + src_min.y, pos.z + src_min.z);
-					unsigned int dst_ri = index(pos.x + dst_min.x, pos.y + dst_min.y, pos.z + dst_min.z);
-					memcpy(&channel.data[dst_ri], &other_channel.data[src_ri], area_size.y * sizeof(uint8_t));
+
+			if (channel.compression == COMPRESSION_BRICKS) {
+				// Copy into each brick overlapping the destination area
+				const Vector3i grid_size = get_brick_grid_size(_size);
+				const Rect3i dst_area(dst_min, area_size);
+				Vector3i min_brick;
+				Vector3i max_brick;
+				get_brick_range(grid_size, dst_min, dst_min + area_size, min_brick, max_brick);
+				const Vector3i src_offset = src_min - dst_min;
+				Brick *bricks = get_bricks(channel.data);
+
+				Vector3i bpos;
+				for (bpos.z = min_brick.z; bpos.z <= max_brick.z; ++bpos.z) {
+					for (bpos.x = min_brick.x; bpos.x <= max_brick.x; ++bpos.x) {
+						for (bpos.y = min_brick.y; bpos.y <= max_brick.y; ++bpos.y) {
+
+							const Rect3i box = Rect3i(bpos << BRICK_SIZE_PO2, get_brick_extent(_size, bpos)).clipped(dst_area);
+							Brick &brick = bricks[bpos.y + grid_size.y * (bpos.x + grid_size.x * bpos.z)];
+							make_brick_writable(brick, format_size);
+
+							Vector3i pos;
+							for (pos.z = box.pos.z; pos.z < box.pos.z + box.size.z; ++pos.z) {
+								for (pos.x = box.pos.x; pos.x < box.pos.x + box.size.x; ++pos.x) {
+									uint8_t *dst = &brick.data[get_index_in_brick(pos.x, box.pos.y, pos.z) * format_size];
+									const Vector3i src_pos(pos.x + src_offset.x, box.pos.y + src_offset.y, pos.z + src_offset.z);
+									if (convert) {
+										other.read_row_raw(channel_index, src_pos.x, src_pos.y, src_pos.z, box.size.y, row.ptrw());
+										convert_voxels_raw(row.ptr(), src_format, dst, channel.format, box.size.y, as_float);
+									} else {
+										other.read_row_raw(channel_index, src_pos.x, src_pos.y, src_pos.z, box.size.y, dst);
+									}
+								}
+							}
+						}
+					}
 				}
-			}
-		} else if (channel.defval != other_channel.defval) {
-			if (channel.data == NULL) {
-				create_channel(channel_index, _size, channel.defval);
-			}
-			// Set row by row
-			Vector3i pos;
-			for (pos.z = 0; pos.z < area_size.z; ++pos.z) {
-				for (pos.x = 0; pos.x < area_size.x; ++pos.x) {
-					unsigned int dst_ri = index(pos.x + dst_min.x, pos.y + dst_min.y, pos.z + dst_min.z);
-					memset(&channel.data[dst_ri], other_channel.defval, area_size.y * sizeof(uint8_t));
+
+			} else {
+				// Copy row by row
+				Vector3i pos;
+				for (pos.z = 0; pos.z < area_size.z; ++pos.z) {
+					for (pos.x = 0; pos.x < area_size.x; ++pos.x) {
+						// Row direction is Y
+						unsigned int dst_ri = index(pos.x + dst_min.x, dst_min.y, pos.z + dst_min.z);
+						uint8_t *dst = &channel.data[dst_ri * format_size];
+						if (convert) {
+							other.read_row_raw(channel_index, pos.x + src_min.x, src_min.y, pos.z + src_min.z, area_size.y, row.ptrw());
+							convert_voxels_raw(row.ptr(), src_format, dst, channel.format, area_size.y, as_float);
+						} else {
+							other.read_row_raw(channel_index, pos.x + src_min.x, src_min.y, pos.z + src_min.z, area_size.y, dst);
+						}
+					}
 				}
 			}
 		}
+
+		mark_modified(Rect3i(dst_min, area_size));
+	}
+}
+
+Rect3i VoxelBuffer::consume_modified_box() {
+	Rect3i box = _modified_box;
+	_modified_box = Rect3i();
+	return box;
+}
+
+void VoxelBuffer::ensure_unique(int i) {
+	Channel &channel = _channels[i];
+	if (channel.data && is_channel_data_shared(channel.data)) {
+		if (channel.compression == COMPRESSION_BRICKS) {
+			// Bricks themselves are copied only when written to
+			uint8_t *data = duplicate_brick_table(channel.data);
+			unref_brick_table(channel.data);
+			channel.data = data;
+		} else {
+			uint8_t *data = duplicate_channel_data(channel.data);
+			unref_channel_data(channel.data);
+			channel.data = data;
+		}
+	}
+}
+
+void VoxelBuffer::make_channel_writable(int i) {
+	Channel &channel = _channels[i];
+	if (channel.data == NULL) {
+		if (_bricked) {
+			const Vector3i grid_size = get_brick_grid_size(_size);
+			channel.data = alloc_brick_table(grid_size.x * grid_size.y * grid_size.z, channel.defval);
+			channel.compression = COMPRESSION_BRICKS;
+		} else {
+			// Allocate channel with same initial values as defval
+			create_channel(i, _size, channel.defval);
+		}
+	} else if (channel.compression == COMPRESSION_PALETTE_RLE) {
+		// Runs can't be edited in place
+		if (_bricked) {
+			compress_channel_bricks(i);
+		} else {
+			decompress_channel(i);
+		}
+	} else {
+		ensure_unique(i);
+	}
+}
+
+void VoxelBuffer::set_bricked(bool bricked) {
+	_bricked = bricked;
+	for (unsigned int i = 0; i < MAX_CHANNELS; ++i) {
+		const Channel &channel = _channels[i];
+		if (channel.data == NULL) {
+			continue;
+		}
+		if (bricked && channel.compression != COMPRESSION_BRICKS) {
+			compress_channel_bricks(i);
+		} else if (!bricked && channel.compression == COMPRESSION_BRICKS) {
+			decompress_channel(i);
+		}
+	}
+}
+
+Ref<VoxelBuffer> VoxelBuffer::duplicate() const {
+	Ref<VoxelBuffer> d;
+	d.instance();
+	d->create(_size.x, _size.y, _size.z);
+	d->_bricked = _bricked;
+	for (unsigned int i = 0; i < MAX_CHANNELS; ++i) {
+		d->copy_from(*this, i);
 	}
+	d->_modified_box = _modified_box;
+	return d;
 }
 
 uint8_t *VoxelBuffer::get_channel_raw(unsigned int channel_index) const {
 	ERR_FAIL_INDEX_V(channel_index, MAX_CHANNELS, NULL);
 	const Channel &channel = _channels[channel_index];
+	if (channel.compression != COMPRESSION_NONE) {
+		return NULL;
+	}
 	return channel.data;
 }
 
-void VoxelBuffer::create_channel(int i, Vector3i size, uint8_t defval) {
+void VoxelBuffer::create_channel(int i, Vector3i size, uint32_t defval) {
 	create_channel_noinit(i, size);
-	memset(_channels[i].data, defval, get_volume() * sizeof(uint8_t));
+	fill_voxels_raw(_channels[i].data, get_format_size(_channels[i].format), get_volume(), defval);
 }
 
 void VoxelBuffer::create_channel_noinit(int i, Vector3i size) {
 	Channel &channel = _channels[i];
 	unsigned int volume = size.x * size.y * size.z;
-	channel.data = (uint8_t *)memalloc(volume * sizeof(uint8_t));
+	channel.data = alloc_channel_data(volume * get_format_size(channel.format), true);
+	channel.compression = COMPRESSION_NONE;
 }
 
 void VoxelBuffer::delete_channel(int i) {
 	Channel &channel = _channels[i];
 	ERR_FAIL_COND(channel.data == NULL);
-	memfree(channel.data);
+	// Channel data may be shared with other buffers
+	if (channel.compression == COMPRESSION_BRICKS) {
+		unref_brick_table(channel.data);
+	} else {
+		unref_channel_data(channel.data);
+	}
 	channel.data = NULL;
+	channel.compression = COMPRESSION_UNIFORM;
 }
 
 void VoxelBuffer::_bind_methods() {
@@ -303,10 +1796,32 @@ void VoxelBuffer::_bind_methods() {
 	ClassDB::bind_method(D_METHOD("fill_f", "value", "channel"), &VoxelBuffer::fill_f, DEFVAL(0));
 	ClassDB::bind_method(D_METHOD("fill_area", "value", "min", "max", "channel"), &VoxelBuffer::_fill_area_binding, DEFVAL(0));
 	ClassDB::bind_method(D_METHOD("copy_from", "other", "channel"), &VoxelBuffer::_copy_from_binding, DEFVAL(0));
+	ClassDB::bind_method(D_METHOD("duplicate"), &VoxelBuffer::duplicate);
 	ClassDB::bind_method(D_METHOD("copy_from_area", "other", "src_min", "src_max", "dst_min", "channel"), &VoxelBuffer::_copy_from_area_binding, DEFVAL(0));
 
 	ClassDB::bind_method(D_METHOD("is_uniform", "channel"), &VoxelBuffer::is_uniform);
 	ClassDB::bind_method(D_METHOD("optimize"), &VoxelBuffer::compress_uniform_channels);
+	ClassDB::bind_method(D_METHOD("compress"), &VoxelBuffer::compress);
+	ClassDB::bind_method(D_METHOD("decompress"), &VoxelBuffer::decompress);
+	ClassDB::bind_method(D_METHOD("get_channel_compression", "channel"), &VoxelBuffer::get_channel_compression);
+	ClassDB::bind_method(D_METHOD("get_memory_usage"), &VoxelBuffer::get_memory_usage);
+	ClassDB::bind_method(D_METHOD("set_bricked", "bricked"), &VoxelBuffer::set_bricked);
+	ClassDB::bind_method(D_METHOD("is_bricked"), &VoxelBuffer::is_bricked);
+
+	ClassDB::bind_method(D_METHOD("get_channel_as_bytes", "channel"), &VoxelBuffer::get_channel_as_bytes);
+	ClassDB::bind_method(D_METHOD("set_channel_from_bytes", "channel", "bytes"), &VoxelBuffer::set_channel_from_bytes);
+	ClassDB::bind_method(D_METHOD("get_channel_as_floats", "channel"), &VoxelBuffer::get_channel_as_floats);
+	ClassDB::bind_method(D_METHOD("set_channel_from_floats", "channel", "values"), &VoxelBuffer::set_channel_from_floats);
+	ClassDB::bind_method(D_METHOD("get_region_as_bytes", "channel", "min", "max"), &VoxelBuffer::_get_region_as_bytes_binding);
+	ClassDB::bind_method(D_METHOD("set_region_from_bytes", "channel", "min", "max", "bytes"), &VoxelBuffer::_set_region_from_bytes_binding);
+	ClassDB::bind_method(D_METHOD("get_region_as_floats", "channel", "min", "max"), &VoxelBuffer::_get_region_as_floats_binding);
+	ClassDB::bind_method(D_METHOD("set_region_from_floats", "channel", "min", "max", "values"), &VoxelBuffer::_set_region_from_floats_binding);
+
+	ClassDB::bind_method(D_METHOD("get_modified_box"), &VoxelBuffer::_get_modified_box_binding);
+	ClassDB::bind_method(D_METHOD("clear_modified_box"), &VoxelBuffer::clear_modified_box);
+
+	ClassDB::bind_method(D_METHOD("set_channel_format", "channel", "format"), &VoxelBuffer::set_channel_format);
+	ClassDB::bind_method(D_METHOD("get_channel_format", "channel"), &VoxelBuffer::get_channel_format);
 
 	BIND_ENUM_CONSTANT(CHANNEL_TYPE);
 	BIND_ENUM_CONSTANT(CHANNEL_ISOLEVEL);
@@ -317,6 +1832,19 @@ void VoxelBuffer::_bind_methods() {
 	BIND_ENUM_CONSTANT(CHANNEL_DATA6);
 	BIND_ENUM_CONSTANT(CHANNEL_DATA7);
 	BIND_ENUM_CONSTANT(MAX_CHANNELS);
+
+	BIND_ENUM_CONSTANT(COMPRESSION_NONE);
+	BIND_ENUM_CONSTANT(COMPRESSION_UNIFORM);
+	BIND_ENUM_CONSTANT(COMPRESSION_PALETTE_RLE);
+	BIND_ENUM_CONSTANT(COMPRESSION_BRICKS);
+	BIND_ENUM_CONSTANT(COMPRESSION_COUNT);
+
+	BIND_ENUM_CONSTANT(FORMAT_U8);
+	BIND_ENUM_CONSTANT(FORMAT_U16);
+	BIND_ENUM_CONSTANT(FORMAT_U32);
+	BIND_ENUM_CONSTANT(FORMAT_F16);
+	BIND_ENUM_CONSTANT(FORMAT_F32);
+	BIND_ENUM_CONSTANT(FORMAT_COUNT);
 }
 
 void VoxelBuffer::_copy_from_binding(Ref<VoxelBuffer> other, unsigned int channel) {
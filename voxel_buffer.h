@@ -1,13 +1,15 @@
 #ifndef VOXEL_BUFFER_H
 #define VOXEL_BUFFER_H
 
+#include "math/rect3i.h"
 #include "math/vector3i.h"
+#include <core/pool_vector.h>
 #include <core/reference.h>
 #include <core/vector.h>
 
 // Dense voxels data storage.
-// Organized in 8-bit channels like images, all optional.
-// Note: for float storage (marching cubes for example), you can map [0..256] to [0..1] and save 3 bytes per cell
+// Organized in channels like images, all optional.
+// Channels are 8-bit by default, but can use wider integers, or floats for isolevels when more precision is needed.
 
 class VoxelBuffer : public Reference {
 	GDCLASS(VoxelBuffer, Reference)
@@ -29,12 +31,49 @@ public:
 	// TODO use C++17 inline to initialize right here...
 	static const char *CHANNEL_ID_HINT_STRING;
 
-	// TODO Quantification options
-	//	enum ChannelFormat {
-	//		FORMAT_I8_Q256U, // 0..255 integer
-	//		FORMAT_F8_Q1S, // -1..1 float stored in 8 bits
-	//		FORMAT_F16_Q128S // -128..128 float stored in 16 bits
-	//	};
+	// How a channel stores its voxels
+	enum Compression {
+		// Flat array of voxels
+		COMPRESSION_NONE = 0,
+		// All voxels have the same value, nothing is allocated
+		COMPRESSION_UNIFORM,
+		// Each [z][x] row is stored as runs along Y, each run referencing a value in a palette.
+		// Voxels can be read directly, but writing one causes the channel to be decompressed.
+		COMPRESSION_PALETTE_RLE,
+		// Voxels are split in bricks of 8x8x8, each either uniform or a flat array.
+		// Voxels can be written in place, and uniform areas don't take memory.
+		COMPRESSION_BRICKS,
+		COMPRESSION_COUNT
+	};
+
+	// How many bits are used to store each voxel of a channel.
+	// Integer formats used on CHANNEL_ISOLEVEL map their range to -1..1 when accessed as floats.
+	enum ChannelFormat {
+		FORMAT_U8 = 0,
+		FORMAT_U16,
+		FORMAT_U32,
+		// Float formats can only be used on CHANNEL_ISOLEVEL
+		FORMAT_F16,
+		FORMAT_F32,
+		FORMAT_COUNT
+	};
+
+	static inline unsigned int get_format_size(ChannelFormat format) {
+		switch (format) {
+			case FORMAT_U16:
+			case FORMAT_F16:
+				return 2;
+			case FORMAT_U32:
+			case FORMAT_F32:
+				return 4;
+			default:
+				return 1;
+		}
+	}
+
+	static inline bool is_format_float(ChannelFormat format) {
+		return format == FORMAT_F16 || format == FORMAT_F32;
+	}
 
 	// Converts -1..1 float into 0..255 integer
 	static inline int iso_to_byte(real_t iso) {
@@ -57,33 +96,105 @@ public:
 	void create(int sx, int sy, int sz);
 	void clear();
 	void clear_channel(unsigned int channel_index, int clear_value = 0);
-	_FORCE_INLINE_ void clear_channel_f(unsigned int channel_index, float clear_value = 0) { clear_channel(channel_index, iso_to_byte(clear_value)); }
+	void clear_channel_f(unsigned int channel_index, real_t clear_value = 0);
 
 	_FORCE_INLINE_ const Vector3i &get_size() const { return _size; }
 
 	void set_default_values(uint8_t values[MAX_CHANNELS]);
 
+	// Integer channels get and set their raw value.
+	// Float channels are quantized to the same 0..255 range as 8-bit isolevels, use the `_f` variants for full precision.
 	int get_voxel(int x, int y, int z, unsigned int channel_index = 0) const;
 	void set_voxel(int value, int x, int y, int z, unsigned int channel_index = 0);
 	void set_voxel_v(int value, Vector3 pos, unsigned int channel_index = 0);
 
 	void try_set_voxel(int x, int y, int z, int value, unsigned int channel_index = 0);
 
-	_FORCE_INLINE_ void set_voxel_f(real_t value, int x, int y, int z, unsigned int channel_index = 0) { set_voxel(iso_to_byte(value), x, y, z, channel_index); }
-	_FORCE_INLINE_ real_t get_voxel_f(int x, int y, int z, unsigned int channel_index = 0) const { return byte_to_iso(get_voxel(x, y, z, channel_index)); }
+	void set_voxel_f(real_t value, int x, int y, int z, unsigned int channel_index = 0);
+	real_t get_voxel_f(int x, int y, int z, unsigned int channel_index = 0) const;
 
 	_FORCE_INLINE_ int get_voxel(const Vector3i pos, unsigned int channel_index = 0) const { return get_voxel(pos.x, pos.y, pos.z, channel_index); }
 	_FORCE_INLINE_ void set_voxel(int value, const Vector3i pos, unsigned int channel_index = 0) { set_voxel(value, pos.x, pos.y, pos.z, channel_index); }
 
 	void fill(int defval, unsigned int channel_index = 0);
-	_FORCE_INLINE_ void fill_f(float value, unsigned int channel = 0) { fill(iso_to_byte(value), channel); }
+	void fill_f(real_t value, unsigned int channel_index = 0);
 	void fill_area(int defval, Vector3i min, Vector3i max, unsigned int channel_index = 0);
 
+	// Sets all voxels of the channel from `get_volume()` floats, in the same order as voxels are stored.
+	// Much faster than calling `set_voxel_f` for each voxel.
+	void set_channel_f(unsigned int channel_index, const float *values);
+	// Gets all voxels of the channel as floats
+	void get_channel_f(unsigned int channel_index, float *out_values) const;
+	// Gets voxels of an area of the channel as floats, in the same order as voxels are stored.
+	// The area must be inside the buffer.
+	void get_region_f(unsigned int channel_index, Rect3i box, float *out_values) const;
+
+	// Bulk access to voxels, in the same order as they are stored ([z][x][y], Y varying fastest).
+	// Bytes are raw values, taking as many bytes per voxel as the format of the channel.
+	// Floats are converted the same way `get_voxel_f` and `set_voxel_f` do.
+	PoolByteArray get_channel_as_bytes(unsigned int channel_index) const;
+	void set_channel_from_bytes(unsigned int channel_index, PoolByteArray bytes);
+	PoolRealArray get_channel_as_floats(unsigned int channel_index) const;
+	void set_channel_from_floats(unsigned int channel_index, PoolRealArray values);
+
+	// Native versions of the byte accessors, reading or writing exactly `get_volume()` voxels of the channel format.
+	// Meant for serialization, where values must be kept as they are.
+	void get_channel_raw_bytes(unsigned int channel_index, uint8_t *dst) const;
+	void set_channel_raw_bytes(unsigned int channel_index, const uint8_t *src);
+
+	// Raw value of a uniform channel, in the format of the channel
+	uint32_t get_channel_uniform_raw_value(unsigned int channel_index) const;
+	void set_channel_uniform_raw_value(unsigned int channel_index, uint32_t raw_value);
+
+	// Same as above, within the box from `min` (included) to `max` (excluded)
+	PoolByteArray get_region_as_bytes(unsigned int channel_index, Vector3i min, Vector3i max) const;
+	void set_region_from_bytes(unsigned int channel_index, Vector3i min, Vector3i max, PoolByteArray bytes);
+	PoolRealArray get_region_as_floats(unsigned int channel_index, Vector3i min, Vector3i max) const;
+	void set_region_from_floats(unsigned int channel_index, Vector3i min, Vector3i max, PoolRealArray values);
+
 	bool is_uniform(unsigned int channel_index) const;
 
+	void compress_uniform_channel(unsigned int channel_index);
 	void compress_uniform_channels();
 
+	// Compresses channels using the smallest representation they fit in.
+	// Meant for buffers that will be stored for a long time and mostly read, like terrain blocks.
+	void compress_channel(unsigned int channel_index);
+	void compress();
+
+	// When enabled, channels are stored as bricks instead of flat arrays when they need to be allocated,
+	// and compression keeps them as bricks. Suits big buffers where most of the volume is uniform.
+	void set_bricked(bool bricked);
+	_FORCE_INLINE_ bool is_bricked() const { return _bricked; }
+
+	// Converts compressed channels back into flat arrays, so their raw pointers can be accessed.
+	// Uniform channels are left as they are.
+	void decompress_channel(unsigned int channel_index);
+	void decompress();
+
+	Compression get_channel_compression(unsigned int channel_index) const;
+
+	// Bytes allocated for voxels of all channels. Data shared with other buffers is counted too.
+	unsigned int get_memory_usage() const;
+	// Bytes allocated for voxels no other buffer references, which would be freed along with this buffer
+	unsigned int get_owned_memory_usage() const;
+
+	// Tells if the voxels of the channel are also referenced by another buffer
+	bool is_channel_shared(unsigned int channel_index) const;
+
+	// Hash of size, formats and voxels, for finding identical buffers.
+	// Compressed channels are hashed from their decoded voxels, so buffers match whatever their compression is,
+	// except uniform channels which only match other uniform channels.
+	uint32_t get_content_hash() const;
+	bool has_same_content(const VoxelBuffer &other) const;
+
+	// Changes how many bits are used per voxel. Existing voxels are converted.
+	void set_channel_format(unsigned int channel_index, ChannelFormat format);
+	ChannelFormat get_channel_format(unsigned int channel_index) const;
+
+	// Copying a whole channel is cheap, because data is shared until one of the buffers modifies it
 	void copy_from(const VoxelBuffer &other, unsigned int channel_index = 0);
+	// Copying an area keeps the format of the destination channel, voxels are converted if needed
 	void copy_from(const VoxelBuffer &other, Vector3i src_min, Vector3i src_max, Vector3i dst_min, unsigned int channel_index = 0);
 
 	_FORCE_INLINE_ bool validate_pos(unsigned int x, unsigned int y, unsigned int z) const {
@@ -102,12 +213,57 @@ public:
 		return _size.x * _size.y * _size.z;
 	}
 
+	// Returns a buffer holding the same voxels. Channels are shared until either buffer modifies them,
+	// so this is cheap, and the copy can be read from another thread while the original keeps being edited.
+	Ref<VoxelBuffer> duplicate() const;
+
+	// Box enclosing voxels modified since the last time it was consumed or cleared, empty if there is none.
+	// Voxels inside it are not guaranteed to have changed, but voxels outside of it are.
+	_FORCE_INLINE_ const Rect3i &get_modified_box() const { return _modified_box; }
+	Rect3i consume_modified_box();
+	_FORCE_INLINE_ void clear_modified_box() { _modified_box = Rect3i(); }
+
+	// Returns the flat array of voxels of the channel, as bytes whatever the format is.
+	// Returns null if the channel is uniform or compressed, call `decompress()` first if you need it.
+	// The array may be shared with other buffers, so it must not be written to.
 	uint8_t *get_channel_raw(unsigned int channel_index) const;
 
+	// Same as `get_channel_raw`, typed after the format of the channel so voxels can be read without conversion.
+	// T must be `uint8_t`, `uint16_t` (also for half floats), `uint32_t` or `float`.
+	template <typename T>
+	T *get_channel_raw_typed(unsigned int channel_index) const {
+		ERR_FAIL_INDEX_V(channel_index, MAX_CHANNELS, NULL);
+		ERR_FAIL_COND_V(!is_format_of((const T *)NULL, _channels[channel_index].format), NULL);
+		return reinterpret_cast<T *>(get_channel_raw(channel_index));
+	}
+
 private:
 	void create_channel_noinit(int i, Vector3i size);
-	void create_channel(int i, Vector3i size, uint8_t defval);
+	void create_channel(int i, Vector3i size, uint32_t defval);
 	void delete_channel(int i);
+	// Allocates the channel if needed and makes its data ready to be written in place
+	void make_channel_writable(int i);
+	// Gives the channel its own copy of the data if it's shared, must be called before writing into it
+	void ensure_unique(int i);
+	// Only changes how the channel is stored, doesn't count as a modification
+	void clear_channel_raw(int i, uint32_t raw_value);
+	void fill_raw(uint32_t raw_value, unsigned int channel_index);
+	void fill_area_raw(uint32_t raw_value, Vector3i min, Vector3i max, unsigned int channel_index);
+	// Reads `count` voxels along Y into a flat array, whatever the representation of the channel is
+	void read_row_raw(unsigned int channel_index, int x, int y, int z, unsigned int count, uint8_t *dst) const;
+	bool validate_region(Vector3i &min, Vector3i &max) const;
+	void set_voxel_raw(uint32_t raw_value, int x, int y, int z, unsigned int channel_index);
+	uint32_t get_voxel_raw(int x, int y, int z, unsigned int channel_index) const;
+	bool compress_channel_rle(int i);
+	void compress_channel_bricks(int i);
+	void optimize_bricks(int i);
+	unsigned int compute_memory_usage(bool owned_only) const;
+	_FORCE_INLINE_ void mark_modified(const Rect3i &box) { _modified_box.merge_with(box); }
+
+	_FORCE_INLINE_ static bool is_format_of(const uint8_t *, ChannelFormat format) { return format == FORMAT_U8; }
+	_FORCE_INLINE_ static bool is_format_of(const uint16_t *, ChannelFormat format) { return format == FORMAT_U16 || format == FORMAT_F16; }
+	_FORCE_INLINE_ static bool is_format_of(const uint32_t *, ChannelFormat format) { return format == FORMAT_U32; }
+	_FORCE_INLINE_ static bool is_format_of(const float *, ChannelFormat format) { return format == FORMAT_F32; }
 
 protected:
 	static void _bind_methods();
@@ -122,20 +278,35 @@ protected:
 	void _copy_from_binding(Ref<VoxelBuffer> other, unsigned int channel);
 	void _copy_from_area_binding(Ref<VoxelBuffer> other, Vector3 src_min, Vector3 src_max, Vector3 dst_min, unsigned int channel);
 	_FORCE_INLINE_ void _fill_area_binding(int defval, Vector3 min, Vector3 max, unsigned int channel_index) { fill_area(defval, Vector3i(min), Vector3i(max), channel_index); }
+	PoolByteArray _get_region_as_bytes_binding(unsigned int channel, Vector3 min, Vector3 max) const { return get_region_as_bytes(channel, Vector3i(min), Vector3i(max)); }
+	void _set_region_from_bytes_binding(unsigned int channel, Vector3 min, Vector3 max, PoolByteArray bytes) { set_region_from_bytes(channel, Vector3i(min), Vector3i(max), bytes); }
+	PoolRealArray _get_region_as_floats_binding(unsigned int channel, Vector3 min, Vector3 max) const { return get_region_as_floats(channel, Vector3i(min), Vector3i(max)); }
+	void _set_region_from_floats_binding(unsigned int channel, Vector3 min, Vector3 max, PoolRealArray values) { set_region_from_floats(channel, Vector3i(min), Vector3i(max), values); }
+	_FORCE_INLINE_ AABB _get_modified_box_binding() const { return AABB(_modified_box.pos.to_vec3(), _modified_box.size.to_vec3()); }
 	_FORCE_INLINE_ void _set_voxel_f_binding(real_t value, int x, int y, int z, unsigned int channel) { set_voxel_f(value, x, y, z, channel); }
 
 private:
 	struct Channel {
 		// Allocated when the channel is populated.
 		// Flat array, in order [z][x][y] because it allows faster vertical-wise access (the engine is Y-up).
+		// Each voxel takes as many bytes as its format requires.
+		// It can be shared with other buffers, in which case it is copied before being modified.
 		uint8_t *data;
 
-		// Default value when data is null
-		uint8_t defval;
+		// Default value when data is null, in the same raw representation as voxels stored in `data`
+		uint32_t defval;
+
+		ChannelFormat format;
+
+		// Tells how `data` must be interpreted.
+		// When palette RLE is used, `data` points to an encoded block instead of a flat array.
+		Compression compression;
 
 		Channel() :
 				data(NULL),
-				defval(0) {}
+				defval(0),
+				format(FORMAT_U8),
+				compression(COMPRESSION_UNIFORM) {}
 	};
 
 	// Each channel can store arbitary data.
@@ -144,8 +315,16 @@ private:
 
 	// How many voxels are there in the three directions. All populated channels have the same size.
 	Vector3i _size;
+
+	// Whether channels get stored as bricks
+	bool _bricked = false;
+
+	// Accumulated by write operations, so users of the buffer can process only what changed
+	Rect3i _modified_box;
 };
 
 VARIANT_ENUM_CAST(VoxelBuffer::ChannelId)
+VARIANT_ENUM_CAST(VoxelBuffer::Compression)
+VARIANT_ENUM_CAST(VoxelBuffer::ChannelFormat)
 
 #endif // VOXEL_BUFFER_H
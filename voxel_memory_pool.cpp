@@ -0,0 +1,163 @@
+#include "voxel_memory_pool.h"
+#include <core/array.h>
+#include <core/print_string.h>
+
+namespace {
+VoxelMemoryPool *g_memory_pool = nullptr;
+} // namespace
+
+void VoxelMemoryPool::create_singleton() {
+	CRASH_COND(g_memory_pool != nullptr);
+	g_memory_pool = memnew(VoxelMemoryPool);
+}
+
+void VoxelMemoryPool::destroy_singleton() {
+	CRASH_COND(g_memory_pool == nullptr);
+	VoxelMemoryPool *pool = g_memory_pool;
+	g_memory_pool = nullptr;
+	memdelete(pool);
+}
+
+VoxelMemoryPool *VoxelMemoryPool::get_singleton() {
+	return g_memory_pool;
+}
+
+VoxelMemoryPool::VoxelMemoryPool() {
+	_mutex = Mutex::create();
+}
+
+VoxelMemoryPool::~VoxelMemoryPool() {
+	clear();
+	memdelete(_mutex);
+}
+
+uint8_t *VoxelMemoryPool::allocate(uint32_t size) {
+	if (size > MAX_POOLED_BLOCK_SIZE) {
+		return (uint8_t *)memalloc(size);
+	}
+
+	Pool *pool = get_or_create_pool(size);
+
+	uint8_t *block = nullptr;
+	{
+		MutexLock lock(pool->mutex);
+		if (pool->blocks.size() > 0) {
+			block = pool->blocks.back();
+			pool->blocks.pop_back();
+			atomic_sub(&_free_bytes, size);
+		}
+		++pool->used_blocks;
+	}
+
+	if (block == nullptr) {
+		block = (uint8_t *)memalloc(size);
+	}
+	return block;
+}
+
+void VoxelMemoryPool::recycle(uint8_t *block, uint32_t size) {
+	ERR_FAIL_COND(block == nullptr);
+
+	if (size > MAX_POOLED_BLOCK_SIZE) {
+		memfree(block);
+		return;
+	}
+
+	Pool *pool = get_or_create_pool(size);
+
+	{
+		MutexLock lock(pool->mutex);
+		--pool->used_blocks;
+		if (atomic_add(&_free_bytes, size) <= MAX_FREE_BYTES) {
+			pool->blocks.push_back(block);
+			return;
+		}
+		atomic_sub(&_free_bytes, size);
+	}
+
+	memfree(block);
+}
+
+void VoxelMemoryPool::clear_unused_blocks() {
+	MutexLock lock(_mutex);
+	const uint32_t *key = nullptr;
+	while ((key = _pools.next(key))) {
+		Pool *pool = _pools.get(*key);
+		MutexLock pool_lock(pool->mutex);
+		for (size_t i = 0; i < pool->blocks.size(); ++i) {
+			memfree(pool->blocks[i]);
+		}
+		atomic_sub(&_free_bytes, (uint64_t)pool->blocks.size() * (*key));
+		pool->blocks.clear();
+	}
+}
+
+void VoxelMemoryPool::clear() {
+	const uint32_t *key = nullptr;
+	while ((key = _pools.next(key))) {
+		Pool *pool = _pools.get(*key);
+		if (pool->used_blocks > 0) {
+			// Blocks still in use will be freed without the pool
+			WARN_PRINT(String("VoxelMemoryPool: {0} blocks of size {1} still in use").format(varray(pool->used_blocks, *key)));
+		}
+		for (size_t i = 0; i < pool->blocks.size(); ++i) {
+			memfree(pool->blocks[i]);
+		}
+		memdelete(pool->mutex);
+		memdelete(pool);
+	}
+	_pools.clear();
+	_free_bytes = 0;
+}
+
+VoxelMemoryPool::Pool *VoxelMemoryPool::get_or_create_pool(uint32_t size) {
+	MutexLock lock(_mutex);
+	Pool **ppool = _pools.getptr(size);
+	Pool *pool;
+	if (ppool == nullptr) {
+		pool = memnew(Pool);
+		pool->mutex = Mutex::create();
+		_pools.set(size, pool);
+	} else {
+		pool = *ppool;
+	}
+	CRASH_COND(pool == nullptr);
+	return pool;
+}
+
+Dictionary VoxelMemoryPool::get_stats() const {
+	MutexLock lock(_mutex);
+
+	Array pools;
+	uint64_t total_used_bytes = 0;
+	uint64_t total_free_bytes = 0;
+
+	const uint32_t *key = nullptr;
+	while ((key = _pools.next(key))) {
+		const uint32_t block_size = *key;
+		Pool *pool = _pools.get(block_size);
+
+		unsigned int used_blocks;
+		unsigned int free_blocks;
+		{
+			MutexLock pool_lock(pool->mutex);
+			used_blocks = pool->used_blocks;
+			free_blocks = pool->blocks.size();
+		}
+
+		Dictionary d;
+		d["block_size"] = block_size;
+		d["used_blocks"] = used_blocks;
+		d["free_blocks"] = free_blocks;
+		pools.append(d);
+
+		total_used_bytes += (uint64_t)used_blocks * block_size;
+		total_free_bytes += (uint64_t)free_blocks * block_size;
+	}
+
+	Dictionary d;
+	d["pools"] = pools;
+	d["total_used_bytes"] = total_used_bytes;
+	d["total_free_bytes"] = total_free_bytes;
+	return d;
+}
@@ -0,0 +1,61 @@
+#ifndef VOXEL_MEMORY_POOL_H
+#define VOXEL_MEMORY_POOL_H
+
+#include <core/dictionary.h>
+#include <core/hash_map.h>
+#include <core/os/mutex.h>
+#include <core/safe_refcount.h>
+#include <vector>
+
+// Pool of memory blocks, for allocations which often have the same size.
+// Voxel buffers allocate their channels with only a few different sizes (block size, with or without padding...),
+// and are created and destroyed frequently as terrain streams in and out. Instead of going back to the general
+// allocator, freed blocks are kept around and reused for allocations of the same size.
+// This class is thread-safe.
+class VoxelMemoryPool {
+private:
+	struct Pool {
+		Mutex *mutex = nullptr;
+		// Blocks available for reuse
+		std::vector<uint8_t *> blocks;
+		// How many blocks were given out and not recycled yet
+		unsigned int used_blocks = 0;
+	};
+
+public:
+	// Terrain blocks are at most 32x32x32 voxels of 32 bits, plus a header.
+	// Bigger allocations are rare, like buffers created by scripts, and go straight to the general allocator.
+	static const uint32_t MAX_POOLED_BLOCK_SIZE = 256 * 1024;
+	// Free blocks beyond this amount of bytes, all sizes included, are given back to the general allocator,
+	// so memory used at peak is not kept forever
+	static const uint64_t MAX_FREE_BYTES = 64 * 1024 * 1024;
+
+	static void create_singleton();
+	static void destroy_singleton();
+	static VoxelMemoryPool *get_singleton();
+
+	VoxelMemoryPool();
+	~VoxelMemoryPool();
+
+	uint8_t *allocate(uint32_t size);
+	// The block must have been obtained with `allocate`, with the same size
+	void recycle(uint8_t *block, uint32_t size);
+
+	// Frees blocks that are not in use.
+	// Called when a map is cleared, since its blocks are unlikely to be reallocated soon.
+	void clear_unused_blocks();
+
+	Dictionary get_stats() const;
+
+private:
+	Pool *get_or_create_pool(uint32_t size);
+	void clear();
+
+	HashMap<uint32_t, Pool *> _pools;
+	// Protects the map of pools, not their contents
+	Mutex *_mutex = nullptr;
+	// Bytes of free blocks in all pools, updated atomically
+	uint64_t _free_bytes = 0;
+};
+
+#endif // VOXEL_MEMORY_POOL_H